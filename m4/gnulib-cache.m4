@@ -42,6 +42,7 @@
 #  configmake \
 #  crypto/md5 \
 #  crypto/sha1 \
+#  crypto/sha256 \
 #  environ \
 #  filemode \
 #  fnmatch \
@@ -87,6 +88,7 @@ gl_MODULES([
   configmake
   crypto/md5
   crypto/sha1
+  crypto/sha256
   environ
   filemode
   fnmatch
@@ -0,0 +1,287 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "Checksum.h"
+#include "SignalHook.h"
+
+static const char *const algo_names[]={"MD5","SHA-1","SHA-256","CRC32",0};
+
+const char *Checksum::AlgoName(algo_t a)
+{
+   if(a==NONE)
+      return 0;
+   return algo_names[a];
+}
+
+Checksum::algo_t Checksum::FindAlgo(const char *name)
+{
+   if(!name)
+      return NONE;
+   for(int i=0; algo_names[i]; i++)
+      if(!strcasecmp(name,algo_names[i]))
+	 return algo_t(i);
+   return NONE;
+}
+
+static bool in_list(const char *name,int len,const char *list)
+{
+   while(list && *list)
+   {
+      list+=strspn(list,",; ");
+      int l=strcspn(list,",;");
+      if(l==len && !strncasecmp(name,list,len))
+	 return true;
+      list+=l;
+   }
+   return false;
+}
+
+const char *Checksum::Choose(const char *list,const char *supported)
+{
+   while(list && *list)
+   {
+      list+=strspn(list,",; ");
+      int len=strcspn(list,",;");
+      if(len>0 && in_list(list,len,supported))
+	 return xstring::get_tmp().nset(list,len);
+      list+=len;
+   }
+   return 0;
+}
+
+Checksum::Checksum(algo_t a) : algo(a)
+{
+   switch(algo)
+   {
+   case MD5:
+      md5_init_ctx(&ctx.md5);
+      break;
+   case SHA1:
+      sha1_init_ctx(&ctx.sha1);
+      break;
+   case SHA256:
+      sha256_init_ctx(&ctx.sha256);
+      break;
+   case CRC32:
+      ctx.crc32=0xFFFFFFFF;
+      break;
+   case NONE:
+      break;
+   }
+}
+
+static unsigned crc32_update(unsigned crc,const char *buf,size_t len)
+{
+   static unsigned table[256];
+   if(!table[1])
+   {
+      for(unsigned n=0; n<256; n++)
+      {
+	 unsigned c=n;
+	 for(int k=0; k<8; k++)
+	    c=(c&1)?0xEDB88320^(c>>1):(c>>1);
+	 table[n]=c;
+      }
+   }
+   while(len-->0)
+      crc=table[(crc^(unsigned char)*buf++)&0xFF]^(crc>>8);
+   return crc;
+}
+
+void Checksum::Update(const char *buf,size_t len)
+{
+   switch(algo)
+   {
+   case MD5:
+      md5_process_bytes(buf,len,&ctx.md5);
+      break;
+   case SHA1:
+      sha1_process_bytes(buf,len,&ctx.sha1);
+      break;
+   case SHA256:
+      sha256_process_bytes(buf,len,&ctx.sha256);
+      break;
+   case CRC32:
+      ctx.crc32=crc32_update(ctx.crc32,buf,len);
+      break;
+   case NONE:
+      break;
+   }
+}
+
+void Checksum::Finish(xstring& hex)
+{
+   hex.truncate();
+   xstring digest;
+   switch(algo)
+   {
+   case MD5:
+      digest.get_space(MD5_DIGEST_SIZE);
+      md5_finish_ctx(&ctx.md5,digest.get_non_const());
+      digest.set_length(MD5_DIGEST_SIZE);
+      break;
+   case SHA1:
+      digest.get_space(SHA1_DIGEST_SIZE);
+      sha1_finish_ctx(&ctx.sha1,digest.get_non_const());
+      digest.set_length(SHA1_DIGEST_SIZE);
+      break;
+   case SHA256:
+      digest.get_space(SHA256_DIGEST_SIZE);
+      sha256_finish_ctx(&ctx.sha256,digest.get_non_const());
+      digest.set_length(SHA256_DIGEST_SIZE);
+      break;
+   case CRC32:
+      hex.appendf("%08x",ctx.crc32^0xFFFFFFFF);
+      return;
+   case NONE:
+      return;
+   }
+   digest.hexdump_to(hex);
+   hex.c_lc();
+}
+
+ChecksumFile::ChecksumFile(const char *f,Checksum::algo_t a)
+   : file(f), algo(a), done(false)
+{
+}
+ChecksumFile::~ChecksumFile()
+{
+   if(w && w->GetState()==w->RUNNING)
+   {
+      w->Kill(SIGKILL);
+      w.borrow()->Auto();
+   }
+}
+
+// runs in the child, the result is "H<hex>" or "E<error>".
+void ChecksumFile::Calculate(const char *file,Checksum::algo_t a,xstring& out)
+{
+   int fd=open(file,O_RDONLY);
+   if(fd==-1)
+   {
+      out.vset("E",file,": ",strerror(errno),NULL);
+      return;
+   }
+   Checksum sum(a);
+   char buf[0x10000];
+   for(;;)
+   {
+      int res=read(fd,buf,sizeof(buf));
+      if(res==-1 && errno==EINTR)
+	 continue;
+      if(res==-1)
+      {
+	 out.vset("Eread(",file,"): ",strerror(errno),NULL);
+	 close(fd);
+	 return;
+      }
+      if(res==0)
+	 break;
+      sum.Update(buf,res);
+   }
+   close(fd);
+   xstring hex;
+   sum.Finish(hex);
+   out.vset("H",hex.get(),NULL);
+}
+
+int ChecksumFile::Do()
+{
+   if(done)
+      return STALL;
+   int m=STALL;
+   if(!w)
+   {
+      int p[2];
+      if(pipe(p)==-1)
+      {
+	 if(NonFatalError(errno))
+	 {
+	    TimeoutS(1);
+	    return m;
+	 }
+	 error_text.vset("pipe(): ",strerror(errno),NULL);
+	 done=true;
+	 return MOVED;
+      }
+      pid_t proc=fork();
+      if(proc==-1)
+      {
+	 close(p[0]);
+	 close(p[1]);
+	 TimeoutS(1);
+	 return m;
+      }
+      if(proc==0)
+      {	 // child
+	 SignalHook::Ignore(SIGINT);
+	 SignalHook::Ignore(SIGTSTP);
+	 SignalHook::Ignore(SIGQUIT);
+	 SignalHook::Ignore(SIGHUP);
+	 close(p[0]);
+	 xstring out;
+	 Calculate(file,algo,out);
+	 const char *s=out;
+	 int left=out.length();
+	 while(left>0)
+	 {
+	    int res=write(p[1],s,left);
+	    if(res==-1 && errno==EINTR)
+	       continue;
+	    if(res<=0)
+	       break;
+	    s+=res;
+	    left-=res;
+	 }
+	 _exit(0);
+      }
+      // parent
+      close(p[1]);
+      fcntl(p[0],F_SETFL,O_NONBLOCK);
+      fcntl(p[0],F_SETFD,FD_CLOEXEC);
+      buf=new IOBufferFDStream(new FDStream(p[0],"<pipe-in>"),IOBuffer::GET);
+      w=new ProcWait(proc);
+      m=MOVED;
+   }
+   if(buf->Error())
+   {
+      error_text.set(buf->ErrorText());
+      done=true;
+      return MOVED;
+   }
+   if(!buf->Eof())
+      return m;
+   const char *s;
+   int n;
+   buf->Get(&s,&n);
+   if(n>1 && s[0]=='H')
+      hex.nset(s+1,n-1);
+   else if(n>1 && s[0]=='E')
+      error_text.nset(s+1,n-1);
+   else
+      error_text.vset(file.get(),": checksum process failed",NULL);
+   done=true;
+   return MOVED;
+}
@@ -0,0 +1,89 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "xstring.h"
+#include "SMTask.h"
+#include "ProcWait.h"
+#include "buffer.h"
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+
+/* File digest calculation, the algorithms are named as in the FTP HASH
+   command (draft-bryan-ftpext-hash): MD5, SHA-1, SHA-256 and CRC32. */
+class Checksum
+{
+public:
+   enum algo_t { NONE=-1, MD5, SHA1, SHA256, CRC32 };
+
+private:
+   algo_t algo;
+   union {
+      struct md5_ctx md5;
+      struct sha1_ctx sha1;
+      struct sha256_ctx sha256;
+      unsigned crc32;
+   } ctx;
+
+public:
+   Checksum(algo_t a);
+   void Update(const char *buf,size_t len);
+   void Finish(xstring& hex);	  // lower case hex digest
+
+   algo_t GetAlgo() const { return algo; }
+   const char *GetAlgoName() const { return AlgoName(algo); }
+
+   static const char *Supported() { return "SHA-256;SHA-1;MD5;CRC32"; }
+   static algo_t FindAlgo(const char *name);
+   static const char *AlgoName(algo_t a);
+   // returns first algorithm from the preference list which is also in
+   // the supported list, both lists are separated with `,' or `;'.
+   static const char *Choose(const char *list,const char *supported);
+};
+
+/* Calculates the digest of a local file in a child process, so that
+   several files are hashed at once on all CPUs while lftp goes on. */
+class ChecksumFile : public SMTask
+{
+   xstring_c file;
+   Checksum::algo_t algo;
+   SMTaskRef<ProcWait> w;
+   SMTaskRef<IOBuffer> buf;
+   xstring hex;
+   xstring error_text;
+   bool done;
+
+   static void Calculate(const char *file,Checksum::algo_t a,xstring& out);
+
+public:
+   ChecksumFile(const char *f,Checksum::algo_t a);
+   ~ChecksumFile();
+   int Do();
+
+   bool Done() const { return done; }
+   bool Error() const { return error_text; }
+   const char *ErrorText() const { return error_text; }
+   const char *GetHex() const { return hex; }
+   const char *GetAlgoName() const { return Checksum::AlgoName(algo); }
+};
+
+#endif//CHECKSUM_H
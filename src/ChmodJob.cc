@@ -70,10 +70,10 @@ int ChmodJob::GetMode(const FileInfo *fi) const
    return -1;
 }
 
-void ChmodJob::CurrentFinished(const char *d,const FileInfo *fi)
+void ChmodJob::CurrentFinished(const char *d,const FileInfo *fi,int res)
 {
    const char *fmt;
-   if(session->Done() < 0)
+   if(res < 0)
    {
       if(quiet)
 	 return;
@@ -133,3 +133,11 @@ void ChmodJob::TreatCurrent(const char *d,const FileInfo *fi)
    if(new_mode!=-1)
       session->Chmod(fi->name,new_mode);
 }
+
+FA::open_mode ChmodJob::BatchMode(const FileInfo *fi,int *new_mode)
+{
+   *new_mode=GetMode(fi);
+   if(*new_mode==-1)
+      return FA::CLOSED;
+   return FA::CHANGE_MODE;
+}
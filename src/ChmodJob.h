@@ -33,7 +33,8 @@ public:
 
 private:
    void TreatCurrent(const char *d,const FileInfo *fi);
-   void CurrentFinished(const char *d,const FileInfo *fi);
+   void CurrentFinished(const char *d,const FileInfo *fi,int res);
+   FA::open_mode BatchMode(const FileInfo *fi,int *new_mode);
 
    void Init();
    void Report(const char *d,const FileInfo *fi, bool success);
@@ -0,0 +1,132 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <config.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+#include "DirWatch.h"
+#include "log.h"
+
+DirWatch::DirWatch()
+   : fd(-1), delay("mirror:watch-delay",0), overflow(false)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+   fd=inotify_init();
+   if(fd==-1)
+   {
+      error_text.setf("inotify_init: %s",strerror(errno));
+      return;
+   }
+   fcntl(fd,F_SETFD,FD_CLOEXEC);
+   fcntl(fd,F_SETFL,O_NONBLOCK);
+#else
+   error_text.set(_("watching directories is not supported on this system"));
+#endif
+}
+
+DirWatch::~DirWatch()
+{
+   if(fd!=-1)
+      close(fd);
+}
+
+bool DirWatch::Add(const char *path,const char *dir)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+   if(fd==-1)
+      return false;
+   int wd=inotify_add_watch(fd,path,IN_ONLYDIR|IN_MODIFY|IN_ATTRIB
+      |IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO);
+   if(wd==-1)
+   {
+      Log::global->Format(1,"inotify_add_watch(%s): %s\n",path,strerror(errno));
+      return false;
+   }
+   // the same directory gets the same descriptor on repeated passes.
+   dirs.add(xstring::format("%d",wd),new xstring(dir?dir:""));
+   return true;
+#else
+   return false;
+#endif
+}
+
+int DirWatch::Do()
+{
+#ifdef HAVE_SYS_INOTIFY_H
+   if(fd==-1)
+      return STALL;
+   union {
+      struct inotify_event ev;
+      char buf[0x4000];
+   } u;
+   int res=read(fd,u.buf,sizeof(u.buf));
+   if(res==-1)
+   {
+      if(E_RETRY(errno))
+      {
+	 Block(fd,POLLIN);
+	 return STALL;
+      }
+      error_text.setf("read(inotify): %s",strerror(errno));
+      close(fd);
+      fd=-1;
+      return MOVED;
+   }
+   for(int i=0; i<res; )
+   {
+      const struct inotify_event *ev=(const struct inotify_event*)(u.buf+i);
+      i+=sizeof(*ev)+ev->len;
+      if(ev->mask&IN_Q_OVERFLOW)
+      {
+	 overflow=true;
+	 continue;
+      }
+      const xstring& key=xstring::format("%d",ev->wd);
+      const xstring *dir=dirs.lookup(key);
+      if(!dir)
+	 continue;
+      if(ev->mask&IN_IGNORED)
+      {
+	 // the directory was removed or unmounted.
+	 dirs.remove(key);
+	 continue;
+      }
+      changed.add(*dir,true);
+   }
+   // more events are likely to follow, wait for them to settle.
+   delay.Reset();
+   return MOVED;
+#else
+   return STALL;
+#endif
+}
+
+void DirWatch::TakeChanges(StringSet& set)
+{
+   set.Empty();
+   // all the values are true.
+   for(bool c=changed.each_begin(); c; c=changed.each_next())
+      set.Append(changed.each_key());
+   changed.empty();
+}
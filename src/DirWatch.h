@@ -0,0 +1,61 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DIRWATCH_H
+#define DIRWATCH_H
+
+#include "SMTask.h"
+#include "StringSet.h"
+#include "Timer.h"
+#include "xmap.h"
+
+/* Watches local directories and collects names of the directories where
+ * something was changed. The changes are ready to be taken when no new
+ * events come for mirror:watch-delay. Only inotify is supported now. */
+class DirWatch : public SMTask
+{
+   int fd;
+   xmap_p<xstring> dirs;  // watch descriptor -> directory name
+   xmap<bool> changed;
+   Timer delay;
+   bool overflow;	  // some events were lost
+   xstring error_text;
+
+   int Do();
+
+protected:
+   ~DirWatch();
+
+public:
+   DirWatch();
+
+   bool Error() const { return error_text!=0; }
+   const char *ErrorText() const { return error_text; }
+
+   // watch directory at path, reporting its changes as dir.
+   bool Add(const char *path,const char *dir);
+
+   bool Overflow() const { return overflow; }
+   bool HasChanges() const { return changed.count()>0 && delay.Stopped(); }
+   void TakeChanges(StringSet& set);
+   void Forget() { changed.empty(); overflow=false; }
+};
+
+#endif//DIRWATCH_H
@@ -39,6 +39,7 @@
 #include "ConnectionSlot.h"
 #include "SignalHook.h"
 #include "FileGlob.h"
+#include "Checksum.h"
 #ifdef WITH_MODULES
 # include "module.h"
 #endif
@@ -63,6 +64,8 @@ void FileAccess::Init()
    opt_date=0;
    opt_size=0;
    fileset_for_info=0;
+   fileset_for_batch=0;
+   batch_mode=CLOSED;
    error_code=OK;
    saved_errno=0;
    mkdir_p=false;
@@ -72,6 +75,7 @@ void FileAccess::Init()
 
    entity_size=NO_SIZE;
    entity_date=NO_DATE;
+   block_size=0;
 
    res_prefix=0;
 
@@ -194,9 +198,11 @@ void FileAccess::Close()
    opt_date=0;
    opt_size=0;
    fileset_for_info=0;
+   fileset_for_batch=0;
    retries=0;
    entity_size=NO_SIZE;
    entity_date=NO_DATE;
+   block_size=0;
    ascii=false;
    norest_manual=false;
    location.set(0);
@@ -364,6 +370,50 @@ void FileAccess::GetInfoArray(FileSet *info)
    fileset_for_info->rewind();
 }
 
+const char *FileAccess::ChecksumAlgoList() const
+{
+   if(checksum_algo)
+      return checksum_algo;
+   return "SHA-256,SHA-1,MD5,CRC32";
+}
+
+const char *FileAccess::ChooseChecksumAlgo(const char *supported) const
+{
+   return Checksum::Choose(ChecksumAlgoList(),supported);
+}
+
+void FileAccess::Batch(FileSet *set,open_mode m)
+{
+   Open(0,BATCH);
+   fileset_for_batch=set;
+   fileset_for_batch->rewind();
+   batch_mode=m;
+   batch_res.truncate();
+   batch_err.Empty();
+   for(int i=0; i<set->count(); i++)
+   {
+      batch_res.append(IN_PROGRESS);
+      batch_err.Append("");
+      if(m==LONG_LIST)
+	 continue;   // the cache entries are replaced when the listings come
+      if(m==RETRIEVE)
+	 continue;
+
+      const char *f=(*set)[i]->name;
+      cache->FileChanged(this,f);
+      if(m==REMOVE_DIR)
+	 cache->TreeChanged(this,f);
+   }
+}
+
+void FileAccess::SetBatchResult(int i,int res,const char *err)
+{
+   if(batch_res[i]!=IN_PROGRESS)
+      return;
+   batch_res[i]=res;
+   batch_err.Replace(i,err?err:"");
+}
+
 static void expand_tilde(xstring &path, const char *home, int i=0)
 {
    if(!(path[i]=='~' && (path[i+1]==0 || path[i+1]=='/')))
@@ -895,6 +945,59 @@ void ListInfo::PrepareToDie()
 }
 ListInfo::~ListInfo() {}
 
+// ListPrefetch implementation
+ListPrefetch::ListPrefetch(const FileAccessRef& s,FileSet *d)
+   : FileAccessOperation(s.get_non_const()), dirs(d), next(0)
+{
+}
+
+int ListPrefetch::Do()
+{
+   if(done)
+      return STALL;
+   if(batch)
+   {
+      int res=session->Done();
+      if(res==FA::IN_PROGRESS)
+	 return STALL;
+      for(int i=0; i<batch->count(); i++)
+      {
+	 if(session->GetBatchResult(i)==FA::OK)
+	    fetched.Append((*batch)[i]->name);
+      }
+      session->Close();
+      batch=0;
+      if(res!=FA::OK)
+	 next=dirs->count();  // the listings are fetched the usual way then.
+   }
+   if(next>=dirs->count())
+   {
+      done=true;
+      return MOVED;
+   }
+   batch=new FileSet;
+   while(next<dirs->count() && batch->count()<BATCH_MAX)
+      batch->Add(new FileInfo(*(*dirs)[next++]));
+   session->Batch(batch.get_non_const(),FA::LONG_LIST);
+   return MOVED;
+}
+
+const char *ListPrefetch::Status()
+{
+   if(!batch)
+      return "";
+   return xstring::format("%s (%d/%d) [%s]",_("Getting directory contents"),
+		  fetched.Count(),dirs->count(),session->CurrentStatus());
+}
+
+bool ListPrefetch::Fetched(const char *dir) const
+{
+   for(int i=0; i<fetched.Count(); i++)
+      if(!strcmp(fetched[i],dir))
+	 return true;
+   return false;
+}
+
 
 // Path implementation
 void FileAccess::Path::init()
@@ -68,6 +68,9 @@ public:
       CHANGE_MODE,
       LINK,
       SYMLINK,
+      BATCH,
+      COPY,
+      BLOCK_SUMS,
    };
 
    class Path
@@ -128,6 +131,16 @@ protected:
    off_t  *opt_size;
 
    FileSet *fileset_for_info;
+   xstring_c checksum_algo;
+   const char *ChecksumAlgoList() const;
+   const char *ChooseChecksumAlgo(const char *supported) const;
+
+   // bulk operation state, see Batch().
+   FileSet *fileset_for_batch;
+   open_mode batch_mode;
+   xarray<int> batch_res;
+   StringSet batch_err;
+   void SetBatchResult(int i,int res,const char *err=0);
 
    Timer reconnect_timer;
    int retries;
@@ -150,6 +163,7 @@ protected:
 
    off_t  entity_size; // size of file to be sent
    time_t entity_date; // date of file to be sent
+   int    block_size;  // block size for BLOCK_SUMS and patching STORE
 
    xstring_c closure;
    const char *res_prefix;
@@ -229,6 +243,7 @@ public:
    void SetLimit(off_t lim) { limit=lim; }
    void SetSize(off_t s) { entity_size=s; }
    void SetDate(time_t d) { entity_date=d; }
+   void SetBlockSize(int bs) { block_size=bs; }
    void WantDate(FileTimestamp *d) { opt_date=d; }
    void WantSize(off_t *s) { opt_size=s; }
    void AsciiTransfer() { ascii=true; }
@@ -247,6 +262,44 @@ public:
 
    void	 GetInfoArray(FileSet *info);
    int	 InfoArrayPercentDone() { return fileset_for_info->curr_pct(); }
+   /* FileInfo::CHECKSUM can be requested with GetInfoArray; the first
+    * algorithm of the list which the server supports is used. */
+   virtual bool ChecksumSupported() const { return false; }
+   void	 SetChecksumAlgo(const char *list) { checksum_algo.set(list); }
+
+   /* Bulk metadata operations: each file of the set is treated with the
+    * mode (REMOVE, REMOVE_DIR, MAKE_DIR or CHANGE_MODE, which takes the
+    * new mode from FileInfo::mode). The requests are sent without waiting
+    * for each reply. Done() is OK when all replies have come, the result
+    * for every file is available with GetBatchResult and GetBatchError.
+    * With LONG_LIST the listings of the directories of the set are fetched
+    * into the listing cache, so that ListInfo for them can be answered
+    * from there; OK means that the listing has been cached.
+    * RETRIEVE and STORE copy the files one after another in one stream:
+    * Read and Write work on the file returned by GetBatchFile (-1 when
+    * there is none at the moment), Read never returns data of two files
+    * at once. STORE takes the sizes from the set, an empty file is sent
+    * with a zero size Write; SkipBatchFile gives up the current file if
+    * no data of it has been written yet.
+    * Should only be used if BatchSupported returns true for the mode. */
+   virtual bool BatchSupported(open_mode m) const { return false; }
+   void	 Batch(FileSet *set,open_mode m);
+   int	 GetBatchResult(int i) const { return batch_res[i]; }
+   const char *GetBatchError(int i) const { return batch_err[i][0]?batch_err[i]:0; }
+   virtual int GetBatchFile() const { return -1; }
+   virtual void SkipBatchFile() {}
+
+   /* STORE at a non-zero position writes into the existing file without
+    * truncating it, and the size is only set by the part reaching the
+    * entity size, so several sessions can upload parts of one file. */
+   virtual bool ParallelStoreSupported() const { return false; }
+
+   /* BLOCK_SUMS reads hex MD5 sums of the file blocks of block_size bytes,
+    * one line per block. STORE with a block size set updates the existing
+    * file in place: only the blocks announced with PatchBlock before their
+    * data are written, and the file is cut to the entity size at the end. */
+   virtual bool BlockSumsSupported() const { return false; }
+   virtual void PatchBlock(off_t n) {}
 
    virtual const char *CurrentStatus();
 
@@ -503,6 +556,9 @@ public:
 
    // caller has to delete the resulting FileSet itself.
    FileSet *GetResult() { return result.borrow(); }
+   // the entries which are complete before the whole listing is; they are
+   // not in the result then. Returns 0 when there are no such entries.
+   virtual FileSet *TakePartial() { return 0; }
    FileSet *GetExcluded() { return excluded.borrow(); }
    bool IsRecursive() const { return is_recursive; }
 
@@ -511,6 +567,27 @@ public:
    void FollowSymlinks() { follow_symlinks=true; }
 };
 
+// Fetches the listings of many directories into the listing cache with
+// LONG_LIST batches, the names are relative to the session cwd.
+class ListPrefetch : public FileAccessOperation
+{
+   Ref<FileSet> dirs;
+   Ref<FileSet> batch;
+   int next;
+   StringSet fetched;
+
+public:
+   enum { BATCH_MAX=64 };
+
+   ListPrefetch(const FileAccessRef& session,FileSet *dirs);
+
+   int Do();
+   const char *Status();
+
+   // true if the listing of the directory is in the cache now.
+   bool Fetched(const char *dir) const;
+};
+
 #include "buffer.h"
 class LsOptions
 {
@@ -45,6 +45,8 @@
 #include "LsCache.h"
 #include "plural.h"
 #include "ArgV.h"
+#include "Checksum.h"
+#include "ascii_ctype.h"
 
 #define skip_threshold 0x1000
 
@@ -1410,6 +1412,15 @@ FileCopyPeer *FileCopyPeerFA::Clone()
 {
    FileCopyPeerFA *c=new FileCopyPeerFA(session->Clone(),file,FAmode);
    c->orig_url.set(orig_url);
+   if(mode==PUT)
+   {
+      // the clone writes a part of the same (maybe temporary) file,
+      // this peer renames it when done.
+      c->file.set(file);
+      c->temp_file=false;
+      c->auto_rename=false;
+      c->suggested_filename.set(0);
+   }
    return c;
 }
 
@@ -1982,6 +1993,483 @@ int FileCopyPeerMemory::Do()
    return m;
 }
 
+// FileCopyTee
+FileCopyTee::FileCopyTee(FileCopyPeer *src)
+   : get(src), started(false), held(false)
+{
+   max_buf=buffer_size.Query(0);
+   if(max_buf<1)
+      max_buf=1;
+   get->SetMaxBuffered(max_buf);
+   get->WantSize();
+   get->WantDate();
+}
+FileCopyPeerTee *FileCopyTee::NewPeer()
+{
+   assert(!started);
+   FileCopyPeerTee *p=new FileCopyPeerTee(this);
+   peers.append(p);
+   return p;
+}
+void FileCopyTee::Start()
+{
+   started=true;
+   get->Resume();
+}
+void FileCopyTee::Release()
+{
+   held=false;
+   if(peers.count()==0)
+      Delete(this);
+}
+void FileCopyTee::Detach(FileCopyPeerTee *p)
+{
+   int i=peers.search(p);
+   if(i>=0)
+      peers.remove(i);
+   if(peers.count()==0 && !held)
+      Delete(this);
+   else
+      Trim();
+}
+void FileCopyTee::Trim()
+{
+   // drop the data already taken by all the peers.
+   off_t min_pos=data.GetPos()+data.Size();
+   for(int i=0; i<peers.count(); i++)
+      if(min_pos>peers[i]->tee_pos)
+	 min_pos=peers[i]->tee_pos;
+   data.Skip(min_pos-data.GetPos());
+}
+void FileCopyTee::PrepareToDie()
+{
+   for(int i=0; i<peers.count(); i++)
+      peers[i]->tee=0;
+   peers.truncate();
+   get=0;
+}
+int FileCopyTee::Do()
+{
+   if(!started || Error() || data.Eof())
+      return STALL;
+   if(get->Error())
+   {
+      error_text.set(get->ErrorText());
+      return MOVED;
+   }
+   if(data.Size()>=max_buf)
+   {
+      get->Suspend(); // wait for the slowest peer.
+      return STALL;
+   }
+   get->Resume();
+
+   const char *b;
+   int s;
+   get->Get(&b,&s);
+   if(b==0) // eof
+   {
+      data.PutEOF();
+      return MOVED;
+   }
+   if(s==0)
+      return STALL;
+   data.Append(b,s);
+   get->Skip(s);
+   return MOVED;
+}
+
+// FileCopyPeerTee
+FileCopyPeerTee::FileCopyPeerTee(FileCopyTee *t)
+   : FileCopyPeer(GET), tee(t), tee_pos(0)
+{
+}
+void FileCopyPeerTee::PrepareToDie()
+{
+   if(tee)
+      tee->Detach(this);
+   tee=0;
+   own=0;
+}
+void FileCopyPeerTee::Seek(off_t new_pos)
+{
+   FileCopyPeer::Seek(new_pos);
+   if(!own && tee && new_pos!=FILE_END
+   && new_pos>=tee->data.GetPos() && new_pos<=tee->data.GetPos()+tee->data.Size())
+   {
+      tee_pos=new_pos;
+      pos=new_pos;
+      tee->Trim();
+      return;
+   }
+   if(!own && tee)
+   {
+      // the data has been dropped already, read the file separately.
+      own=tee->get->Clone();
+      tee->Detach(this);
+      tee=0;
+   }
+   if(!own)
+      return;
+   own->Seek(new_pos);
+   if(new_pos!=FILE_END)
+      pos=new_pos;
+}
+int FileCopyPeerTee::Do()
+{
+   if(Done())
+      return STALL;
+   if(!tee && !own)
+   {
+      SetError(_("data source has been closed"));
+      return MOVED;
+   }
+   int m=STALL;
+   const SMTaskRef<FileCopyPeer>& src=(own?own:tee->get);
+   if(want_size && size==NO_SIZE_YET && src->GetSize()!=NO_SIZE_YET)
+   {
+      size=src->GetSize();
+      m=MOVED;
+   }
+   if(want_date && date==NO_DATE_YET && src->GetDate()!=NO_DATE_YET)
+   {
+      SetDate(src->GetDate());
+      m=MOVED;
+   }
+   if(own)
+   {
+      if(own->Error())
+      {
+	 SetError(own->ErrorText());
+	 return MOVED;
+      }
+      if(!start_transfer || eof)
+	 return m;
+      const char *b;
+      int s;
+      own->Get(&b,&s);
+      if(b==0) // eof
+      {
+	 eof=true;
+	 return MOVED;
+      }
+      if(max_buf && s>max_buf-Size())
+	 s=max_buf-Size();
+      if(s<=0)
+	 return m;
+      memcpy(GetSpace(s),b,s);
+      SpaceAdd(s);
+      own->Skip(s);
+      return MOVED;
+   }
+   if(tee->Error())
+   {
+      SetError(tee->ErrorText());
+      return MOVED;
+   }
+   if(!start_transfer || eof)
+      return m;
+
+   const Buffer& data=tee->data;
+   off_t avail=data.GetPos()+data.Size()-tee_pos;
+   if(avail<=0)
+   {
+      if(data.Eof())
+      {
+	 eof=true;
+	 return MOVED;
+      }
+      return m;
+   }
+   int s=avail;
+   if(max_buf)
+   {
+      if(Size()>=max_buf)
+	 return m;
+      if(s>max_buf-Size())
+	 s=max_buf-Size();
+   }
+   memcpy(GetSpace(s),data.Get()+(tee_pos-data.GetPos()),s);
+   SpaceAdd(s);
+   tee_pos+=s;
+   tee->Trim();
+   return MOVED;
+}
+
+// FileCopyBulk
+FileCopyBulk::FileCopyBulk(FileAccess *s,FA::open_mode m)
+   : session(s), mode(m), files(new FileSet), active(0), pending_file(-1),
+     started(false), finished(false), held(false)
+{
+   max_buf=buffer_size.Query(0);
+   if(max_buf<1)
+      max_buf=1;
+}
+void FileCopyBulk::Add(const FileInfo *fi)
+{
+   assert(!started);
+   FileInfo *n=new FileInfo(*fi);
+   n->SetRank(files->count());
+   files->Add(n);
+}
+void FileCopyBulk::Start()
+{
+   started=true;
+   files->Sort(FileSet::BYRANK);
+   for(int i=0; i<files->count(); i++)
+   {
+      peers.append(0);
+      unwanted.append(false);
+   }
+   if(files->count()>0)
+      session->Batch(files.get_non_const(),mode);
+   else
+      finished=true;
+}
+int FileCopyBulk::FindFile(const char *name) const
+{
+   const FileInfo *fi=files->FindByName(name);
+   return fi ? fi->GetRank() : -1;
+}
+int FileCopyBulk::Result(int i) const
+{
+   return finished ? result[i] : session->GetBatchResult(i);
+}
+const char *FileCopyBulk::ResultError(int i) const
+{
+   const char *e=(finished ? result_error[i] : session->GetBatchError(i));
+   return e && e[0] ? e : session->StrError(Result(i));
+}
+FileCopyPeerBulk *FileCopyBulk::NewPeer(const char *name)
+{
+   assert(started);
+   int i=FindFile(name);
+   if(i<0 || peers[i] || unwanted[i])
+      return 0;
+   FileCopyPeerBulk *p=new FileCopyPeerBulk(this,i);
+   peers[i]=p;
+   active++;
+   if(pending_file==i)
+   {
+      p->SpaceAdd(p->MoveDataHere(&pending,pending.Size()));
+      pending_file=-1;
+   }
+   return p;
+}
+void FileCopyBulk::Unwant(const char *name)
+{
+   int i=FindFile(name);
+   if(i<0 || peers[i])
+      return;
+   unwanted[i]=true;
+   if(pending_file==i)
+   {
+      pending.Empty();
+      pending_file=-1;
+   }
+}
+void FileCopyBulk::Release()
+{
+   held=false;
+   if(active==0)
+      Delete(this);
+}
+void FileCopyBulk::Detach(FileCopyPeerBulk *p)
+{
+   int i=p->index;
+   peers[i]=0;
+   active--;
+   if(Result(i)==FA::IN_PROGRESS)
+   {
+      // the rest of the file is not needed.
+      unwanted[i]=true;
+      if(mode==FA::STORE && !finished && session->GetBatchFile()==i)
+	 session->SkipBatchFile();
+   }
+   if(active==0 && !held)
+      Delete(this);
+}
+void FileCopyBulk::PrepareToDie()
+{
+   for(int i=0; i<peers.count(); i++)
+      if(peers[i])
+	 peers[i]->bulk=0;
+   peers.truncate();
+   session=0;
+}
+int FileCopyBulk::Do()
+{
+   if(!started || finished || Error())
+      return STALL;
+   int res=session->Done();
+   if(res==FA::OK)
+   {
+      for(int i=0; i<files->count(); i++)
+      {
+	 result.append(session->GetBatchResult(i));
+	 const char *e=session->GetBatchError(i);
+	 result_error.Append(e?e:"");
+      }
+      finished=true;
+      session->Close();
+      return MOVED;
+   }
+   if(res!=FA::IN_PROGRESS)
+   {
+      error_text.set(session->StrError(res));
+      return MOVED;
+   }
+   int i=session->GetBatchFile();
+   if(i<0)
+      return STALL;
+   if(mode==FA::STORE)
+   {
+      // the peers write by themselves.
+      if(!unwanted[i])
+	 return STALL;
+      session->SkipBatchFile();
+      return MOVED;
+   }
+
+   Buffer *to=peers[i];
+   if(!to)
+   {
+      if(pending_file!=i)
+      {
+	 if(pending_file!=-1 && pending.Size()>0)
+	    return STALL;  // the previous file waits for its peer.
+	 pending.Empty();
+	 pending_file=(unwanted[i] ? -1 : i);
+      }
+      to=&pending;
+   }
+   if(to->Size()>=max_buf)
+      return STALL;
+   res=session->Read(to,max_buf-to->Size());
+   if(res==FA::DO_AGAIN || res==0)
+      return STALL;
+   if(res<0)
+   {
+      error_text.set(session->StrError(res));
+      return MOVED;
+   }
+   to->SpaceAdd(res);
+   if(pending_file==-1 && to==&pending)
+      pending.Empty();	 // an unwanted file
+   return MOVED;
+}
+
+// FileCopyPeerBulk
+FileCopyPeerBulk::FileCopyPeerBulk(FileCopyBulk *b,int i)
+   : FileCopyPeer(b->mode==FA::STORE ? PUT : GET), bulk(b), index(i)
+{
+   can_seek=false;
+   can_seek0=false;
+}
+void FileCopyPeerBulk::PrepareToDie()
+{
+   if(bulk)
+      bulk->Detach(this);
+   bulk=0;
+}
+int FileCopyPeerBulk::Put_LL(const char *buf,int len)
+{
+   if(!bulk || !Current())
+      return 0;
+   // the size has been announced to the server, it cannot be exceeded.
+   off_t left=FileSize()-(pos-Size());
+   if(len>left)
+      len=left;
+   if(len<=0)
+      return 0;
+   int res=bulk->session->Write(buf,len);
+   if(res<0)
+   {
+      if(res==FA::DO_AGAIN)
+	 return 0;
+      SetError(bulk->session->StrError(res));
+      return -1;
+   }
+   return res;
+}
+int FileCopyPeerBulk::Do()
+{
+   if(Done())
+      return STALL;
+   if(!bulk)
+   {
+      SetError(_("data source has been closed"));
+      return MOVED;
+   }
+   int m=STALL;
+   const FileInfo *fi=(*bulk->files)[index];
+   if(want_size && size==NO_SIZE_YET)
+   {
+      size=(fi->Has(fi->SIZE) ? fi->size : NO_SIZE);
+      m=MOVED;
+   }
+   if(want_date && date==NO_DATE_YET)
+   {
+      if(fi->Has(fi->DATE))
+	 SetDate(fi->date);
+      else
+	 SetDate(NO_DATE);
+      m=MOVED;
+   }
+   if(bulk->Error())
+   {
+      SetError(bulk->ErrorText());
+      return MOVED;
+   }
+   int res=bulk->Result(index);
+   if(res!=FA::IN_PROGRESS && res!=FA::OK)
+   {
+      SetError(bulk->ResultError(index));
+      return MOVED;
+   }
+   if(mode==GET)
+   {
+      // the data have been put here by the bulk before the result.
+      if(res==FA::OK)
+      {
+	 eof=true;
+	 m=MOVED;
+      }
+      return m;
+   }
+
+   if(res==FA::OK)
+   {
+      if(eof && Size()==0)
+      {
+	 done=true;
+	 m=MOVED;
+      }
+      return m;
+   }
+   if(Size()>0)
+   {
+      if(IOBuffer::Do()==MOVED)
+	 m=MOVED;
+      if(Size()>0 && pos-Size()==FileSize() && !Current())
+      {
+	 SetError(_("file size increased during transfer"));
+	 return MOVED;
+      }
+   }
+   else if(eof && Current())
+   {
+      if(pos<FileSize())
+      {
+	 SetError(_("file size decreased during transfer"));
+	 return MOVED;
+      }
+      bulk->session->Write("",0);   // an empty file
+      m=MOVED;
+   }
+   return m;
+}
+
 // FileVerificator
 void FileVerificator::Init0()
 {
@@ -2076,5 +2564,186 @@ int FileVerificator::Do()
 }
 
 
+// FileCopyPeerDelta
+FileCopyPeerDelta::FileCopyPeerDelta(FileAccess *s,const char *f,off_t sz)
+   : FileCopyPeer(PUT), session(s), file(f), file_size(sz),
+     sums_done(false), block_no(0), block_sent(-1), blocks_sent(0)
+{
+   can_seek=false;
+   can_seek0=false;
+   // keep the number of sums moderate for huge files.
+   block_size=0x10000;
+   while(file_size/block_size>0x4000 && block_size<0x40000000)
+      block_size*=2;
+   session->Open(file,FA::BLOCK_SUMS);
+   session->SetBlockSize(block_size);
+}
+int FileCopyPeerDelta::BlockLen(off_t n) const
+{
+   off_t rest=file_size-n*block_size;
+   return rest<block_size ? rest : block_size;
+}
+void FileCopyPeerDelta::ParseSums()
+{
+   const char *b;
+   int s;
+   sums_buf.Get(&b,&s);
+   while(s>0)
+   {
+      const char *eol=(const char*)memchr(b,'\n',s);
+      int len=(eol ? eol-b : s);
+      bool valid=(len==32 || (len>32 && b[32]==' '));
+      for(int i=0; valid && i<32; i++)
+	 valid=is_ascii_xdigit(b[i]);
+      if(!valid)
+      {
+	 // an error message instead of the sums, send all the blocks.
+	 debug((9,"copy: no block sums for `%s'\n",file.get()));
+	 sums.Empty();
+	 return;
+      }
+      sums.Append(xstring::get_tmp(b,32).c_lc());
+      if(!eol)
+	 break;
+      b+=len+1;
+      s-=len+1;
+   }
+}
+void FileCopyPeerDelta::CheckBlock()
+{
+   const char *old_sum=sums[block_no];
+   if(old_sum)
+   {
+      Checksum md5(Checksum::MD5);
+      md5.Update(block,block.length());
+      xstring sum;
+      md5.Finish(sum);
+      if(sum.eq(old_sum))
+      {
+	 block.truncate();
+	 block_no++;
+	 return;
+      }
+   }
+   session->PatchBlock(block_no);
+   block_sent=0;
+}
+int FileCopyPeerDelta::SendBlock()
+{
+   int res=session->Write(block.get()+block_sent,block.length()-block_sent);
+   if(res<0)
+   {
+      if(res==FA::DO_AGAIN)
+	 return 0;
+      SetError(session->StrError(res));
+      return -1;
+   }
+   block_sent+=res;
+   if(block_sent==(int)block.length())
+   {
+      block.truncate();
+      block_no++;
+      block_sent=-1;
+      blocks_sent++;
+   }
+   return res;
+}
+int FileCopyPeerDelta::Put_LL(const char *buf,int len)
+{
+   if(!sums_done || block_sent>=0 || block_no*block_size>=file_size)
+      return 0;
+   int need=BlockLen(block_no)-block.length();
+   if(len>need)
+      len=need;
+   block.append(buf,len);
+   if((int)block.length()==BlockLen(block_no))
+      CheckBlock();
+   return len;
+}
+int FileCopyPeerDelta::Do()
+{
+   int m=STALL;
+   if(Done() || Error())
+      return m;
+   if(!sums_done)
+   {
+      int res=session->Read(&sums_buf,0x10000);
+      if(res==FA::DO_AGAIN)
+	 return m;
+      if(res>0)
+      {
+	 sums_buf.SpaceAdd(res);
+	 return MOVED;
+      }
+      if(res<0)
+      {
+	 debug((9,"copy: block sums failed: %s\n",session->StrError(res)));
+	 sums_buf.Empty();
+      }
+      ParseSums();
+      sums_buf.Empty();
+      sums_done=true;
+      session->Close();
+      session->Open(file,FA::STORE);
+      session->SetSize(file_size);
+      session->SetBlockSize(block_size);
+      m=MOVED;
+   }
+   if(block_sent>=0)
+   {
+      int res=SendBlock();
+      if(res<0)
+	 return MOVED;
+      if(res>0)
+	 m=MOVED;
+      if(block_sent>=0)
+	 return m;
+   }
+   if(Size()>0)
+   {
+      if(block_no*block_size>=file_size)
+      {
+	 SetError(_("file size increased during transfer"));
+	 return MOVED;
+      }
+      if(IOBuffer::Do()==MOVED)
+	 m=MOVED;
+      return m;
+   }
+   if(!eof)
+      return m;
+   if(block_no*block_size<file_size)
+   {
+      SetError(_("file size decreased during transfer"));
+      return MOVED;
+   }
+   if(date!=NO_DATE && date!=NO_DATE_YET)
+      session->SetDate(date);
+   int res=session->StoreStatus();
+   if(res==FA::IN_PROGRESS || res==FA::DO_AGAIN)
+      return m;
+   if(res<0)
+   {
+      SetError(session->StrError(res));
+      return MOVED;
+   }
+   debug((9,"copy: %lld of %lld blocks of `%s' sent\n",(long long)blocks_sent,
+	 (long long)(file_size+block_size-1)/block_size,file.get()));
+   session->Close();
+   done=true;
+   return MOVED;
+}
+void FileCopyPeerDelta::SuspendInternal()
+{
+   if(session->IsOpen())
+      session->SuspendSlave();
+   super::SuspendInternal();
+}
+void FileCopyPeerDelta::ResumeInternal()
+{
+   super::ResumeInternal();
+   session->ResumeSlave();
+}
+
 // special pointer to creator of ftp/ftp copier. It is init'ed in Ftp class.
 FileCopy *(*FileCopy::fxp_create)(FileCopyPeer *src,FileCopyPeer *dst,bool cont);
@@ -23,7 +23,11 @@
    FileCopyPeer
    +FileCopyPeerFA
    +FileCopyPeerFDStream
+   +FileCopyPeerTee
+   +FileCopyPeerBulk
    \FileCopyPeerList
+   FileCopyTee
+   FileCopyBulk
 */
 
 #ifndef FILECOPY_H
@@ -466,4 +470,175 @@ public:
    bool Done() { return true; }
 };
 
+class FileCopyPeerTee;
+
+// Reads a file once and feeds the data to several FileCopyPeerTee peers,
+// each of them being the source of a separate FileCopy. The data is kept
+// until all the peers have taken it, so the slowest one limits the reading.
+class FileCopyTee : public SMTask
+{
+   friend class FileCopyPeerTee;
+
+   SMTaskRef<FileCopyPeer> get;
+   Buffer data;	  // data.GetPos() is the file position of buffered data
+   int max_buf;
+   xarray<FileCopyPeerTee*> peers;
+   bool started;
+   bool held;
+   xstring_c error_text;
+
+   void Trim();
+   void Detach(FileCopyPeerTee *p);
+
+protected:
+   void PrepareToDie();
+
+public:
+   FileCopyTee(FileCopyPeer *src);  // consumes src
+   int Do();
+
+   // new peers can be added until the data starts flowing.
+   FileCopyPeerTee *NewPeer();
+   void Start();
+   bool Started() const { return started; }
+   // the tee deletes itself when the last peer is gone and it is not held.
+   void Hold() { held=true; }
+   void Release();
+
+   bool Error() const { return error_text!=0; }
+   const char *ErrorText() const { return error_text; }
+};
+
+// A peer seeking out of the shared data (on retry or resume) leaves the
+// tee and reads the file by itself.
+class FileCopyPeerTee : public FileCopyPeer
+{
+   friend class FileCopyTee;
+   FileCopyTee *tee;
+   off_t tee_pos;
+   SMTaskRef<FileCopyPeer> own;
+
+protected:
+   void PrepareToDie();
+
+public:
+   FileCopyPeerTee(FileCopyTee *t);
+   int Do();
+   void Seek(off_t new_pos);
+   const char *GetStatus() { return own ? own->GetStatus() : tee ? tee->get->GetStatus() : 0; }
+};
+
+class FileCopyPeerBulk;
+
+// Copies many files over one session with a RETRIEVE or STORE batch, so
+// that they go in one stream without a round trip per file. Each file is
+// still copied by its own FileCopy, with a FileCopyPeerBulk as the source
+// (RETRIEVE) or the target (STORE). The files go in the order they were
+// added; a file which is not going to be copied has to be given up with
+// Unwant, otherwise the stream waits for it.
+class FileCopyBulk : public SMTask
+{
+   friend class FileCopyPeerBulk;
+
+   FileAccessRef session;
+   FA::open_mode mode;
+   Ref<FileSet> files;	 // the rank of a file is its index
+   xarray<FileCopyPeerBulk*> peers;
+   xarray<bool> unwanted;
+   int active;
+   Buffer pending;	 // RETRIEVE data of a file which has no peer yet
+   int pending_file;
+   int max_buf;
+   bool started;
+   bool finished;
+   bool held;
+   xarray<int> result;	 // copied from the session when the batch is done
+   StringSet result_error;
+   xstring_c error_text;
+
+   int FindFile(const char *name) const;
+   int Result(int i) const;
+   const char *ResultError(int i) const;
+   void Detach(FileCopyPeerBulk *p);
+
+protected:
+   void PrepareToDie();
+
+public:
+   FileCopyBulk(FileAccess *s,FA::open_mode m);	 // consumes s
+   int Do();
+
+   // the files are added before Start, the peers are created after it.
+   void Add(const FileInfo *fi);
+   int Count() const { return files->count(); }
+   FA::open_mode GetMode() const { return mode; }
+   void Start();
+   FileCopyPeerBulk *NewPeer(const char *name);  // 0 if not added
+   void Unwant(const char *name);
+   // the bulk deletes itself when the last peer is gone and it is not held.
+   void Hold() { held=true; }
+   void Release();
+
+   bool Error() const { return error_text!=0; }
+   const char *ErrorText() const { return error_text; }
+   const char *GetStatus() { return finished ? 0 : session->CurrentStatus(); }
+};
+
+class FileCopyPeerBulk : public FileCopyPeer
+{
+   friend class FileCopyBulk;
+   FileCopyBulk *bulk;
+   int index;
+
+   bool Current() const { return bulk->session->GetBatchFile()==index; }
+   off_t FileSize() const { return (*bulk->files)[index]->size; }
+
+protected:
+   void PrepareToDie();
+   int Put_LL(const char *buf,int size);
+
+public:
+   FileCopyPeerBulk(FileCopyBulk *b,int i);
+   int Do();
+   const char *GetStatus() { return bulk ? bulk->GetStatus() : 0; }
+};
+
+// Updates an existing remote file in place. The MD5 sums of the blocks of
+// the old file are fetched first, then only the blocks which differ are
+// sent. The blocks are compared at fixed offsets, so this pays off for
+// files changed in place, not for data inserted in the middle.
+class FileCopyPeerDelta : public FileCopyPeer
+{
+   FileAccessRef session;
+   xstring_c file;
+   off_t file_size;
+   int block_size;
+
+   Buffer sums_buf;
+   StringSet sums;
+   bool sums_done;
+
+   xstring block;      // data of the current block
+   off_t block_no;
+   int block_sent;     // -1 until the block is found to differ
+   off_t blocks_sent;
+
+   int BlockLen(off_t n) const;
+   void ParseSums();
+   void CheckBlock();
+   int SendBlock();
+
+protected:
+   int Put_LL(const char *buf,int size);
+
+public:
+   FileCopyPeerDelta(FileAccess *s,const char *f,off_t size);
+   int Do();
+
+   int Buffered() { return Size()+block.length()+session->Buffered(); }
+   void SuspendInternal();
+   void ResumeInternal();
+   const char *GetStatus() { return session->CurrentStatus(); }
+};
+
 #endif
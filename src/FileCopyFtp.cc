@@ -32,6 +32,30 @@
 #define ftp_src get->GetSession().Cast<Ftp>()
 #define ftp_dst put->GetSession().Cast<Ftp>()
 
+xmap_p<FileCopyFtp::PairInfo> FileCopyFtp::pair_info;
+
+const xstring& FileCopyFtp::PairKey(const FileAccess *src,const FileAccess *dst)
+{
+   return xstring::cat(src->GetHostName()," ",dst->GetHostName(),NULL);
+}
+
+void FileCopyFtp::SavePairInfo(bool failed)
+{
+   const xstring& key=PairKey(ftp_src,ftp_dst);
+   PairInfo *info=pair_info.lookup(key);
+   if(!info)
+   {
+      info=new PairInfo;
+      pair_info.add(key,info);
+   }
+   info->passive_source=passive_source;
+   info->passive_ssl_connect=passive_ssl_connect;
+   info->protect=protect;
+   info->failed=failed;
+   if(failed)
+      info->fail_time=SMTask::now;
+}
+
 void FileCopyFtp::Close()
 {
    ftp_src->Close();
@@ -114,6 +138,7 @@ int FileCopyFtp::Do()
       {
 	 // both ways failed. Fall back to normal copying.
 	 Log::global->Write(0,_("**** FXP: giving up, reverting to plain copy\n"));
+	 SavePairInfo(true);
 	 Close();
 	 disable_fxp=true;
 	 get->SetFXP(false);
@@ -157,6 +182,7 @@ int FileCopyFtp::Do()
    dst_res=ftp_dst->Done();
    if(src_res==FA::OK && dst_res==FA::OK)
    {
+      SavePairInfo(false);
       Close();
       const long long size=GetSize();
       if(size>=0)
@@ -246,6 +272,17 @@ FileCopyFtp::FileCopyFtp(FileCopyPeer *s,FileCopyPeer *d,bool c,bool rp)
    passive_ssl_connect=ResMgr::QueryBool("ftp:fxp-passive-sscn",0);
    orig_passive_ssl_connect=passive_ssl_connect;
 #endif
+
+   // start with what worked last time for these sites.
+   const PairInfo *info=pair_info.lookup(PairKey(ftp_src,ftp_dst));
+   if(info && !info->failed)
+   {
+      orig_passive_source=passive_source=info->passive_source;
+#if USE_SSL
+      orig_passive_ssl_connect=passive_ssl_connect=info->passive_ssl_connect;
+      protect=info->protect;
+#endif
+   }
 }
 
 FileCopy *FileCopyFtp::New(FileCopyPeer *s,FileCopyPeer *d,bool c)
@@ -260,5 +297,15 @@ FileCopy *FileCopyFtp::New(FileCopyPeer *s,FileCopyPeer *d,bool c)
    if(!ResMgr::QueryBool("ftp:use-fxp",s_s->GetHostName())
    || !ResMgr::QueryBool("ftp:use-fxp",d_s->GetHostName()))
       return 0;
+   const PairInfo *info=pair_info.lookup(PairKey(s_s,d_s));
+   if(info && info->failed
+   && !TimeIntervalR(ResMgr::Query("ftp:fxp-retry-interval",s_s->GetHostName())).Finished(info->fail_time)
+   && !ResMgr::QueryBool("ftp:fxp-force",s_s->GetHostName())
+   && !ResMgr::QueryBool("ftp:fxp-force",d_s->GetHostName()))
+   {
+      Log::global->Format(9,"**** FXP: did not work between %s and %s before, using plain copy\n",
+	 s_s->GetHostName(),d_s->GetHostName());
+      return 0;
+   }
    return new FileCopyFtp(s,d,c,ResMgr::QueryBool("ftp:fxp-passive-source",0));
 }
@@ -41,6 +41,20 @@ class FileCopyFtp : public FileCopy
 
    void Close();
 
+   // what worked for FXP between two sites, so that the following copies
+   // start with it or go straight to plain copy.
+   struct PairInfo
+   {
+      bool passive_source;
+      bool passive_ssl_connect;
+      bool protect;
+      bool failed;
+      Time fail_time;	// FXP is tried again after ftp:fxp-retry-interval
+   };
+   static xmap_p<PairInfo> pair_info;
+   static const xstring& PairKey(const FileAccess *src,const FileAccess *dst);
+   void SavePairInfo(bool failed);
+
 public:
    void Init();
    FileCopyFtp(FileCopyPeer *src,FileCopyPeer *dst,bool cont,bool rp);
@@ -74,6 +74,19 @@ void  FileInfo::MergeInfo(const FileInfo& f,unsigned dif)
       SetGroup(f.group);
    if(dif&NLINKS)
       SetNlink(f.nlinks);
+   if(dif&CHECKSUM) {
+      checksum.set(f.checksum);
+      def(CHECKSUM);
+   }
+}
+
+void FileInfo::SetChecksum(const char *algo,const char *hex)
+{
+   // the digests are compared as strings, so use one case for them.
+   xstring& lc_hex=xstring::get_tmp(hex);
+   lc_hex.c_lc();
+   checksum.vset(algo,":",lc_hex.get(),NULL);
+   def(CHECKSUM);
 }
 
 void FileInfo::SetUser(const char *u)
@@ -248,6 +261,22 @@ static int sort_size(const int *s1, const int *s2)
    return 0;
 }
 
+static int sort_size_dirs_last(const int *s1, const int *s2)
+{
+   const FileInfo *p1=(*files_cmp)[*s1];
+   const FileInfo *p2=(*files_cmp)[*s2];
+   bool d1=p1->TypeIs(FileInfo::DIRECTORY);
+   bool d2=p2->TypeIs(FileInfo::DIRECTORY);
+   if(d1!=d2)
+      return d1 ? 1 : -1;
+   if(!d1) {
+      int res=sort_size(s1,s2);
+      if(res)
+	 return res;
+   }
+   return sort_name(s1,s2);
+}
+
 static int sort_dirs(const int *s1, const int *s2)
 {
    const FileInfo *p1=(*files_cmp)[*s1];
@@ -320,6 +349,7 @@ void FileSet::Sort(sort_e newsort, bool casefold, bool reverse)
    case DIRSFIRST: sorted.qsort(sort_dirs); break;
    case BYRANK: sorted.qsort(sort_rank); break;
    case BYDATE: sorted.qsort(sort_date); break;
+   case BYSIZE_DIRSLAST: sorted.qsort(sort_size_dirs_last); break;
    }
    sort_mode=newsort;
 }
@@ -858,6 +888,7 @@ FileInfo::FileInfo(const FileInfo &fi)
    date=fi.date;
    size=fi.size;
    nlinks=fi.nlinks;
+   checksum.set(fi.checksum);
    longname.set(fi.longname);
 }
 FileInfo::~FileInfo()
@@ -58,6 +58,7 @@ public:
    xstring  data;
    const char *user, *group;
    int      nlinks;
+   xstring_c checksum;	// "ALGO:hex", e.g. "SHA-1:da39a3ee..."
 
    enum	 type
    {
@@ -77,6 +78,8 @@ public:
       IGNORE_SIZE_IF_OLDER=02000, // for ignore mask
       IGNORE_DATE_IF_OLDER=04000, // for ignore mask
 
+      CHECKSUM=010000,  // not a part of ALL_INFO, has to be requested
+
       ALL_INFO=NAME|MODE|DATE|TYPE|SYMLINK_DEF|SIZE|USER|GROUP|NLINKS
    };
    unsigned defined;
@@ -107,6 +110,7 @@ public:
    const char *GetRedirect() const { return symlink; }
    void	SetSize(off_t s) { size=s; def(SIZE); }
    void	SetNlink(int n) { nlinks=n; def(NLINKS); }
+   void	SetChecksum(const char *algo,const char *hex);
 
    void	 Merge(const FileInfo&);
    void  MergeInfo(const FileInfo& f,unsigned mask);
@@ -143,7 +147,7 @@ class PatternSet;
 class FileSet
 {
 public:
-   enum sort_e { BYNAME, BYSIZE, DIRSFIRST, BYRANK, BYDATE, BYNAME_FLAT };
+   enum sort_e { BYNAME, BYSIZE, DIRSFIRST, BYRANK, BYDATE, BYNAME_FLAT, BYSIZE_DIRSLAST };
 
 private:
    RefArray<FileInfo> files;
@@ -111,6 +111,15 @@ int FinderJob::Do()
       top.fset->rewind();
 
       li=0;
+      if(!InitListPrefetch())
+	 goto pre_LOOP;
+      state=PREFETCH;
+      m=MOVED;
+   case PREFETCH:
+      if(!prefetch->Done())
+	 return m;
+      prefetch=0;
+   pre_LOOP:
       state=LOOP;
       m=MOVED;
    case LOOP:
@@ -194,6 +203,31 @@ int FinderJob::Do()
    return m;
 }
 
+/* The listings of the subdirectories of the new directory are fetched
+ * into the cache in batches, GetFileInfo takes them from there. */
+bool FinderJob::InitListPrefetch()
+{
+   if(!use_cache || stack_ptr<1 || (maxdepth!=-1 && stack_ptr+1>=maxdepth))
+      return false;
+   if(!session->IsClosed() || !session->BatchSupported(FA::LONG_LIST))
+      return false;
+
+   Ref<FileSet> dirs(new FileSet);
+   for(int i=0; i<top.fset->count(); i++)
+   {
+      const FileInfo *f=(*top.fset)[i];
+      if((f->defined&f->TYPE) && f->filetype==f->DIRECTORY)
+	 dirs->Add(new FileInfo(f->name));
+   }
+   if(dirs->count()<2)
+      return false;
+
+   session->SetCwd(init_dir);
+   session->Chdir(top.path,false);
+   prefetch=new ListPrefetch(session,dirs.borrow());
+   return true;
+}
+
 void FinderJob::Up()
 {
    if(stack_ptr==-1)
@@ -306,6 +340,9 @@ void FinderJob::ShowRunStatus(const SMTaskRef<StatusLine>& sl)
    case INFO:
       sl->Show("%s: %s",dir_file(stack_ptr>=0?top.path.get():0,dir),li->Status());
       break;
+   case PREFETCH:
+      sl->Show("%s: %s",top.path.get(),prefetch->Status());
+      break;
    case WAIT:
       Job::ShowRunStatus(sl);
       break;
@@ -324,6 +361,9 @@ xstring& FinderJob::FormatStatus(xstring& s,int v,const char *prefix)
    case INFO:
       s.appendf("\t%s: %s\n",dir_file(stack_ptr>=0?top.path.get():0,dir),li->Status());
       break;
+   case PREFETCH:
+      s.appendf("\t%s: %s\n",top.path.get(),prefetch->Status());
+      break;
    case WAIT:
       break;
    default:
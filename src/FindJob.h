@@ -34,6 +34,8 @@ class FinderJob : public SessionJob
    xstring_c dir;
    int errors;
    SMTaskRef<GetFileInfo> li;
+   SMTaskRef<ListPrefetch> prefetch;  // listings of the subdirectories
+   bool InitListPrefetch();
 
    class place
       {
@@ -67,7 +69,7 @@ class FinderJob : public SessionJob
    Ref<PatternSet> exclude;
 
 protected:
-   enum state_t { START_INFO, INFO, LOOP, PROCESSING, WAIT, DONE };
+   enum state_t { START_INFO, INFO, PREFETCH, LOOP, PROCESSING, WAIT, DONE };
    state_t state;
 
    const char *op;
@@ -36,6 +36,8 @@
 
 #define max_buf 0x10000
 
+xmap<bool> Fish::no_block_sums;
+
 void Fish::GetBetterConnection(int level)
 {
    for(FA *fo=FirstSameSite(); fo!=0; fo=NextSameSite(fo))
@@ -136,6 +138,9 @@ int Fish::Do()
       if(!ReconnectAllowed())
 	 return m;
 
+      if(WaitSharedConnection())
+	 return m;
+
       if(!NextTry())
 	 return MOVED;
 
@@ -145,6 +150,7 @@ int Fish::Do()
       if(!prog || !prog[0])
 	 prog="ssh -a -x";
       ArgV args;
+      AddSharedConnectionOptions(args);
       if(user)
       {
 	 args.Add("-l");
@@ -233,7 +239,7 @@ int Fish::Do()
 	    break;
       }
       SendMethod();
-      if(mode==LONG_LIST || mode==LIST || mode==QUOTE_CMD)
+      if(mode==LONG_LIST || mode==LIST || mode==QUOTE_CMD || mode==BLOCK_SUMS)
       {
 	 state=FILE_RECV;
 	 m=MOVED;
@@ -308,6 +314,8 @@ void Fish::DisconnectLL()
    state=DISCONNECTED;
    if(mode==STORE)
       SetError(STORE_FAILED,0);
+   if(mode==BATCH)
+      FailBatchFiles();
    home_auto.set(FindHomeAuto());
 }
 
@@ -316,6 +324,14 @@ void Fish::Init()
    state=DISCONNECTED;
    max_send=0;
    eof=false;
+   batch_reply=0;
+   batch_data=0;
+   batch_file=-1;
+   batch_size_sent=false;
+   patch_block=-1;
+   patch_left=0;
+   patch_header_sent=false;
+   patch_end_sent=false;
 }
 
 Fish::Fish() : SSH_Access("FISH:")
@@ -362,6 +378,11 @@ void Fish::Close()
    state=(recv_buf?CONNECTED:DISCONNECTED);
    eof=false;
    encode_file=true;
+   batch_files.truncate();
+   batch_file=-1;
+   patch_block=-1;
+   patch_left=0;
+   patch_end_sent=false;
    super::Close();
 }
 
@@ -390,6 +411,113 @@ void Fish::SendArrayInfoRequests()
    }
 }
 
+void Fish::SendBatchRequests()
+{
+   batch_files.truncate();
+   batch_reply=0;
+   batch_data=0;
+   batch_file=-1;
+   for(int i=0; i<fileset_for_batch->count(); i++)
+   {
+      if(GetBatchResult(i)!=IN_PROGRESS)
+	 continue;
+      if(batch_mode==STORE && !(*fileset_for_batch)[i]->Has(FileInfo::SIZE))
+      {
+	 SetBatchResult(i,NO_FILE,"Have to know file size before upload");
+	 continue;
+      }
+      batch_files.append(i);
+   }
+   if(batch_files.count()==0)
+      return;
+
+   if(batch_mode==RETRIEVE)
+   {
+      // every file is preceded by its ls line which gives the size,
+      // a file which cannot be read gets 500 and no data.
+      for(int j=0; j<batch_files.count(); j++)
+      {
+	 const char *name=(*fileset_for_batch)[batch_files[j]]->name;
+	 const char *e=shell_encode(name);
+	 Send("#RETR %s\n"
+	      "if [ -f %s ] && [ -r %s ];then "
+		  "ls -lLd %s;echo '### 100';cat %s;echo '### 200';"
+	      "else ls -d %s>/dev/null&&echo 'Not a regular file';"
+		  "echo '### 500';fi\n",name,e,e,e,e,e);
+	 PushExpect(EXPECT_BATCH_RETR_INFO);
+	 PushExpect(EXPECT_BATCH_RETR);
+      }
+      return;
+   }
+
+   // STORE: the data of every file are preceded by a line with the size,
+   // -1 skips the file. The script is a function, so that the shell has
+   // read all of it before the data come.
+   xstring script;
+   for(int j=0; j<batch_files.count(); j++)
+   {
+      const char *e=shell_encode((*fileset_for_batch)[batch_files[j]]->name);
+      script.appendf("read rest;if [ \"$rest\" -ge 0 ];then "
+	    "if true>%s;then f=%s;else f=/dev/null;fi;"
+	    "while [ $rest -gt 0 ];do "
+	       "bs=4096;cnt=`expr $rest / $bs`;"
+	       "[ $cnt -eq 0 ] && { cnt=1;bs=$rest; }; "
+	       "n=`dd ibs=$bs count=$cnt 2>/dev/null|tee -a \"$f\"|wc -c`;"
+	       "[ \"$n\" -le 0 ] && exit;"
+	       "rest=`expr $rest - $n`; "
+	    "done;fi;echo '### 200';",e,e);
+   }
+   Send("#STORS %d\n"
+	"lftp_stors(){ echo '### 001';%s}\n"
+	"lftp_stors\n",batch_files.count(),script.get());
+   PushExpect(EXPECT_STOR_PRELIMINARY);
+   for(int j=0; j<batch_files.count(); j++)
+      PushExpect(EXPECT_BATCH_STOR);
+}
+
+void Fish::SetBatchFile()
+{
+   batch_file=(batch_data<batch_files.count() ? batch_files[batch_data] : -1);
+   batch_size_sent=false;
+   real_pos=0;
+   if(batch_file!=-1)
+      entity_size=(*fileset_for_batch)[batch_file]->size;
+}
+
+void Fish::SkipBatchFile()
+{
+   if(mode!=BATCH || batch_mode!=STORE || state!=FILE_SEND || batch_file==-1)
+      return;
+   if(batch_size_sent)
+   {
+      // a part of the data has been sent already.
+      Disconnect();
+      return;
+   }
+   Send("-1\n");
+   batch_data++;
+   SetBatchFile();
+}
+
+void Fish::FailBatchFiles()
+{
+   // the files which the connection was lost in the middle of.
+   int end=batch_data;
+   if(batch_file!=-1 && (batch_mode==RETRIEVE || batch_size_sent))
+      end++;
+   for(int j=batch_reply; j<end && j<batch_files.count(); j++)
+      SetBatchResult(batch_files[j],NO_FILE,_("Peer closed connection"));
+   batch_files.truncate();
+   batch_reply=0;
+   batch_data=0;
+   batch_file=-1;
+}
+
+bool Fish::BatchSupported(open_mode m) const
+{
+   return (m==RETRIEVE || m==STORE) && QueryBool("bulk-transfer",hostname);
+}
+
 void Fish::SendMethod()
 {
    const char *e=file?alloca_strdup(shell_encode(file)):0;
@@ -447,7 +575,37 @@ void Fish::SendMethod()
 	 SetError(NO_FILE,"Have to know file size before upload");
 	 break;
       }
-      if(entity_size>0)
+      if(block_size>0)
+      {
+	 // non-standard extension: every block is preceded by a line with
+	 // its number and length, "-1 0" ends the blocks. The existing file
+	 // is written in place, so it has to be writable.
+	 Send("#PATCH %lld %s\n"
+	      "lftp_patch(){ f=%s;"
+	      "if [ -f \"$f\" ] && [ -w \"$f\" ];then :;"
+	      "else echo 'Cannot write the file';echo '### 001';return;fi;"
+	      "t=`mktemp 2>/dev/null`;"
+	      "if [ -z \"$t\" ];then t=`dirname \"$f\"`/.lftp_patch.$$;"
+		  "(set -C;:>\"$t\") 2>/dev/null||"
+		  "{ echo 'Cannot create a temporary file';echo '### 001';return; };"
+	      "fi;"
+	      "echo '### 001';"
+	      "while read n rest;do [ $n -lt 0 ]&&break;true>\"$t\";"
+		  "while [ $rest -gt 0 ];do "
+		     "bs=4096;cnt=`expr $rest / $bs`;"
+		     "[ $cnt -eq 0 ] && { cnt=1;bs=$rest; }; "
+		     "c=`dd ibs=$bs count=$cnt 2>/dev/null|tee -a \"$t\"|wc -c`;"
+		     "[ \"$c\" -le 0 ] && exit;"
+		     "rest=`expr $rest - $c`; "
+		  "done;"
+		  "dd if=\"$t\" of=\"$f\" bs=%d seek=$n conv=notrunc 2>/dev/null;"
+	      "done;rm -f \"$t\";"
+	      "dd if=/dev/null of=\"$f\" bs=1 seek=%lld 2>/dev/null;"
+	      "echo '### 200';}\n"
+	      "lftp_patch\n",
+	    (long long)entity_size,e,e,block_size,(long long)entity_size);
+      }
+      else if(entity_size>0)
       {
 	 Send("#STOR %lld %s\n"
 	      "rest=%lld;file=%s;:>$file;echo '### 001';"
@@ -530,7 +688,40 @@ void Fish::SendMethod()
       PushExpect(EXPECT_QUOTE);
       real_pos=0;
       break;
+   case BLOCK_SUMS:
+      // non-standard extension. GNU split runs md5sum once per block,
+      // otherwise dd reads the blocks one by one. BSD has md5 instead of
+      // md5sum; without any md5 command the reply is 504.
+      Send("#SUMS %d %s\n"
+	   "f=%s;bs=%d;m=1;"
+	   "if md5sum </dev/null >/dev/null 2>&1;then lftp_md5(){ md5sum; };"
+	   "elif md5 -q </dev/null >/dev/null 2>&1;then lftp_md5(){ md5 -q; };"
+	   "elif openssl md5 </dev/null >/dev/null 2>&1;then "
+	      "lftp_md5(){ openssl md5|sed 's/.*= *//'; };"
+	   "else m=;fi;"
+	   "if [ -z \"$m\" ];then echo '### 504';else "
+	   "if [ -r \"$f\" ];then "
+	      "if md5sum </dev/null >/dev/null 2>&1"
+	      "&& echo|split -b 1 --filter=cat >/dev/null 2>&1;then "
+		  "split -b $bs --filter=md5sum \"$f\";"
+	      "else s=`wc -c <\"$f\"`;n=0;"
+		  "while [ `expr $n \\* $bs` -lt $s ];do "
+		     "dd if=\"$f\" bs=$bs skip=$n count=1 2>/dev/null|lftp_md5;"
+		     "n=`expr $n + 1`;"
+		  "done;fi;fi;echo '### 200';fi\n",
+	 block_size,e,e,block_size);
+      PushExpect(EXPECT_DIR);
+      real_pos=0;
+      break;
+   case BATCH:
+      if(batch_mode==RETRIEVE || batch_mode==STORE)
+      {
+	 SendBatchRequests();
+	 break;
+      }
+      /* fallthrough */
    case MP_LIST:
+   case COPY:
       SetError(NOT_SUPP);
       break;
    case CONNECT_VERIFY:
@@ -715,8 +906,17 @@ int Fish::HandleReplies()
       fi->need=0;
       break;
    }
-   case EXPECT_RETR:
    case EXPECT_DIR:
+      if(mode==BLOCK_SUMS && code==504)
+      {
+	 // no md5 command there, don't ask for the sums again.
+	 LogNote(9,"no md5 command on %s, block sums disabled\n",hostname.get());
+	 no_block_sums.add(xstring::get_tmp(hostname),true);
+	 SetError(NOT_SUPP);
+	 break;
+      }
+      /* fallthrough */
+   case EXPECT_RETR:
    case EXPECT_QUOTE:
       eof=true;
       state=DONE;
@@ -731,6 +931,12 @@ int Fish::HandleReplies()
 	 Disconnect();
 	 SetError(NO_FILE,message);
       }
+      else if(mode==BATCH)
+      {
+	 state=FILE_SEND;
+	 batch_data=0;
+	 SetBatchFile();
+      }
       break;
    case EXPECT_STOR:
       if(message)
@@ -739,6 +945,50 @@ int Fish::HandleReplies()
 	 SetError(NO_FILE,message);
       }
       break;
+   case EXPECT_BATCH_RETR_INFO:
+   {
+      int i=BatchReplyFile();
+      if(code!=100)
+      {
+	 SetBatchResult(i,NO_FILE,message?message.get():"");
+	 RespQueue.next();  // no data and no final reply follow.
+	 batch_reply++;
+	 break;
+      }
+      Ref<FileInfo> fi(message?FileInfo::parse_ls_line(message,"GMT"):0);
+      if(!fi || !fi->Has(fi->SIZE))
+      {
+	 // the data cannot be told from the following replies.
+	 SetBatchResult(i,NO_FILE,message?message.get():"");
+	 Disconnect();
+	 break;
+      }
+      batch_data=batch_reply;
+      batch_file=i;
+      entity_size=fi->size;
+      real_pos=0;
+      state=(entity_size>0?FILE_RECV:WAITING);
+      break;
+   }
+   case EXPECT_BATCH_RETR:
+      // anything before the reply means the file has grown meanwhile.
+      if(message)
+	 SetBatchResult(batch_file,NO_FILE,"file size changed");
+      else
+	 SetBatchResult(batch_file,OK);
+      batch_file=-1;
+      batch_reply++;
+      state=WAITING;
+      break;
+   case EXPECT_BATCH_STOR:
+      if(message)
+	 SetBatchResult(BatchReplyFile(),NO_FILE,message);
+      else
+	 SetBatchResult(BatchReplyFile(),OK);
+      batch_reply++;
+      if(RespQueueIsEmpty())
+	 state=DONE;
+      break;
    case EXPECT_IGNORE:
       break;
    }
@@ -775,6 +1025,9 @@ void Fish::CloseExpectQueue()
       case EXPECT_RETR:
       case EXPECT_STOR_PRELIMINARY:
       case EXPECT_STOR:
+      case EXPECT_BATCH_RETR_INFO:
+      case EXPECT_BATCH_RETR:
+      case EXPECT_BATCH_STOR:
 	 Disconnect();
 	 break;
       }
@@ -802,6 +1055,8 @@ int Fish::Read(Buffer *buf,int size)
       return 0;
    if(state==DONE)
       return 0;	  // eof
+   if(mode==BATCH)
+      return ReadBatch(buf,size);
    if(state==FILE_RECV && real_pos>=0)
    {
       const char *buf1;
@@ -882,9 +1137,134 @@ int Fish::Read(Buffer *buf,int size)
    return DO_AGAIN;
 }
 
+int Fish::ReadBatch(Buffer *buf,int size)
+{
+   if(state!=FILE_RECV || batch_file==-1)
+      return DO_AGAIN;
+   if(recv_buf->Size()==0 && recv_buf->Error())
+   {
+      Disconnect();
+      return DO_AGAIN;
+   }
+   const char *buf1;
+   int size1;
+   recv_buf->Get(&buf1,&size1);
+   if(buf1==0) // eof
+   {
+      Disconnect();
+      return DO_AGAIN;
+   }
+   // never return data of the next file in the same call.
+   if(real_pos+size1>entity_size)
+      size1=entity_size-real_pos;
+   int bytes_allowed=rate_limit->BytesAllowedToGet();
+   if(size1>bytes_allowed)
+      size1=bytes_allowed;
+   if(size>size1)
+      size=size1;
+   if(size<=0)
+      return DO_AGAIN;
+   size=buf->MoveDataHere(recv_buf,size);
+   if(size<=0)
+      return DO_AGAIN;
+   pos+=size;
+   real_pos+=size;
+   rate_limit->BytesGot(size);
+   TrySuccess();
+   if(real_pos>=entity_size)
+   {
+      state=WAITING;
+      if(HandleReplies()==MOVED)
+	 current->Timeout(0);
+   }
+   return size;
+}
+
+int Fish::WriteBatch(const void *buf,int size)
+{
+   if(state!=FILE_SEND || batch_file==-1 || rate_limit==0)
+      return DO_AGAIN;
+   {
+      int allowed=rate_limit->BytesAllowedToPut();
+      if(allowed==0)
+	 return DO_AGAIN;
+      if(size+send_buf->Size()>allowed)
+	 size=allowed-send_buf->Size();
+   }
+   if(size+send_buf->Size()>0x4000)
+      size=0x4000-send_buf->Size();
+   if(real_pos+size>entity_size)
+      size=entity_size-real_pos;
+   // an empty file is sent with zero size write.
+   if(size<=0 && real_pos<entity_size)
+      return 0;
+   if(size<0)
+      size=0;
+   if(!batch_size_sent)
+   {
+      Send("%lld\n",(long long)entity_size);
+      batch_size_sent=true;
+   }
+   send_buf->Put((char*)buf,size);
+   TrySuccess();
+   rate_limit->BytesPut(size);
+   pos+=size;
+   real_pos+=size;
+   if(real_pos==entity_size)
+   {
+      batch_data++;
+      SetBatchFile();
+   }
+   return size;
+}
+
+void Fish::PatchBlock(off_t n)
+{
+   if(block_size<=0 || patch_left>0 || n*block_size>=entity_size)
+      return;
+   patch_block=n;
+   patch_left=block_size;
+   if(entity_size-n*block_size<block_size)
+      patch_left=entity_size-n*block_size;
+   patch_header_sent=false;
+}
+
+int Fish::WritePatch(const void *buf,int size)
+{
+   if(state!=FILE_SEND || rate_limit==0)
+      return DO_AGAIN;
+   if(patch_left==0)
+      return 0;	  // no block announced.
+   {
+      int allowed=rate_limit->BytesAllowedToPut();
+      if(allowed==0)
+	 return DO_AGAIN;
+      if(size+send_buf->Size()>allowed)
+	 size=allowed-send_buf->Size();
+   }
+   if(size+send_buf->Size()>0x4000)
+      size=0x4000-send_buf->Size();
+   if(size>patch_left)
+      size=patch_left;
+   if(size<=0)
+      return 0;
+   if(!patch_header_sent)
+   {
+      Send("%lld %d\n",(long long)patch_block,patch_left);
+      patch_header_sent=true;
+   }
+   send_buf->Put((char*)buf,size);
+   TrySuccess();
+   rate_limit->BytesPut(size);
+   patch_left-=size;
+   pos+=size;
+   real_pos+=size;
+   return size;
+}
+
 int Fish::Write(const void *buf,int size)
 {
-   if(mode!=STORE)
+   if(mode!=STORE && mode!=BATCH)
       return(0);
 
    Resume();
@@ -892,6 +1272,11 @@ int Fish::Write(const void *buf,int size)
    if(Error())
       return(error_code);
 
+   if(mode==BATCH)
+      return WriteBatch(buf,size);
+   if(block_size>0)
+      return WritePatch(buf,size);
+
    if(state!=FILE_SEND || rate_limit==0)
       return DO_AGAIN;
 
@@ -932,7 +1317,20 @@ int Fish::StoreStatus()
       return error_code;
    if(state!=FILE_SEND)
       return IN_PROGRESS;
-   if(real_pos!=entity_size)
+   if(block_size>0)
+   {
+      if(patch_left>0)
+      {
+	 Disconnect();
+	 return IN_PROGRESS;
+      }
+      if(!patch_end_sent)
+      {
+	 Send("-1 0\n");
+	 patch_end_sent=true;
+      }
+   }
+   else if(real_pos!=entity_size)
    {
       Disconnect();
       return IN_PROGRESS;
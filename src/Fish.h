@@ -22,6 +22,7 @@
 
 #include "SSH_Access.h"
 #include "StringSet.h"
+#include "xmap.h"
 
 class Fish : public SSH_Access
 {
@@ -45,6 +46,7 @@ class Fish : public SSH_Access
    void	 Send(const char *format,...) PRINTF_LIKE(2,3);
    void	 SendMethod();
    void	 SendArrayInfoRequests();
+   void	 SendBatchRequests();
 
    void DisconnectLL();
    int IsConnected() const
@@ -73,6 +75,9 @@ class Fish : public SSH_Access
       EXPECT_STOR_PRELIMINARY,
       EXPECT_STOR,
       EXPECT_QUOTE,
+      EXPECT_BATCH_RETR_INFO,
+      EXPECT_BATCH_RETR,
+      EXPECT_BATCH_STOR,
       EXPECT_IGNORE
    };
 
@@ -100,6 +105,29 @@ class Fish : public SSH_Access
    bool	 eof;
    bool	 encode_file;
 
+   // RETRIEVE and STORE batches: the files in the order of the sent script,
+   // positions there of the file the next reply is for and of the file
+   // the data go for; batch_file is the index of the latter in the set.
+   xarray<int> batch_files;
+   int	 batch_reply;
+   int	 batch_data;
+   int	 batch_file;
+   bool	 batch_size_sent;
+   int	 BatchReplyFile() const
+      { return batch_reply<batch_files.count() ? batch_files[batch_reply] : -1; }
+   void	 SetBatchFile();
+   void	 FailBatchFiles();
+   int	 ReadBatch(Buffer *buf,int size);
+   int	 WriteBatch(const void *buf,int size);
+
+   // STORE with block_size set: the block being patched, the bytes of it
+   // still to send (its header is sent with the first ones).
+   off_t patch_block;
+   int	 patch_left;
+   bool	 patch_header_sent;
+   bool	 patch_end_sent;
+   int	 WritePatch(const void *buf,int size);
+
 public:
    static void ClassInit();
 
@@ -136,6 +164,15 @@ public:
 
    bool NeedSizeDateBeforehand() { return true; }
 
+   bool BatchSupported(open_mode m) const;
+   int GetBatchFile() const { return batch_file; }
+   void SkipBatchFile();
+
+   // hosts where #SUMS found no md5 command.
+   static xmap<bool> no_block_sums;
+   bool BlockSumsSupported() const { return !no_block_sums.lookup(hostname); }
+   void PatchBlock(off_t n);
+
    void SuspendInternal();
    void ResumeInternal();
 };
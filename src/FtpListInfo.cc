@@ -29,12 +29,51 @@
 #include "ftpclass.h"
 #include "ascii_ctype.h"
 
-#define number_of_parsers 7
+#define number_of_parsers Ftp::LongListParser::NUM_PARSERS
+
+int FtpListInfo::ParseMore(const char *buf,int len)
+{
+   if(mode!=FA::LONG_LIST && mode!=FA::MP_LIST)
+      return 0;
+   if(parser && parser_mode!=mode)
+   {
+      // the listing is being retried in another mode.
+      parser=0;
+      parsed_len=0;
+   }
+   if(!parser)
+   {
+      parser=new Ftp::LongListParser(ResMgr::Query("ftp:timezone",session->GetHostName()));
+      parser_mode=mode;
+   }
+   int n=parser->Parse(buf,len);
+   parsed_len+=n;
+   return n;
+}
+
+/* The entries parsed so far, once the format is known. They reach
+   consumers through ListInfo::TakePartial (mirror --streaming); find and
+   du still wait for the complete set, as they walk it in sorted order. */
+FileSet *FtpListInfo::TakeParsed()
+{
+   if(!parser || parser_mode!=mode)
+      return 0;
+   FileSet *set=parser->TakeGuessed();
+   if(set)
+      taken=true;
+   return set;
+}
 
 FileSet *FtpListInfo::Parse(const char *buf,int len)
 {
    if(mode==FA::LONG_LIST || mode==FA::MP_LIST)
    {
+      // the data could be parsed partially while being received.
+      len+=parsed_len;
+      ParseMore(buf,len-parsed_len);
+      parsed_len=0;
+      Ref<Ftp::LongListParser> p(parser.borrow());
+
       if(len==0 && mode==FA::LONG_LIST
       && !ResMgr::QueryBool("ftp:list-empty-ok",session->GetHostName()))
       {
@@ -42,7 +81,14 @@ FileSet *FtpListInfo::Parse(const char *buf,int len)
 	 return 0;
       }
       int err;
-      FileSet *set=session->ParseLongList(buf,len,&err);
+      FileSet *set=p->GetResult(&err);
+      if(taken)
+      {
+	 // a part of the listing is in use already, can't try another mode.
+	 if(!set)
+	    set=new FileSet;
+	 return set;
+      }
       if(!set || err>0)
       {
 	 if(mode==FA::MP_LIST)
@@ -58,100 +104,110 @@ FileSet *FtpListInfo::Parse(const char *buf,int len)
    }
 }
 
-FileSet *Ftp::ParseLongList(const char *buf,int len,int *err_ret) const
+Ftp::LongListParser::LongListParser(const char *tz_)
+   : tz(tz_), best_err1(0), best_err2(1), guessed(-1), failed(false)
 {
-   if(err_ret)
-      *err_ret=0;
-
-   int err[number_of_parsers];
-   FileSet *set[number_of_parsers];
-   int i;
-   for(i=0; i<number_of_parsers; i++)
+   for(int i=0; i<number_of_parsers; i++)
    {
       err[i]=0;
       set[i]=new FileSet;
    }
+}
+Ftp::LongListParser::~LongListParser()
+{
+   for(int i=0; i<number_of_parsers; i++)
+      delete set[i];
+}
 
-   xstring line;
-   xstring tmp_line;
-
-   FtpLineParser guessed_parser=0;
-   FileSet **the_set=0;
-   int *the_err=0;
-   int *best_err1=&err[0];
-   int *best_err2=&err[1];
-
-   const char *tz=Query("timezone",hostname);
-
-   for(;;)
+void Ftp::LongListParser::ParseLine()
+{
+   if(guessed<0)
    {
-      const char *nl=(char*)memchr(buf,'\n',len);
-      if(!nl)
-	 break;
-      line.nset(buf,nl-buf);
-      line.chomp('\r');
-      if(line.length()==0)
-      {
-	 len-=nl+1-buf;
-	 buf=nl+1;
-	 continue;
-      }
-
-      len-=nl+1-buf;
-      buf=nl+1;
-
-      if(!guessed_parser)
+      for(int i=0; i<number_of_parsers; i++)
       {
-	 for(i=0; i<number_of_parsers; i++)
-	 {
-	    tmp_line.set(line);	 // parser can clobber the line - work on a copy
-	    FileInfo *info=(*line_parsers[i])(tmp_line.get_non_const(),&err[i],tz);
-	    if(info && info->name.length()>1)
-	       info->name.chomp('/');
-	    if(info && !strchr(info->name,'/'))
-	       set[i]->Add(info);
-	    else
-	       delete info;
-
-	    if(*best_err1>err[i])
-	       best_err1=&err[i];
-	    if(*best_err2>err[i] && best_err1!=&err[i])
-	       best_err2=&err[i];
-	    if(*best_err1>16)
-	       goto leave; // too many errors with best parser.
-	 }
-	 if(*best_err2 > (*best_err1+1)*16)
-	 {
-	    i=best_err1-err;
-	    guessed_parser=line_parsers[i];
-	    the_set=&set[i];
-	    the_err=&err[i];
-	 }
-      }
-      else
-      {
-	 FileInfo *info=(*guessed_parser)(line.get_non_const(),the_err,tz);
+	 tmp_line.set(line);	 // parser can clobber the line - work on a copy
+	 FileInfo *info=(*line_parsers[i])(tmp_line.get_non_const(),&err[i],tz);
 	 if(info && info->name.length()>1)
 	    info->name.chomp('/');
 	 if(info && !strchr(info->name,'/'))
-	    (*the_set)->Add(info);
+	    set[i]->Add(info);
 	 else
 	    delete info;
+
+	 if(err[best_err1]>err[i])
+	    best_err1=i;
+	 if(err[best_err2]>err[i] && best_err1!=i)
+	    best_err2=i;
+	 if(err[best_err1]>16)
+	 {
+	    failed=true; // too many errors with best parser.
+	    return;
+	 }
       }
+      if(err[best_err2] > (err[best_err1]+1)*16)
+	 guessed=best_err1;
    }
-   if(!the_set)
+   else
    {
-      i=best_err1-err;
-      the_set=&set[i];
-      the_err=&err[i];
+      FileInfo *info=(*line_parsers[guessed])(line.get_non_const(),&err[guessed],tz);
+      if(info && info->name.length()>1)
+	 info->name.chomp('/');
+      if(info && !strchr(info->name,'/'))
+	 set[guessed]->Add(info);
+      else
+	 delete info;
    }
-leave:
-   for(i=0; i<number_of_parsers; i++)
-      if(&set[i]!=the_set)
-	 delete set[i];
-   if(err_ret && the_err)
-      *err_ret=*the_err;
-   return the_set?*the_set:0;
+}
+
+int Ftp::LongListParser::Parse(const char *buf,int len)
+{
+   const char *start=buf;
+   while(!failed)
+   {
+      const char *nl=(const char*)memchr(buf,'\n',len);
+      if(!nl)
+	 break;
+      line.nset(buf,nl-buf);
+      line.chomp('\r');
+      len-=nl+1-buf;
+      buf=nl+1;
+      if(line.length()==0)
+	 continue;
+      ParseLine();
+   }
+   if(failed)
+      return buf-start+len;   // the rest is of no use
+   return buf-start;
+}
+
+FileSet *Ftp::LongListParser::GetResult(int *err_ret)
+{
+   if(err_ret)
+      *err_ret=0;
+   if(failed)
+      return 0;
+   int i=(guessed>=0?guessed:best_err1);
+   if(err_ret)
+      *err_ret=err[i];
+   FileSet *result=set[i];
+   set[i]=0;
+   return result;
+}
+
+FileSet *Ftp::LongListParser::TakeGuessed()
+{
+   if(failed || guessed<0 || err[guessed]>0 || set[guessed]->count()==0)
+      return 0;
+   FileSet *result=set[guessed];
+   set[guessed]=new FileSet;
+   return result;
+}
+
+FileSet *Ftp::ParseLongList(const char *buf,int len,int *err_ret) const
+{
+   LongListParser parser(Query("timezone",hostname));
+   parser.Parse(buf,len);
+   return parser.GetResult(err_ret);
 }
 
 FileSet *FtpListInfo::ParseShortList(const char *buf,int len)
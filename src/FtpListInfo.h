@@ -21,13 +21,23 @@
 #define FTPLISTINFO_H
 
 #include "NetAccess.h"
+#include "ftpclass.h"
 
 class FtpListInfo : public GenericParseListInfo
 {
+   Ref<Ftp::LongListParser> parser;
+   int parser_mode;
+   int parsed_len;
+   bool taken;
+
    FileSet *ParseShortList(const char *buf,int len);
 public:
+   virtual int ParseMore(const char *buf,int len);
    virtual FileSet *Parse(const char *buf,int len);
-   FtpListInfo(FileAccess *session,const char *path) : GenericParseListInfo(session,path) {}
+   virtual FileSet *TakeParsed();
+   FtpListInfo(FileAccess *session,const char *path)
+      : GenericParseListInfo(session,path), parser_mode(FA::CLOSED), parsed_len(0),
+	taken(false) {}
 };
 
 #endif//FTPLISTINFO_H
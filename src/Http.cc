@@ -30,6 +30,7 @@
 #include <locale.h>
 #include <assert.h>
 #include "Http.h"
+#include "Http2.h"
 #include "ResMgr.h"
 #include "log.h"
 #include "url.h"
@@ -124,10 +125,14 @@ enum { CHUNK_SIZE_UNKNOWN=-1 };
 Http::Connection::Connection(int s,const char *c)
    : closure(c), sock(s)
 {
+#if USE_SSL
+   alpn=false;
+#endif
 }
 Http::Connection::~Connection()
 {
-   close(sock);
+   if(sock!=-1)
+      close(sock);
    /* make sure we free buffers before ssl */
    recv_buf=0;
    send_buf=0;
@@ -159,6 +164,11 @@ void Http::Init()
 
    array_send=0;
 
+   batch_next=0;
+   batch_file=-1;
+   batch_replies=0;
+   batch_pipelined=false;
+
    chunked=false;
    chunked_trailer=false;
    chunk_size=CHUNK_SIZE_UNKNOWN;
@@ -225,6 +235,8 @@ void Http::DisconnectLL()
 {
    Enter(this);
    rate_limit=0;
+   if(mode==BATCH && fileset_for_batch)
+      FailBatchFiles();
    if(conn)
    {
       LogNote(7,_("Closing HTTP connection"));
@@ -284,7 +296,8 @@ void Http::Close()
    if(conn && conn->recv_buf)
       conn->recv_buf->Roll();	// try to read any remaining data
    if(conn && keep_alive && (keep_alive_max>0 || keep_alive_max==-1)
-   && !ModeIs(STORE) && !conn->recv_buf->Eof() && (state==RECEIVING_BODY || state==DONE))
+   && !ModeIs(STORE) && !conn->recv_buf->Eof() && (state==RECEIVING_BODY || state==DONE)
+   && batch_sent.count()==0)
    {
       conn->recv_buf->Resume();
       conn->recv_buf->Roll();
@@ -303,6 +316,7 @@ void Http::Close()
       state=CONNECTED;
       ResetRequestData();
       rate_limit=0;
+      PoolConnection();
    }
    else
    {
@@ -311,6 +325,11 @@ void Http::Close()
       DontSleep();
    }
    array_send=0;
+   batch_sent.truncate();
+   batch_next=0;
+   batch_file=-1;
+   batch_replies=0;
+   batch_pipelined=false;
    no_cache_this=false;
    auth_sent[0]=auth_sent[1]=0;
    auth_scheme[0]=auth_scheme[1]=HttpAuth::NONE;
@@ -514,7 +533,11 @@ bool Http::ModeSupported()
    case CHANGE_MODE:
    case LINK:
    case SYMLINK:
+   case COPY:
+   case BLOCK_SUMS:
       return false;
+   case BATCH:
+      return batch_mode==RETRIEVE;
    case CONNECT_VERIFY:
    case RETRIEVE:
    case STORE:
@@ -744,8 +767,11 @@ void Http::SendRequest(const char *connection,const char *f)
    case CHANGE_MODE:
    case LINK:
    case SYMLINK:
+   case COPY:
+   case BLOCK_SUMS:
       abort(); // unsupported
 
+   case BATCH:	// only RETRIEVE is supported
    case RETRIEVE:
    retrieve:
       SendMethod("GET",efile);
@@ -962,6 +988,118 @@ void Http::ProceedArrayInfo()
    }
 }
 
+bool Http::BatchSupported(open_mode m) const
+{
+   return m==RETRIEVE && !hftp && (int)Query("pipeline-depth",hostname)>0;
+}
+
+void Http::SendBatchRequests()
+{
+   // the first request on a connection goes alone, the reply tells
+   // if the server keeps the connection open.
+   int depth=1;
+   if(keep_alive && proto_version>=0x11)
+   {
+      depth=Query("pipeline-depth",hostname);
+      if(keep_alive_max>0 && depth>keep_alive_max)
+	 depth=keep_alive_max;
+      if(depth<1)
+	 depth=1;
+   }
+   int sent=batch_sent.count();
+   while(batch_sent.count()<depth && batch_next<fileset_for_batch->count())
+   {
+      int i=batch_next++;
+      if(GetBatchResult(i)!=IN_PROGRESS)
+	 continue;
+      file_url.unset();
+      pos=0;
+      SendRequest("keep-alive",(*fileset_for_batch)[i]->name);
+      batch_sent.append(i);
+   }
+   if(batch_sent.count()>1 && batch_sent.count()>sent && !batch_pipelined)
+   {
+      LogNote(9,"pipelining %d requests",batch_sent.count());
+      batch_pipelined=true;
+      batch_replies=0;
+   }
+}
+
+void Http::ProceedBatch()
+{
+   // the reply to batch_sent[0] is complete.
+   if(batch_file!=-1)
+      SetBatchResult(batch_file,OK);
+   batch_file=-1;
+   if(batch_sent.count()>0)
+      batch_sent.remove(0);
+   batch_replies++;
+
+   // prepare to receive the next reply
+   status.set(0);
+   status_code=0;
+   status_consumed=0;
+   body_size=-1;
+   bytes_received=0;
+   chunked=false;
+   chunked_trailer=false;
+   chunk_size=CHUNK_SIZE_UNKNOWN;
+   chunk_pos=0;
+   inflate=0;
+   content_encoding.set(0);
+   pos=real_pos=0;
+   entity_size=NO_SIZE;
+
+   if(!keep_alive || !(keep_alive_max>1 || keep_alive_max==-1))
+   {
+      bool more=(batch_sent.count()>0);
+      for(int i=batch_next; !more && i<fileset_for_batch->count(); i++)
+	 more=(GetBatchResult(i)==IN_PROGRESS);
+      if(!more)
+      {
+	 state=DONE;
+	 return;
+      }
+      // the server closes the connection, the rest goes over a new one.
+      batch_sent.truncate();
+      Disconnect();
+      DontSleep();
+      return;
+   }
+   state=CONNECTED;
+   SendBatchRequests();
+   if(batch_sent.count()==0)
+   {
+      state=DONE;
+      return;
+   }
+   keep_alive=false;	// the next reply tells again
+   keep_alive_max=-1;
+   state=RECEIVING_HEADER;
+}
+
+void Http::FailBatchFiles()
+{
+   // the file some data of which have been passed on cannot be requested again.
+   if(batch_file!=-1 && pos>0)
+      SetBatchResult(batch_file,NO_FILE,_("Peer closed connection"));
+   pos=0;
+   entity_size=NO_SIZE;
+   // a server closing the connection before answering any of the
+   // pipelined requests does not handle pipelining.
+   if(batch_pipelined && batch_replies==0 && batch_sent.count()>0
+   && conn && conn->recv_buf && (conn->recv_buf->Eof() || conn->recv_buf->Error()))
+   {
+      LogError(0,"the server does not seem to support pipelining, turning it off");
+      ResMgr::Set("http:pipeline-depth",hostname,"0");
+   }
+   batch_sent.truncate();
+   batch_next=0;
+   batch_file=-1;
+   batch_replies=0;
+   batch_pipelined=false;
+}
+
 void Http::NewAuth(const char *hdr,HttpAuth::target_t target,const char *user,const char *pass)
 {
    if(!user || !pass)
@@ -1188,6 +1326,152 @@ const char *find_eol(const char *p,int len,int *eol_size)
    return 0;
 }
 
+SMTaskRef<Http::ConnectionPool> Http::connection_pool;
+
+const xstring& Http::PoolKey() const
+{
+   return xstring::format("%s://%s:%s %s:%s",GetProto(),hostname.get(),
+      portname?portname.get():"",proxy?proxy.get():"",proxy_port?proxy_port.get():"");
+}
+
+void Http::PoolConnection()
+{
+   if(conn->h2)
+   {
+      // the HTTP/2 connection is shared anyway, a new channel is cheap.
+      conn=0;
+   }
+   else
+   {
+      if(!connection_pool)
+	 connection_pool=new ConnectionPool();
+      if(!connection_pool->Put(PoolKey(),conn,tunnel_state==TUNNEL_ESTABLISHED,hostname))
+	 return;  // the session keeps it while idle.
+      LogNote(9,"keeping the connection in the pool");
+   }
+   last_method=0;
+   last_uri.unset();
+   last_url.unset();
+   tunnel_state=NO_TUNNEL;
+   state=DISCONNECTED;
+}
+
+bool Http::TakePooledConnection()
+{
+   if(!connection_pool)
+      return false;
+   bool tunnel=false;
+   Connection *c=connection_pool->Get(PoolKey(),&tunnel);
+   if(!c)
+      return false;
+   LogNote(9,"reusing a pooled connection");
+   conn=c;
+   tunnel_state=(tunnel?TUNNEL_ESTABLISHED:NO_TUNNEL);
+   state=CONNECTED;
+   timeout_timer.Reset();
+   return true;
+}
+
+const char *Http::Alpn() const
+{
+   if(hftp || !QueryBool("use-http2",hostname))
+      return 0;
+   return "h2,http/1.1";
+}
+
+void Http::UseHttp2()
+{
+   LogNote(9,"using HTTP/2");
+   Http2Connection *h2=new Http2Connection(PoolKey(),hostname,conn.borrow());
+   Http2Connection::Add(h2);
+   conn=h2->OpenChannel();
+}
+
+bool Http::TakeHttp2Channel()
+{
+   if(!https || hftp || !QueryBool("use-http2",hostname))
+      return false;
+   Http2Connection *h2=Http2Connection::Find(PoolKey());
+   if(!h2)
+      return false;
+   LogNote(9,"sharing an HTTP/2 connection");
+   conn=h2->OpenChannel();
+   tunnel_state=NO_TUNNEL;
+   state=CONNECTED;
+   timeout_timer.Reset();
+   return true;
+}
+
+bool Http::ConnectionPool::Healthy(Connection *c)
+{
+   if(!c->send_buf || !c->recv_buf)
+      return false;
+   c->recv_buf->Roll();
+   // a server closing the connection or sending anything unrequested.
+   return !c->recv_buf->Eof() && !c->recv_buf->Error() && c->recv_buf->Size()==0
+      && !c->send_buf->Error() && c->send_buf->Size()==0;
+}
+
+bool Http::ConnectionPool::Put(const xstring& key,Ref<Connection>& c,bool tunnel,const char *host)
+{
+   int max=ResMgr::Query("http:pool-max-idle",host);
+   if(max<=0 || !Healthy(c.get_non_const()))
+      return false;
+   int count=0;
+   int oldest=-1;
+   for(int i=0; i<entries.count(); i++)
+   {
+      if(!entries[i]->key.eq(key))
+	 continue;
+      if(oldest==-1)
+	 oldest=i;
+      count++;
+   }
+   if(count>=max)
+      entries.remove(oldest);
+   c->ResumeInternal();
+   entries.append(new Entry(key,c.borrow(),tunnel,host));
+   return true;
+}
+
+Http::Connection *Http::ConnectionPool::Get(const xstring& key,bool *tunnel)
+{
+   // the most recently used connection is the most likely to be alive.
+   for(int i=entries.count()-1; i>=0; i--)
+   {
+      Entry *e=entries[i];
+      if(!e->key.eq(key))
+	 continue;
+      Connection *c=0;
+      if(!e->idle.Stopped() && Healthy(e->conn.get_non_const()))
+      {
+	 *tunnel=e->tunnel;
+	 c=e->conn.borrow();
+      }
+      entries.remove(i);
+      if(c)
+	 return c;
+   }
+   return 0;
+}
+
+int Http::ConnectionPool::Do()
+{
+   int m=STALL;
+   for(int i=0; i<entries.count(); i++)
+   {
+      Entry *e=entries[i];
+      const SMTaskRef<IOBuffer>& in=e->conn->recv_buf;
+      if(e->idle.Stopped() || in->Eof() || in->Error() || in->Size()>0)
+      {
+	 Log::global->Format(9,"---- closing pooled connection %s\n",e->key.get());
+	 entries.remove(i--);
+	 m=MOVED;
+      }
+   }
+   return m;
+}
+
 void Http::GetBetterConnection(int level)
 {
    if(level==0)
@@ -1383,6 +1667,9 @@ int Http::Do()
 	 }
       }
 
+      if(TakeHttp2Channel() || TakePooledConnection())
+	 return MOVED;
+
       // walk through Http classes and try to find identical idle session
       // first try "easy" cases of session take-over.
       for(int i=0; i<3; i++)
@@ -1475,7 +1762,7 @@ int Http::Do()
 #if USE_SSL
       if(proxy?!strncmp(proxy,"https://",8):https)
       {
-	 conn->MakeSSLBuffers();
+	 conn->MakeSSLBuffers(proxy?0:SSLSessionKey(),proxy?0:Alpn());
       }
       else
 #endif
@@ -1513,6 +1800,28 @@ int Http::Do()
       }
       if(mode==CLOSED)
 	 return m;
+#if USE_SSL
+      if(conn->alpn)
+      {
+	 // the server tells in the handshake if it talks HTTP/2.
+	 if(!conn->ssl->handshake_done)
+	 {
+	    if(conn->send_buf->Error() || conn->recv_buf->Error())
+	       goto handle_buf_error;
+	    timeout_timer.Reset(conn->send_buf->EventTime());
+	    timeout_timer.Reset(conn->recv_buf->EventTime());
+	    if(CheckTimeout())
+	       return MOVED;
+	    return m;
+	 }
+	 conn->alpn=false;
+	 if(!xstrcmp(conn->ssl->alpn,"h2"))
+	 {
+	    UseHttp2();
+	    return MOVED;
+	 }
+      }
+#endif
       if(!special && !ModeSupported())
       {
 	 SetError(NOT_SUPP);
@@ -1532,6 +1841,14 @@ int Http::Do()
 	    return MOVED;
 	 }
       }
+      else if(mode==BATCH)
+      {
+	 SendBatchRequests();
+	 if(batch_sent.count()==0) {
+	    state=DONE;
+	    return MOVED;
+	 }
+      }
       else
       {
 	 LogNote(9,_("Sending request..."));
@@ -1596,7 +1913,7 @@ int Http::Do()
 		  {
 #if USE_SSL
 		     if(https)
-			conn->MakeSSLBuffers();
+			conn->MakeSSLBuffers(SSLSessionKey(),Alpn());
 #endif
 		     tunnel_state=TUNNEL_ESTABLISHED;
 		     ResetRequestData();
@@ -1606,6 +1923,11 @@ int Http::Do()
 	       }
 	       if(chunked_trailer)
 	       {
+		  if(mode==BATCH)
+		  {
+		     ProceedBatch();
+		     return MOVED;
+		  }
 		  chunked_trailer=false;
 		  chunked=false;
 		  if(propfind) {
@@ -1693,6 +2015,14 @@ int Http::Do()
 		  proto_version=0x09;
 		  status_code=H_Ok;
 		  LogError(0,_("Could not parse HTTP status line"));
+		  if(mode==BATCH && batch_pipelined)
+		  {
+		     // garbage in place of a pipelined reply.
+		     LogError(0,"the server does not seem to support pipelining, turning it off");
+		     ResMgr::Set("http:pipeline-depth",hostname,"0");
+		     Disconnect();
+		     return MOVED;
+		  }
 		  if(ModeIs(STORE))
 		  {
 		     state=DONE;
@@ -1721,7 +2051,7 @@ int Http::Do()
 		     const char *cc=Query("cache-control");
 		     if(cc && strstr(cc,"only-if-cached"))
 		     {
-			if(mode!=ARRAY_INFO)
+			if(mode!=ARRAY_INFO && mode!=BATCH)
 			{
 			   SetError(NO_FILE,_("Object is not cached and http:cache-control has only-if-cached"));
 			   return MOVED;
@@ -1765,7 +2095,8 @@ int Http::Do()
 	 }
       }
 
-      if(ModeIs(STORE) && (!status || H_CONTINUE(status_code)) && !sent_eot)
+      if(ModeIs(STORE) && (!status || H_CONTINUE(status_code)) && !sent_eot
+      && conn->sock!=-1)
 	 Block(conn->sock,POLLOUT);
 
       return m;
@@ -1805,17 +2136,20 @@ int Http::Do()
       {
 	 xstring err;
 	 int code=NO_FILE;
+	 const char *name=file;
+	 if(mode==BATCH && batch_sent.count()>0)
+	    name=(*fileset_for_batch)[batch_sent[0]]->name;
 
 	 if(H_REDIRECTED(status_code))
 	 {
 	    HandleRedirection();
-	    err.setf("%s (%s -> %s)",status+status_consumed,file.get(),
+	    err.setf("%s (%s -> %s)",status+status_consumed,name,
 				    location?location.get():"nowhere");
 	    code=FILE_MOVED;
 	 }
 	 else
 	 {
-	    const char *closure=file;
+	    const char *closure=name;
 	    if(H_UNSUPPORTED(status_code) || status_code==H_Method_Not_Allowed)
 	    {
 	       if(H_UNSUPPORTED(status_code))
@@ -1850,6 +2184,16 @@ int Http::Do()
 	    Disconnect();
 	    DontSleep();
 	 }
+	 else if(mode==BATCH && batch_sent.count()>0)
+	 {
+	    // the error body is not read, the requests after this one
+	    // are sent again over a new connection.
+	    SetBatchResult(batch_sent[0],code,err);
+	    batch_sent.remove(0);
+	    batch_replies++;
+	    Disconnect();
+	    DontSleep();
+	 }
 	 else
 	    SetError(code,err);
 	 return MOVED;
@@ -1900,6 +2244,8 @@ int Http::Do()
 	 }
 	 real_pos=0;
       }
+      if(mode==BATCH && batch_sent.count()>0)
+	 batch_file=batch_sent[0];
       state=RECEIVING_BODY;
       m=MOVED;
       /*passthrough*/
@@ -2051,6 +2397,13 @@ int Http::Read(Buffer *buf,int size)
 	    rate_limit->BytesGot(res);
 	 TrySuccess();
       }
+      else if(res==0 && mode==BATCH)
+      {
+	 // the file is complete, go on with the next reply.
+	 ProceedBatch();
+	 Timeout(0);
+	 res=DO_AGAIN;
+      }
       Leave(this);
    }
    return res;
@@ -2294,7 +2647,10 @@ int Http::SendEOT()
       {
 	 if(entity_size==NO_SIZE || pos<entity_size)
 	 {
-	    shutdown(conn->sock,1);
+	    if(conn->h2)
+	       conn->send_buf->PutEOF();
+	    else
+	       shutdown(conn->sock,1);
 	    keep_alive=false;
 	 }
 	 sent_eot=true;
@@ -2376,7 +2732,7 @@ void Http::Reconfig(const char *name)
       SetProxy(p);
    }
 
-   if(conn)
+   if(conn && conn->sock!=-1)
       SetSocketBuffer(conn->sock);
    if(proxy && proxy_port==0)
       proxy_port.set(HTTP_DEFAULT_PROXY_PORT);
@@ -2640,10 +2996,22 @@ Https::Https(const Https *o) : super(o)
 }
 FileAccess *Https::New(){ return new Https();}
 
-void Http::Connection::MakeSSLBuffers()
+const char *Http::SSLSessionKey() const
+{
+   const char *port=portname?portname.get():HTTPS_DEFAULT_PORT;
+   return xstring::cat(hostname.get(),":",port,NULL);
+}
+
+void Http::Connection::MakeSSLBuffers(const char *session_key,const char *protocols)
 {
    ssl=new lftp_ssl(sock,lftp_ssl::CLIENT,closure);
    ssl->load_keys();
+   ssl->resume_session(session_key);
+   if(protocols)
+   {
+      ssl->set_alpn(protocols);
+      alpn=true;
+   }
    IOBufferSSL *send_buf_ssl=new IOBufferSSL(ssl,IOBuffer::PUT);
    IOBufferSSL *recv_buf_ssl=new IOBufferSSL(ssl,IOBuffer::GET);
    send_buf=send_buf_ssl;
@@ -26,8 +26,13 @@
 #include "HttpHeader.h"
 #include "HttpAuth.h"
 
+class Http2Channel;
+class Http2Connection;
+
 class Http : public NetAccess
 {
+   friend class Http2Connection;
+
    enum state_t
    {
       DISCONNECTED,
@@ -63,8 +68,10 @@ class Http : public NetAccess
       void MakeBuffers();
 #if USE_SSL
       Ref<lftp_ssl> ssl;
-      void MakeSSLBuffers();
+      bool alpn;  // the protocol is to be checked after the handshake
+      void MakeSSLBuffers(const char *session_key,const char *protocols=0);
 #endif
+      Ref<Http2Channel> h2;  // sock is -1, buffers lead to a HTTP/2 stream
 
       void SuspendInternal()
       {
@@ -83,6 +90,41 @@ class Http : public NetAccess
 
    Ref<Connection> conn;
 
+   /* Idle keep-alive connections of all sessions, keyed by scheme, host,
+      port and proxy. A session puts its connection here when a request is
+      complete and takes one for the next request, so a connection can be
+      used by any session and outlives the one which made it
+      (http:pool-max-idle, http:pool-idle). */
+   class ConnectionPool : public SMTask
+   {
+      struct Entry
+      {
+	 xstring key;
+	 Ref<Connection> conn;
+	 bool tunnel;
+	 Timer idle;
+	 Entry(const xstring& k,Connection *c,bool t,const char *host)
+	    : conn(c), tunnel(t), idle("http:pool-idle",host) { key.set(k); }
+      };
+      xarray_p<Entry> entries;
+
+      static bool Healthy(Connection *c);
+
+   public:
+      bool Put(const xstring& key,Ref<Connection>& c,bool tunnel,const char *host);
+      Connection *Get(const xstring& key,bool *tunnel);
+      int Do();
+   };
+   static SMTaskRef<ConnectionPool> connection_pool;
+   const xstring& PoolKey() const;
+   void PoolConnection();
+   bool TakePooledConnection();
+
+   // HTTP/2 connections are shared by sessions instead of pooled (http:use-http2).
+   const char *Alpn() const;
+   void UseHttp2();
+   bool TakeHttp2Channel();
+
    static void AppendHostEncoded(xstring&,const char *);
    void SendMethod(const char *,const char *);
    const char *last_method;
@@ -105,6 +147,18 @@ class Http : public NetAccess
       }
    int SendArrayInfoRequest(); // returns count of sent requests
    void ProceedArrayInfo();
+
+   // RETRIEVE batch: the GET requests are pipelined, batch_sent holds
+   // the files the replies are awaited for in the order of the requests,
+   // batch_file is the one the body being read belongs to.
+   xarray<int> batch_sent;
+   int batch_next;	// where to look for the next file to request
+   int batch_file;
+   int batch_replies;	// since the pipelining began on this connection
+   bool batch_pipelined;
+   void SendBatchRequests();
+   void ProceedBatch();
+   void FailBatchFiles();
    void SendPropfind(const xstring& efile,int depth);
    void SendPropfindBody();
    static const xstring& FormatLastModified(time_t);
@@ -199,6 +253,9 @@ protected:
    bool hftp;  // ftp over http proxy.
    bool https; // secure http
    bool use_head;
+#if USE_SSL
+   const char *SSLSessionKey() const;
+#endif
 
 public:
    static void ClassInit();
@@ -239,6 +296,9 @@ public:
 
    bool NeedSizeDateBeforehand() { return true; }
 
+   bool BatchSupported(open_mode m) const;
+   int GetBatchFile() const { return batch_file; }
+
    void SuspendInternal();
    void ResumeInternal();
 
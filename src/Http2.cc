@@ -0,0 +1,1010 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include "Http2.h"
+#include "misc.h"
+
+enum {
+   FRAME_DATA=0x0,
+   FRAME_HEADERS=0x1,
+   FRAME_PRIORITY=0x2,
+   FRAME_RST_STREAM=0x3,
+   FRAME_SETTINGS=0x4,
+   FRAME_PUSH_PROMISE=0x5,
+   FRAME_PING=0x6,
+   FRAME_GOAWAY=0x7,
+   FRAME_WINDOW_UPDATE=0x8,
+   FRAME_CONTINUATION=0x9,
+
+   FLAG_ACK=0x1,
+   FLAG_END_STREAM=0x1,
+   FLAG_END_HEADERS=0x4,
+   FLAG_PADDED=0x8,
+   FLAG_PRIORITY=0x20,
+
+   SETTINGS_HEADER_TABLE_SIZE=0x1,
+   SETTINGS_ENABLE_PUSH=0x2,
+   SETTINGS_MAX_CONCURRENT_STREAMS=0x3,
+   SETTINGS_INITIAL_WINDOW_SIZE=0x4,
+   SETTINGS_MAX_FRAME_SIZE=0x5,
+
+   ERROR_NO_ERROR=0x0,
+   ERROR_PROTOCOL=0x1,
+   ERROR_FLOW_CONTROL=0x3,
+   ERROR_REFUSED_STREAM=0x7,
+   ERROR_CANCEL=0x8,
+   ERROR_COMPRESSION=0x9,
+};
+
+static const char preface[]="PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const int frame_header_size=9;
+static const int default_window=65535;
+static const int stream_window=0x100000;  // what we announce
+static const int conn_window=0x1000000;
+static const int max_recv_frame=0x1000000;
+static const int send_buf_limit=0x10000;
+
+static const char *error_name(unsigned code)
+{
+   static const char *const names[]={
+      "NO_ERROR","PROTOCOL_ERROR","INTERNAL_ERROR","FLOW_CONTROL_ERROR",
+      "SETTINGS_TIMEOUT","STREAM_CLOSED","FRAME_SIZE_ERROR","REFUSED_STREAM",
+      "CANCEL","COMPRESSION_ERROR","CONNECT_ERROR","ENHANCE_YOUR_CALM",
+      "INADEQUATE_SECURITY","HTTP_1_1_REQUIRED",
+   };
+   if(code<sizeof(names)/sizeof(*names))
+      return names[code];
+   return "unknown error";
+}
+
+static const char *reason_phrase(int code)
+{
+   switch(code)
+   {
+   case 100: return "Continue";
+   case 200: return "OK";
+   case 201: return "Created";
+   case 204: return "No Content";
+   case 206: return "Partial Content";
+   case 207: return "Multi-Status";
+   case 301: return "Moved Permanently";
+   case 302: return "Found";
+   case 303: return "See Other";
+   case 304: return "Not Modified";
+   case 307: return "Temporary Redirect";
+   case 308: return "Permanent Redirect";
+   case 400: return "Bad Request";
+   case 401: return "Unauthorized";
+   case 403: return "Forbidden";
+   case 404: return "Not Found";
+   case 405: return "Method Not Allowed";
+   case 416: return "Range Not Satisfiable";
+   case 429: return "Too Many Requests";
+   case 500: return "Internal Server Error";
+   case 501: return "Not Implemented";
+   case 502: return "Bad Gateway";
+   case 503: return "Service Unavailable";
+   }
+   return "";
+}
+
+// strip the padding of DATA, HEADERS and PUSH_PROMISE
+static bool unpad(int flags,const char *&p,unsigned &len)
+{
+   if(!(flags&FLAG_PADDED))
+      return true;
+   if(len<1)
+      return false;
+   unsigned pad=(unsigned char)*p;
+   if(pad>=len)
+      return false;
+   p++;
+   len-=1+pad;
+   return true;
+}
+
+static unsigned get_uint32(const char *p)
+{
+   const unsigned char *u=(const unsigned char*)p;
+   return (u[0]<<24)|(u[1]<<16)|(u[2]<<8)|u[3];
+}
+
+// Http2Channel implementation
+Http2Channel::Http2Channel(Http2Connection *c)
+   : h2(c), send_buf(0), recv_buf(0), id(0), send_window(0), recv_unacked(0),
+     req_state(REQ_HEAD), req_left(0), head_method(false),
+     reply_state(REPLY_DONE), reply_chunked(false)
+{
+}
+Http2Channel::~Http2Channel()
+{
+   if(send_buf)
+      send_buf->channel=0;
+   if(recv_buf)
+      recv_buf->channel=0;
+   if(h2)
+      h2->Detach(this);
+}
+
+bool Http2Channel::ParseRequest()
+{
+   const char *line=req;
+   const char *end=line+req.length();
+   const char *eol=strstr(line,"\r\n");
+   const char *sp1=(const char*)memchr(line,' ',eol-line);
+   const char *sp2=sp1?(const char*)memchr(sp1+1,' ',eol-sp1-1):0;
+   if(!sp2)
+      return false;
+   xstring method(line,sp1-line);
+   xstring path(sp1+1,sp2-sp1-1);
+   xstring authority;
+   xstring rest;
+
+   head_method=method.eq("HEAD");
+   req_left=(method.eq("PUT") || method.eq("POST") ? -1 : 0);
+
+   for(line=eol+2; line<end; line=eol+2)
+   {
+      eol=strstr(line,"\r\n");
+      if(eol==line)
+	 break;
+      const char *colon=(const char*)memchr(line,':',eol-line);
+      if(!colon)
+	 return false;
+      xstring name(line,colon-line);
+      name.c_lc();
+      const char *v=colon+1;
+      while(v<eol && (*v==' ' || *v=='\t'))
+	 v++;
+      xstring value(v,eol-v);
+      // connection-specific headers are not allowed in HTTP/2
+      if(name.eq("host"))
+      {
+	 authority.set(value);
+	 continue;
+      }
+      if(name.eq("connection") || name.eq("keep-alive")
+      || name.eq("proxy-connection") || name.eq("transfer-encoding")
+      || name.eq("upgrade") || (name.eq("te") && !value.eq_nc("trailers")))
+	 continue;
+      if(name.eq("content-length"))
+	 req_left=atoll(value);
+      HpackEncoder::Encode(rest,name,value);
+   }
+
+   req.truncate();
+   HpackEncoder::Encode(req,":method",method);
+   HpackEncoder::Encode(req,":scheme","https");
+   HpackEncoder::Encode(req,":authority",authority);
+   HpackEncoder::Encode(req,":path",path);
+   req.append(rest);
+   req_state=REQ_OPEN;
+   return true;
+}
+
+int Http2Channel::Send(const char *buf,int size)
+{
+   if(!h2 || req_state==REQ_DISCARD)
+   {
+      if(req_state==REQ_DISCARD)
+	 return size;  // the reply is already there
+      send_buf->SetError(_("HTTP/2 connection closed"),false);
+      return -1;
+   }
+   int total=0;
+   while(size>0)
+   {
+      if(req_state==REQ_HEAD)
+      {
+	 if(id)
+	    break;   // the previous reply is not complete yet
+	 if(h2->goaway)
+	 {
+	    if(total>0)
+	       break;
+	    send_buf->SetError(_("HTTP/2 connection closed"),false);
+	    return -1;
+	 }
+	 int old=req.length();
+	 req.append(buf,size);
+	 const char *hdr_end=strstr(req.get()+(old>3?old-3:0),"\r\n\r\n");
+	 if(!hdr_end)
+	 {
+	    if(req.length()>0x10000)
+	    {
+	       send_buf->SetError(_("request header is too long"),true);
+	       return -1;
+	    }
+	    total+=size;
+	    break;
+	 }
+	 int used=hdr_end+4-req.get()-old;
+	 req.truncate(hdr_end+4-req.get());
+	 total+=used;
+	 buf+=used;
+	 size-=used;
+	 if(!ParseRequest())
+	 {
+	    send_buf->SetError(_("invalid request"),true);
+	    return -1;
+	 }
+	 Flush();
+	 continue;
+      }
+      if(req_state==REQ_BODY)
+      {
+	 int res=h2->SendData(this,buf,size);
+	 if(res<=0)
+	    break;
+	 total+=res;
+	 buf+=res;
+	 size-=res;
+	 continue;
+      }
+      break;   // waiting for a stream, or the request is complete
+   }
+   return total;
+}
+
+// open the stream of a pending request, finish a body going up to EOF.
+void Http2Channel::Flush()
+{
+   if(!h2)
+      return;
+   if(req_state==REQ_OPEN && h2->CanOpenStream())
+   {
+      id=h2->next_id;
+      h2->next_id+=2;
+      send_window=h2->initial_window;
+      recv_unacked=0;
+      reply_state=REPLY_HEAD;
+      reply_chunked=false;
+      bool end=(req_left==0);
+      h2->SendHeaders(id,req,end);
+      req.truncate();
+      req_state=(end?REQ_DONE:REQ_BODY);
+   }
+   if(req_state==REQ_BODY && send_buf && send_buf->Eof() && send_buf->Size()==0)
+   {
+      if(req_left>0)
+      {
+	 // the body is shorter than announced.
+	 h2->SendReset(id,ERROR_CANCEL);
+	 Fail(_("request body is incomplete"));
+	 return;
+      }
+      h2->SendFrame(FRAME_DATA,FLAG_END_STREAM,id,0,0);
+      req_state=REQ_DONE;
+   }
+}
+
+int Http2Channel::Receive(int size)
+{
+   int res=recv_buf->MoveDataHere(&in,size);
+   // give the window back when the session has consumed the data.
+   if(h2 && id && reply_state!=REPLY_DONE && recv_unacked>=0x4000
+   && in.Size()<stream_window/2)
+   {
+      h2->SendWindowUpdate(id,recv_unacked);
+      recv_unacked=0;
+   }
+   return res;
+}
+
+void Http2Channel::Reply(const xarray_p<HttpHeader>& hdr,bool end)
+{
+   if(reply_state==REPLY_HEAD)
+   {
+      int code=0;
+      for(int i=0; i<hdr.count(); i++)
+	 if(!strcmp(hdr[i]->GetName(),":status"))
+	    code=atoi(hdr[i]->GetValue());
+      if(code<100 || code>999)
+      {
+	 h2->SendReset(id,ERROR_PROTOCOL);
+	 Fail(_("invalid HTTP/2 reply"));
+	 return;
+      }
+      in.Format("HTTP/1.1 %d %s\r\n",code,reason_phrase(code));
+      bool length=false;
+      for(int i=0; i<hdr.count(); i++)
+      {
+	 const char *name=hdr[i]->GetName();
+	 if(name[0]==':')
+	    continue;
+	 if(!strcmp(name,"content-length"))
+	    length=true;
+	 in.Format("%s: %s\r\n",name,hdr[i]->GetValue());
+      }
+      if(code<200)
+      {
+	 // an interim reply, the final one follows.
+	 in.Put("\r\n");
+	 return;
+      }
+      bool body=!(head_method || code==204 || code==304);
+      if(body && !length)
+      {
+	 if(end)
+	    in.Put("Content-Length: 0\r\n");
+	 else
+	 {
+	    in.Put("Transfer-Encoding: chunked\r\n");
+	    reply_chunked=true;
+	 }
+      }
+      in.Put("\r\n");
+      reply_state=REPLY_BODY;
+   }
+   else if(reply_chunked)
+   {
+      // trailers
+      in.Put("0\r\n");
+      for(int i=0; i<hdr.count(); i++)
+	 in.Format("%s: %s\r\n",hdr[i]->GetName(),hdr[i]->GetValue());
+      in.Put("\r\n");
+      reply_chunked=false;
+   }
+   if(end)
+      EndReply();
+   SMTask::Timeout(0);
+}
+
+void Http2Channel::ReplyData(const char *buf,int len,bool end)
+{
+   if(reply_state!=REPLY_BODY)
+   {
+      h2->SendReset(id,ERROR_PROTOCOL);
+      Fail(_("invalid HTTP/2 reply"));
+      return;
+   }
+   if(len>0)
+   {
+      if(reply_chunked)
+      {
+	 in.Format("%x\r\n",len);
+	 in.Put(buf,len);
+	 in.Put("\r\n");
+      }
+      else
+	 in.Put(buf,len);
+   }
+   if(end)
+      EndReply();
+   SMTask::Timeout(0);
+}
+
+void Http2Channel::EndReply()
+{
+   if(reply_chunked)
+      in.Put("0\r\n\r\n");
+   reply_chunked=false;
+   reply_state=REPLY_DONE;
+   if(req_state!=REQ_DONE)
+   {
+      // the server has replied before getting the whole request,
+      // the rest of the request body is dropped.
+      h2->SendReset(id,ERROR_CANCEL);
+      req_state=REQ_DISCARD;
+   }
+   else
+      req_state=REQ_HEAD;
+   id=0;
+}
+
+// the stream has failed
+void Http2Channel::Fail(const char *msg)
+{
+   id=0;
+   req_state=REQ_DISCARD;
+   reply_state=REPLY_DONE;
+   if(send_buf)
+      send_buf->SetError(msg,false);
+   if(recv_buf)
+      recv_buf->SetError(msg,false);
+}
+
+// the connection has gone
+void Http2Channel::Lost(const char *msg)
+{
+   h2=0;
+   // a complete reply can still be read, the next request fails.
+   if(id==0 && req_state==REQ_HEAD)
+      return;
+   Fail(msg);
+}
+
+// IOBufferHttp2 implementation
+IOBufferHttp2::IOBufferHttp2(Http2Channel *c,dir_t m)
+   : IOBuffer(m), channel(c)
+{
+   if(mode==PUT)
+      channel->send_buf=this;
+   else
+      channel->recv_buf=this;
+}
+void IOBufferHttp2::PrepareToDie()
+{
+   if(!channel)
+      return;
+   if(channel->send_buf==this)
+      channel->send_buf=0;
+   if(channel->recv_buf==this)
+      channel->recv_buf=0;
+   channel=0;
+}
+int IOBufferHttp2::Get_LL(int size)
+{
+   if(!channel)
+      return 0;
+   return channel->Receive(size);
+}
+int IOBufferHttp2::Put_LL(const char *buf,int size)
+{
+   if(!channel)
+   {
+      SetError(_("HTTP/2 connection closed"),false);
+      return -1;
+   }
+   return channel->Send(buf,size);
+}
+int IOBufferHttp2::PutEOF_LL()
+{
+   if(channel && Size()==0)
+      channel->Flush();
+   return 0;
+}
+
+// Http2Connection implementation
+TaskRefArray<Http2Connection> Http2Connection::all;
+
+Http2Connection::Http2Connection(const xstring& k,const char *host,Http::Connection *c)
+   : hostname(host), conn(c), idle("http:pool-idle",host),
+     next_id(1), max_streams(100), max_frame(16384),
+     initial_window(default_window), send_window(default_window),
+     recv_unacked(0), goaway(false),
+     block_id(0), block_promised(0), block_end(false)
+{
+   key.set(k);
+   conn->ResumeInternal();
+   conn->send_buf->Put(preface);
+
+   // server push is not used, a large window keeps the streams going.
+   conn->send_buf->PackUINT32BE((12<<8)|FRAME_SETTINGS);
+   conn->send_buf->PackUINT8(0);
+   conn->send_buf->PackUINT32BE(0);
+   conn->send_buf->PackUINT16BE(SETTINGS_ENABLE_PUSH);
+   conn->send_buf->PackUINT32BE(0);
+   conn->send_buf->PackUINT16BE(SETTINGS_INITIAL_WINDOW_SIZE);
+   conn->send_buf->PackUINT32BE(stream_window);
+   SendWindowUpdate(0,conn_window-default_window);
+}
+Http2Connection::~Http2Connection()
+{
+   for(int i=0; i<channels.count(); i++)
+      channels[i]->Lost(_("HTTP/2 connection closed"));
+}
+
+void Http2Connection::SendFrame(int type,int flags,unsigned id,const char *payload,int len)
+{
+   conn->send_buf->PackUINT32BE((len<<8)|type);
+   conn->send_buf->PackUINT8(flags);
+   conn->send_buf->PackUINT32BE(id);
+   if(len>0)
+      conn->send_buf->Put(payload,len);
+}
+void Http2Connection::SendWindowUpdate(unsigned id,unsigned inc)
+{
+   conn->send_buf->PackUINT32BE((4<<8)|FRAME_WINDOW_UPDATE);
+   conn->send_buf->PackUINT8(0);
+   conn->send_buf->PackUINT32BE(id);
+   conn->send_buf->PackUINT32BE(inc);
+}
+void Http2Connection::SendReset(unsigned id,unsigned code)
+{
+   conn->send_buf->PackUINT32BE((4<<8)|FRAME_RST_STREAM);
+   conn->send_buf->PackUINT8(0);
+   conn->send_buf->PackUINT32BE(id);
+   conn->send_buf->PackUINT32BE(code);
+}
+void Http2Connection::SendGoAway(unsigned code)
+{
+   conn->send_buf->PackUINT32BE((8<<8)|FRAME_GOAWAY);
+   conn->send_buf->PackUINT8(0);
+   conn->send_buf->PackUINT32BE(0);
+   conn->send_buf->PackUINT32BE(0);  // no server streams were accepted
+   conn->send_buf->PackUINT32BE(code);
+}
+void Http2Connection::SendHeaders(unsigned id,const xstring& hdr,bool end)
+{
+   int len=hdr.length();
+   int sent=0;
+   int type=FRAME_HEADERS;
+   int flags=(end?FLAG_END_STREAM:0);
+   do {
+      int n=len-sent;
+      if(n>(int)max_frame)
+	 n=max_frame;
+      if(sent+n==len)
+	 flags|=FLAG_END_HEADERS;
+      SendFrame(type,flags,id,hdr.get()+sent,n);
+      sent+=n;
+      type=FRAME_CONTINUATION;
+      flags=0;
+   } while(sent<len);
+}
+int Http2Connection::SendData(Http2Channel *ch,const char *buf,int size)
+{
+   if(!conn || conn->send_buf->Size()>=send_buf_limit)
+      return 0;   // let the socket drain first
+   long long n=size;
+   if(ch->req_left>=0 && n>ch->req_left)
+      n=ch->req_left;
+   if(n>ch->send_window)
+      n=ch->send_window;
+   if(n>send_window)
+      n=send_window;
+   if(n>max_frame)
+      n=max_frame;
+   if(n<=0)
+      return 0;
+   bool end=(ch->req_left==n);
+   SendFrame(FRAME_DATA,end?FLAG_END_STREAM:0,ch->id,buf,n);
+   ch->send_window-=n;
+   send_window-=n;
+   if(ch->req_left>=0)
+      ch->req_left-=n;
+   if(end)
+      ch->req_state=ch->REQ_DONE;
+   return n;
+}
+
+int Http2Connection::ActiveStreams() const
+{
+   int count=0;
+   for(int i=0; i<channels.count(); i++)
+      if(channels[i]->id)
+	 count++;
+   return count;
+}
+bool Http2Connection::CanOpenStream() const
+{
+   return conn && !goaway && next_id<0x7fffffff
+      && ActiveStreams()<(int)max_streams;
+}
+Http2Channel *Http2Connection::FindStream(unsigned id) const
+{
+   if(id==0)
+      return 0;
+   for(int i=0; i<channels.count(); i++)
+      if(channels[i]->id==id)
+	 return channels[i];
+   return 0;
+}
+
+Http::Connection *Http2Connection::OpenChannel()
+{
+   Http2Channel *ch=new Http2Channel(this);
+   channels.append(ch);
+   Http::Connection *c=new Http::Connection(-1,hostname);
+   c->send_buf=new IOBufferHttp2(ch,IOBuffer::PUT);
+   c->recv_buf=new IOBufferHttp2(ch,IOBuffer::GET);
+   c->h2=ch;
+   idle.Reset();
+   return c;
+}
+void Http2Connection::Detach(Http2Channel *ch)
+{
+   for(int i=0; i<channels.count(); i++)
+   {
+      if(channels[i]!=ch)
+	 continue;
+      channels.remove(i);
+      break;
+   }
+   if(ch->id && conn)
+      SendReset(ch->id,ERROR_CANCEL);
+   ch->h2=0;
+   idle.Reset();
+}
+
+// move a channel with a request not sent yet from a going away connection.
+void Http2Connection::Adopt(Http2Channel *ch)
+{
+   Http2Connection *from=ch->h2;
+   for(int i=0; i<from->channels.count(); i++)
+   {
+      if(from->channels[i]!=ch)
+	 continue;
+      from->channels.remove(i);
+      break;
+   }
+   ch->h2=this;
+   channels.append(ch);
+   idle.Reset();
+   ch->Flush();
+}
+void Http2Connection::Add(Http2Connection *c)
+{
+   // take the requests waiting on connections the server is closing.
+   for(int i=0; i<all.count(); i++)
+   {
+      Http2Connection *o=all[i].get_non_const();
+      if(!o->goaway || !o->key.eq(c->key))
+	 continue;
+      for(int j=0; j<o->channels.count(); j++)
+      {
+	 Http2Channel *ch=o->channels[j];
+	 if(ch->id==0 && ch->req_state==ch->REQ_OPEN)
+	 {
+	    c->Adopt(ch);
+	    j--;
+	 }
+      }
+   }
+   all.append(c);
+}
+
+Http2Connection *Http2Connection::Find(const xstring& key)
+{
+   Http2Connection *best=0;
+   for(int i=0; i<all.count(); i++)
+   {
+      Http2Connection *c=all[i].get_non_const();
+      if(!c->key.eq(key) || !c->CanOpenStream())
+	 continue;
+      if(!best || c->channels.count()<best->channels.count())
+	 best=c;
+   }
+   return best;
+}
+
+void Http2Connection::Close()
+{
+   for(int i=0; i<channels.count(); i++)
+      channels[i]->h2=0;
+   channels.truncate();
+   conn=0;
+   for(int i=0; i<all.count(); i++)
+   {
+      if(all[i]!=this)
+	 continue;
+      all.remove(i);
+      break;
+   }
+}
+void Http2Connection::Fail(const char *msg,unsigned code)
+{
+   LogError(0,"%s",msg);
+   if(conn && code!=ERROR_NO_ERROR)
+   {
+      SendGoAway(code);
+      conn->send_buf->Roll();
+   }
+   for(int i=0; i<channels.count(); i++)
+      channels[i]->Lost(msg);
+   Close();
+}
+
+void Http2Connection::HandleBlock()
+{
+   xarray_p<HttpHeader> hdr;
+   unsigned id=block_id;
+   block_id=0;
+   if(!hpack.Decode(block,block.length(),hdr))
+   {
+      Fail(_("HTTP/2 header compression error"),ERROR_COMPRESSION);
+      return;
+   }
+   block.truncate();
+   if(block_promised)
+   {
+      // push is disabled, still the header block had to be decoded.
+      SendReset(block_promised,ERROR_REFUSED_STREAM);
+      block_promised=0;
+      return;
+   }
+   Http2Channel *ch=FindStream(id);
+   if(ch)
+      ch->Reply(hdr,block_end);
+}
+
+void Http2Connection::HandleFrame(int type,int flags,unsigned id,const char *p,unsigned len)
+{
+   if(block_id && type!=FRAME_CONTINUATION)
+   {
+      Fail(_("HTTP/2 protocol error: CONTINUATION expected"),ERROR_PROTOCOL);
+      return;
+   }
+   switch(type)
+   {
+   case FRAME_DATA: {
+      // the server must keep within the windows announced to it.
+      if(recv_unacked+len>conn_window)
+      {
+	 Fail(_("HTTP/2 flow control error"),ERROR_FLOW_CONTROL);
+	 return;
+      }
+      Http2Channel *ch=FindStream(id);
+      if(ch && ch->recv_unacked+len>stream_window)
+      {
+	 SendReset(id,ERROR_FLOW_CONTROL);
+	 ch->Fail(_("HTTP/2 flow control error"));
+	 ch=0;
+      }
+      // the connection window is given back at once.
+      recv_unacked+=len;
+      if(recv_unacked>=conn_window/2)
+      {
+	 SendWindowUpdate(0,recv_unacked);
+	 recv_unacked=0;
+      }
+      if(ch)
+	 ch->recv_unacked+=len;
+      if(!unpad(flags,p,len))
+      {
+	 Fail(_("HTTP/2 protocol error: invalid padding"),ERROR_PROTOCOL);
+	 return;
+      }
+      if(ch)
+	 ch->ReplyData(p,len,flags&FLAG_END_STREAM);
+      return;
+   }
+   case FRAME_HEADERS:
+      if(!unpad(flags,p,len) || ((flags&FLAG_PRIORITY) && len<5))
+      {
+	 Fail(_("HTTP/2 protocol error: invalid HEADERS"),ERROR_PROTOCOL);
+	 return;
+      }
+      if(flags&FLAG_PRIORITY)
+      {
+	 p+=5;
+	 len-=5;
+      }
+      block.nset(p,len);
+      block_id=id;
+      block_end=(flags&FLAG_END_STREAM);
+      if(flags&FLAG_END_HEADERS)
+	 HandleBlock();
+      return;
+   case FRAME_PUSH_PROMISE:
+      if(!unpad(flags,p,len) || len<4)
+      {
+	 Fail(_("HTTP/2 protocol error: invalid PUSH_PROMISE"),ERROR_PROTOCOL);
+	 return;
+      }
+      block_promised=get_uint32(p)&0x7fffffff;
+      block.nset(p+4,len-4);
+      block_id=id;
+      block_end=false;
+      if(flags&FLAG_END_HEADERS)
+	 HandleBlock();
+      return;
+   case FRAME_CONTINUATION:
+      if(!block_id || id!=block_id)
+      {
+	 Fail(_("HTTP/2 protocol error: unexpected CONTINUATION"),ERROR_PROTOCOL);
+	 return;
+      }
+      block.append(p,len);
+      if(flags&FLAG_END_HEADERS)
+	 HandleBlock();
+      return;
+   case FRAME_RST_STREAM: {
+      if(len!=4)
+      {
+	 Fail(_("HTTP/2 protocol error: invalid RST_STREAM"),ERROR_PROTOCOL);
+	 return;
+      }
+      Http2Channel *ch=FindStream(id);
+      if(ch)
+	 ch->Fail(xstring::format(_("HTTP/2 stream reset by the server (%s)"),
+	    error_name(get_uint32(p))));
+      return;
+   }
+   case FRAME_SETTINGS:
+      if(flags&FLAG_ACK)
+	 return;
+      if(id!=0 || len%6)
+      {
+	 Fail(_("HTTP/2 protocol error: invalid SETTINGS"),ERROR_PROTOCOL);
+	 return;
+      }
+      for(unsigned i=0; i<len; i+=6)
+      {
+	 unsigned setting=((unsigned char)p[i]<<8)|(unsigned char)p[i+1];
+	 unsigned value=get_uint32(p+i+2);
+	 LogNote(10,"HTTP/2 setting %u=%u",setting,value);
+	 switch(setting)
+	 {
+	 case SETTINGS_MAX_CONCURRENT_STREAMS:
+	    max_streams=value;
+	    break;
+	 case SETTINGS_INITIAL_WINDOW_SIZE:
+	    if(value>0x7fffffff)
+	    {
+	       Fail(_("HTTP/2 flow control error"),ERROR_FLOW_CONTROL);
+	       return;
+	    }
+	    for(int c=0; c<channels.count(); c++)
+	    {
+	       if(!channels[c]->id)
+		  continue;
+	       channels[c]->send_window+=(long long)value-initial_window;
+	       if(channels[c]->send_window>0x7fffffff)
+	       {
+		  Fail(_("HTTP/2 flow control error"),ERROR_FLOW_CONTROL);
+		  return;
+	       }
+	    }
+	    initial_window=value;
+	    break;
+	 case SETTINGS_MAX_FRAME_SIZE:
+	    if(value<16384 || value>16777215)
+	    {
+	       Fail(_("HTTP/2 protocol error: invalid SETTINGS"),ERROR_PROTOCOL);
+	       return;
+	    }
+	    max_frame=value;
+	    break;
+	 }
+      }
+      SendFrame(FRAME_SETTINGS,FLAG_ACK,0,0,0);
+      return;
+   case FRAME_PING:
+      if(len!=8)
+      {
+	 Fail(_("HTTP/2 protocol error: invalid PING"),ERROR_PROTOCOL);
+	 return;
+      }
+      if(!(flags&FLAG_ACK))
+	 SendFrame(FRAME_PING,FLAG_ACK,0,p,8);
+      return;
+   case FRAME_GOAWAY: {
+      if(len<8)
+      {
+	 Fail(_("HTTP/2 protocol error: invalid GOAWAY"),ERROR_PROTOCOL);
+	 return;
+      }
+      unsigned last=get_uint32(p)&0x7fffffff;
+      unsigned code=get_uint32(p+4);
+      LogNote(9,"HTTP/2 server is going away (%s)",error_name(code));
+      goaway=true;
+      // the streams above the last one were not processed and can be retried.
+      for(int i=0; i<channels.count(); i++)
+	 if(channels[i]->id>last)
+	    channels[i]->Fail(_("HTTP/2 connection is going away"));
+      // the requests not sent yet go to another connection to the server.
+      Http2Connection *to=Find(key);
+      bool reconnect=false;
+      for(int i=0; i<channels.count(); i++)
+      {
+	 Http2Channel *ch=channels[i];
+	 if(ch->id || ch->req_state!=ch->REQ_OPEN)
+	    continue;
+	 if(to)
+	 {
+	    to->Adopt(ch);
+	    i--;
+	 }
+	 else if(!reconnect)
+	 {
+	    // one session opens a new connection, the rest are adopted by it.
+	    ch->Lost(_("HTTP/2 connection is going away"));
+	    channels.remove(i--);
+	    reconnect=true;
+	 }
+      }
+      return;
+   }
+   case FRAME_WINDOW_UPDATE: {
+      if(len!=4)
+      {
+	 Fail(_("HTTP/2 protocol error: invalid WINDOW_UPDATE"),ERROR_PROTOCOL);
+	 return;
+      }
+      unsigned inc=get_uint32(p)&0x7fffffff;
+      // a window above 2^31-1 is a flow control error (RFC 7540, 6.9.1).
+      if(id==0)
+      {
+	 if(send_window+inc>0x7fffffff)
+	 {
+	    Fail(_("HTTP/2 flow control error"),ERROR_FLOW_CONTROL);
+	    return;
+	 }
+	 send_window+=inc;
+      }
+      else
+      {
+	 Http2Channel *ch=FindStream(id);
+	 if(ch && ch->send_window+inc>0x7fffffff)
+	 {
+	    SendReset(id,ERROR_FLOW_CONTROL);
+	    ch->Fail(_("HTTP/2 flow control error"));
+	 }
+	 else if(ch)
+	    ch->send_window+=inc;
+      }
+      return;
+   }
+   }
+   // PRIORITY and unknown frames are ignored.
+}
+
+int Http2Connection::Do()
+{
+   int m=STALL;
+   if(!conn)
+      return m;
+   if(conn->send_buf->Error())
+   {
+      Fail(xstring::format("send: %s",conn->send_buf->ErrorText()),ERROR_NO_ERROR);
+      return MOVED;
+   }
+   if(conn->recv_buf->Error())
+   {
+      Fail(xstring::format("recv: %s",conn->recv_buf->ErrorText()),ERROR_NO_ERROR);
+      return MOVED;
+   }
+   for(;;)
+   {
+      const char *b;
+      int s;
+      conn->recv_buf->Get(&b,&s);
+      if(!b)
+      {
+	 Fail(_("Peer closed connection"),ERROR_NO_ERROR);
+	 return MOVED;
+      }
+      if(s<frame_header_size)
+	 break;
+      unsigned len=conn->recv_buf->UnpackUINT32BE(0)>>8;
+      if(len>max_recv_frame)
+      {
+	 Fail(_("HTTP/2 protocol error: frame is too large"),ERROR_PROTOCOL);
+	 return MOVED;
+      }
+      if(s<frame_header_size+(int)len)
+	 break;
+      int type=conn->recv_buf->UnpackUINT8(3);
+      int flags=conn->recv_buf->UnpackUINT8(4);
+      unsigned id=conn->recv_buf->UnpackUINT32BE(5)&0x7fffffff;
+      HandleFrame(type,flags,id,b+frame_header_size,len);
+      if(!conn)
+	 return MOVED;
+      conn->recv_buf->Skip(frame_header_size+len);
+      m=MOVED;
+   }
+   for(int i=0; i<channels.count(); i++)
+      channels[i]->Flush();
+   if(channels.count()>0)
+      idle.Reset();
+   else if(goaway || idle.Stopped())
+   {
+      LogNote(9,"closing idle HTTP/2 connection");
+      SendGoAway(ERROR_NO_ERROR);
+      conn->send_buf->Roll();
+      Close();
+      return MOVED;
+   }
+   return m;
+}
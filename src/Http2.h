@@ -0,0 +1,143 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include "Http.h"
+#include "HttpHpack.h"
+
+class Http2Connection;
+class IOBufferHttp2;
+
+/* A session's part of a shared HTTP/2 connection (RFC 7540). The session
+   writes HTTP/1.1 requests to send_buf and reads HTTP/1.1 replies from
+   recv_buf, so Http parses them as usual. Every request goes on a new
+   stream when the reply to the previous one is complete. */
+class Http2Channel
+{
+   friend class Http2Connection;
+   friend class IOBufferHttp2;
+
+   Http2Connection *h2;	 // 0 when the connection is gone
+   IOBufferHttp2 *send_buf;
+   IOBufferHttp2 *recv_buf;
+
+   unsigned id;		 // the stream of the current request, 0 if none
+   long long send_window;
+   int recv_unacked;	 // DATA not given back to the stream window yet
+
+   enum { REQ_HEAD, REQ_OPEN, REQ_BODY, REQ_DONE, REQ_DISCARD } req_state;
+   xstring req;		 // the request head, then its header block
+   long long req_left;	 // the body size to send, -1 for up to EOF
+   bool head_method;
+
+   enum { REPLY_HEAD, REPLY_BODY, REPLY_DONE } reply_state;
+   bool reply_chunked;
+   Buffer in;		 // the reply converted to HTTP/1.1
+
+   bool ParseRequest();
+   int Send(const char *buf,int size);
+   int Receive(int size);
+   void Flush();
+   void Reply(const xarray_p<HttpHeader>& hdr,bool end);
+   void ReplyData(const char *buf,int len,bool end);
+   void EndReply();
+   void Fail(const char *msg);
+   void Lost(const char *msg);
+
+public:
+   Http2Channel(Http2Connection *c);
+   ~Http2Channel();
+};
+
+class IOBufferHttp2 : public IOBuffer
+{
+   friend class Http2Channel;
+
+   Http2Channel *channel;
+
+   int Get_LL(int size);
+   int Put_LL(const char *buf,int size);
+   int PutEOF_LL();
+
+public:
+   IOBufferHttp2(Http2Channel *c,dir_t m);
+   void PrepareToDie();
+};
+
+/* A TLS connection which talked "h2" in ALPN. It carries the requests of
+   all sessions to the same server (by Http::PoolKey), so parallel mget,
+   mirror and pget share it instead of opening a connection each. */
+class Http2Connection : public SMTask, protected ProtoLog
+{
+   friend class Http2Channel;
+
+   static TaskRefArray<Http2Connection> all;
+
+   xstring key;
+   xstring_c hostname;
+   Ref<Http::Connection> conn;
+   HpackDecoder hpack;
+   xarray<Http2Channel*> channels;
+   Timer idle;
+
+   unsigned next_id;
+   unsigned max_streams;    // SETTINGS_MAX_CONCURRENT_STREAMS of the server
+   unsigned max_frame;	    // SETTINGS_MAX_FRAME_SIZE of the server
+   long long initial_window; // SETTINGS_INITIAL_WINDOW_SIZE of the server
+   long long send_window;
+   int recv_unacked;
+   bool goaway;
+
+   // a header block coming in HEADERS (or PUSH_PROMISE) and CONTINUATION
+   unsigned block_id;
+   unsigned block_promised;
+   bool block_end;
+   xstring block;
+
+   void SendFrame(int type,int flags,unsigned id,const char *payload,int len);
+   void SendWindowUpdate(unsigned id,unsigned inc);
+   void SendReset(unsigned id,unsigned code);
+   void SendGoAway(unsigned code);
+   void SendHeaders(unsigned id,const xstring& hdr,bool end);
+   int SendData(Http2Channel *ch,const char *buf,int len);
+
+   int ActiveStreams() const;
+   bool CanOpenStream() const;
+   Http2Channel *FindStream(unsigned id) const;
+   void HandleFrame(int type,int flags,unsigned id,const char *p,unsigned len);
+   void HandleBlock();
+   void Detach(Http2Channel *ch);
+   void Adopt(Http2Channel *ch);
+   void Fail(const char *msg,unsigned code);
+   void Close();
+
+public:
+   Http2Connection(const xstring& key,const char *host,Http::Connection *c);
+   ~Http2Connection();
+   int Do();
+   const char *GetLogContext() { return hostname; }
+
+   Http::Connection *OpenChannel();
+   static Http2Connection *Find(const xstring& key);
+   static void Add(Http2Connection *c);
+};
+
+#endif//HTTP2_H
@@ -0,0 +1,373 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include "HttpHpack.h"
+
+static const struct { const char *name,*value; } static_table[61]={
+   {":authority",                  ""},
+   {":method",                     "GET"},
+   {":method",                     "POST"},
+   {":path",                       "/"},
+   {":path",                       "/index.html"},
+   {":scheme",                     "http"},
+   {":scheme",                     "https"},
+   {":status",                     "200"},
+   {":status",                     "204"},
+   {":status",                     "206"},
+   {":status",                     "304"},
+   {":status",                     "400"},
+   {":status",                     "404"},
+   {":status",                     "500"},
+   {"accept-charset",              ""},
+   {"accept-encoding",             "gzip, deflate"},
+   {"accept-language",             ""},
+   {"accept-ranges",               ""},
+   {"accept",                      ""},
+   {"access-control-allow-origin", ""},
+   {"age",                         ""},
+   {"allow",                       ""},
+   {"authorization",               ""},
+   {"cache-control",               ""},
+   {"content-disposition",         ""},
+   {"content-encoding",            ""},
+   {"content-language",            ""},
+   {"content-length",              ""},
+   {"content-location",            ""},
+   {"content-range",               ""},
+   {"content-type",                ""},
+   {"cookie",                      ""},
+   {"date",                        ""},
+   {"etag",                        ""},
+   {"expect",                      ""},
+   {"expires",                     ""},
+   {"from",                        ""},
+   {"host",                        ""},
+   {"if-match",                    ""},
+   {"if-modified-since",           ""},
+   {"if-none-match",               ""},
+   {"if-range",                    ""},
+   {"if-unmodified-since",         ""},
+   {"last-modified",               ""},
+   {"link",                        ""},
+   {"location",                    ""},
+   {"max-forwards",                ""},
+   {"proxy-authenticate",          ""},
+   {"proxy-authorization",         ""},
+   {"range",                       ""},
+   {"referer",                     ""},
+   {"refresh",                     ""},
+   {"retry-after",                 ""},
+   {"server",                      ""},
+   {"set-cookie",                  ""},
+   {"strict-transport-security",   ""},
+   {"transfer-encoding",           ""},
+   {"user-agent",                  ""},
+   {"vary",                        ""},
+   {"via",                         ""},
+   {"www-authenticate",            ""},
+};
+
+// RFC 7541 Appendix B
+static const unsigned huffman_code[257]={
+   0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+   0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+   0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+   0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+   0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+   0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+   0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+   0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+   0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+   0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+   0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+   0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+   0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+   0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+   0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+   0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+   0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+   0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+   0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+   0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+   0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+   0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+   0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+   0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+   0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+   0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+   0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+   0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+   0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+   0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+   0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+   0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+   0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+   0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+   0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+   0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+   0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+   0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+   0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+   0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+   0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+   0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+   0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff,
+};
+static const unsigned char huffman_len[257]={
+   13,23,28,28,28,28,28,28,28,24,30,28,28,30,28,28,
+   28,28,28,28,28,28,30,28,28,28,28,28,28,28,28,28,
+   6,10,10,12,13,6,8,11,10,10,8,11,8,6,6,6,
+   5,5,5,6,6,6,6,6,6,6,7,8,15,6,12,10,
+   13,6,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+   7,7,7,7,7,7,7,7,8,7,8,13,19,13,14,6,
+   15,5,6,5,6,5,6,6,6,5,7,7,6,6,6,5,
+   6,7,6,5,5,6,7,7,7,7,7,15,11,14,13,28,
+   20,22,20,20,22,22,22,23,22,23,23,23,23,23,24,23,
+   24,24,22,23,24,23,23,23,23,21,22,23,22,23,23,24,
+   22,21,20,22,22,23,23,21,23,22,22,24,21,22,23,23,
+   21,21,22,21,23,22,23,23,20,22,22,22,23,22,22,23,
+   26,26,20,19,22,23,22,25,26,26,26,27,27,26,24,25,
+   19,21,26,27,27,26,27,24,21,21,26,26,28,27,27,27,
+   20,24,20,21,22,21,21,23,22,22,25,25,24,24,26,23,
+   26,27,26,26,27,27,27,27,27,28,27,27,27,27,27,26,
+   30,
+};
+
+void HpackEncoder::PutInt(xstring& out,int bits,int prefix,unsigned v)
+{
+   unsigned max=(1<<prefix)-1;
+   if(v<max)
+   {
+      out.append(char(bits|v));
+      return;
+   }
+   out.append(char(bits|max));
+   v-=max;
+   while(v>=128)
+   {
+      out.append(char((v&127)|128));
+      v>>=7;
+   }
+   out.append(char(v));
+}
+
+void HpackEncoder::PutString(xstring& out,const char *s)
+{
+   int len=strlen(s);
+   PutInt(out,0,7,len);
+   out.append(s,len);
+}
+
+void HpackEncoder::Encode(xstring& out,const char *name,const char *value)
+{
+   int name_index=0;
+   for(int i=0; i<61; i++)
+   {
+      if(strcmp(static_table[i].name,name))
+	 continue;
+      if(!strcmp(static_table[i].value,value))
+      {
+	 PutInt(out,0x80,7,i+1);   // indexed
+	 return;
+      }
+      if(!name_index)
+	 name_index=i+1;
+   }
+   // literal without indexing, credentials are never indexed.
+   bool sensitive=(!strcmp(name,"authorization")
+      || !strcmp(name,"proxy-authorization") || !strcmp(name,"cookie"));
+   PutInt(out,sensitive?0x10:0,4,name_index);
+   if(!name_index)
+      PutString(out,name);
+   PutString(out,value);
+}
+
+void HpackDecoder::Evict()
+{
+   while(table_size>max_size && table.count()>0)
+   {
+      table_size-=table.last()->Size();
+      table.chop();
+   }
+}
+
+void HpackDecoder::Add(const xstring& name,const xstring& value)
+{
+   Entry *e=new Entry(name,value);
+   table_size+=e->Size();
+   table.insert(e,0);
+   Evict();   // an entry larger than the table empties it
+}
+
+bool HpackDecoder::Lookup(unsigned index,const char **name,const char **value) const
+{
+   if(index==0)
+      return false;
+   if(index<=61)
+   {
+      *name=static_table[index-1].name;
+      *value=static_table[index-1].value;
+      return true;
+   }
+   index-=62;
+   if(index>=(unsigned)table.count())
+      return false;
+   *name=table[index]->name;
+   *value=table[index]->value;
+   return true;
+}
+
+bool HpackDecoder::GetInt(const unsigned char *&p,const unsigned char *end,int prefix,unsigned *v)
+{
+   if(p>=end)
+      return false;
+   unsigned max=(1<<prefix)-1;
+   *v=*p++&max;
+   if(*v<max)
+      return true;
+   for(int shift=0; shift<=21; shift+=7)
+   {
+      if(p>=end)
+	 return false;
+      unsigned b=*p++;
+      *v+=(b&127)<<shift;
+      if(!(b&128))
+	 return true;
+   }
+   return false;  // too large
+}
+
+bool HpackDecoder::GetString(const unsigned char *&p,const unsigned char *end,xstring& s)
+{
+   if(p>=end)
+      return false;
+   bool huffman=(*p&0x80);
+   unsigned len;
+   if(!GetInt(p,end,7,&len) || len>unsigned(end-p))
+      return false;
+   const unsigned char *data=p;
+   p+=len;
+   if(huffman)
+      return HuffmanDecode(s,data,len);
+   s.nset((const char*)data,len);
+   return true;
+}
+
+bool HpackDecoder::HuffmanDecode(xstring& out,const unsigned char *p,int len)
+{
+   // the tree of the code: a child is a node index, or -1-symbol for a leaf.
+   static short tree[256][2];
+   static int nodes;
+   if(nodes==0)
+   {
+      nodes=1;
+      for(int sym=0; sym<257; sym++)
+      {
+	 unsigned code=huffman_code[sym];
+	 int node=0;
+	 for(int bit=huffman_len[sym]-1; bit>0; bit--)
+	 {
+	    int b=(code>>bit)&1;
+	    if(!tree[node][b])
+	       tree[node][b]=nodes++;
+	    node=tree[node][b];
+	 }
+	 tree[node][code&1]=-1-sym;
+      }
+   }
+   out.truncate();
+   int node=0;
+   int bits=0;	  // since the last symbol
+   bool ones=true;
+   for(int i=0; i<len; i++)
+   {
+      for(int bit=7; bit>=0; bit--)
+      {
+	 int b=(p[i]>>bit)&1;
+	 node=tree[node][b];
+	 bits++;
+	 ones&=b;
+	 if(node>0)
+	    continue;
+	 if(node==0 || node==-1-256)
+	    return false;  // no such code, or EOS
+	 out.append(char(-1-node));
+	 node=0;
+	 bits=0;
+	 ones=true;
+      }
+   }
+   // the padding is a prefix of EOS, shorter than 8 bits.
+   return bits<8 && ones;
+}
+
+bool HpackDecoder::Decode(const char *buf,int len,xarray_p<HttpHeader>& out)
+{
+   const unsigned char *p=(const unsigned char*)buf;
+   const unsigned char *end=p+len;
+   xstring name,value;
+   while(p<end)
+   {
+      unsigned index;
+      const char *n,*v;
+      if(*p&0x80)
+      {
+	 // indexed header field
+	 if(!GetInt(p,end,7,&index) || !Lookup(index,&n,&v))
+	    return false;
+	 name.set(n);
+	 value.set(v);
+      }
+      else if((*p&0xE0)==0x20)
+      {
+	 // dynamic table size update
+	 if(!GetInt(p,end,5,&index) || index>limit)
+	    return false;
+	 max_size=index;
+	 Evict();
+	 continue;
+      }
+      else
+      {
+	 // literal, with incremental indexing (01), without (0000)
+	 // or never indexed (0001)
+	 bool indexing=((*p&0xC0)==0x40);
+	 if(!GetInt(p,end,indexing?6:4,&index))
+	    return false;
+	 if(index)
+	 {
+	    if(!Lookup(index,&n,&v))
+	       return false;
+	    name.set(n);
+	 }
+	 else if(!GetString(p,end,name))
+	    return false;
+	 if(!GetString(p,end,value))
+	    return false;
+	 if(indexing)
+	    Add(name,value);
+      }
+      HttpHeader *h=new HttpHeader(name);
+      h->SetValue(value);
+      out.append(h);
+   }
+   return true;
+}
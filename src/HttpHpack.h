@@ -0,0 +1,66 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2017 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTPHPACK_H
+#define HTTPHPACK_H
+
+#include "xstring.h"
+#include "xarray.h"
+#include "HttpHeader.h"
+
+/* HPACK header compression of HTTP/2 (RFC 7541). The encoder does not
+   use the dynamic table, so it keeps no state; the decoder keeps the
+   table the peer fills in. */
+class HpackEncoder
+{
+   static void PutInt(xstring& out,int bits,int prefix,unsigned v);
+   static void PutString(xstring& out,const char *s);
+public:
+   static void Encode(xstring& out,const char *name,const char *value);
+};
+
+class HpackDecoder
+{
+   struct Entry
+   {
+      xstring name;
+      xstring value;
+      Entry(const xstring& n,const xstring& v) { name.set(n); value.set(v); }
+      unsigned Size() const { return name.length()+value.length()+32; }
+   };
+   xarray_p<Entry> table;  // the newest first
+   unsigned table_size;
+   unsigned max_size;	    // set by the peer, up to the limit
+   unsigned limit;	    // SETTINGS_HEADER_TABLE_SIZE we announced
+
+   void Evict();
+   void Add(const xstring& name,const xstring& value);
+   bool Lookup(unsigned index,const char **name,const char **value) const;
+
+   static bool GetInt(const unsigned char *&p,const unsigned char *end,int prefix,unsigned *v);
+   static bool GetString(const unsigned char *&p,const unsigned char *end,xstring& s);
+   static bool HuffmanDecode(xstring& out,const unsigned char *p,int len);
+
+public:
+   HpackDecoder(unsigned l=4096) : table_size(0), max_size(l), limit(l) {}
+   // returns false on a compression error, the connection cannot be used then.
+   bool Decode(const char *buf,int len,xarray_p<HttpHeader>& out);
+};
+
+#endif//HTTPHPACK_H
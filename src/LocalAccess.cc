@@ -283,20 +283,63 @@ int LocalAccess::Do()
       return MOVED;
 
    case(ARRAY_INFO):
-      fill_array_info();
+      if(!fill_array_info())
+	 return m;
       done=true;
       return MOVED;
    case MP_LIST:
+   case BATCH:
+   case COPY:
+   case BLOCK_SUMS:
       SetError(NOT_SUPP);
       return MOVED;
    }
    return m;
 }
 
-void LocalAccess::fill_array_info()
+// returns false when it has to be called again.
+bool LocalAccess::fill_array_info()
 {
+   for(int i=0; i<checksum_jobs.count(); i++)
+   {
+      const ChecksumFile *job=checksum_jobs[i];
+      if(!job->Done())
+	 continue;
+      FileInfo *fi=checksum_files[i];
+      if(job->Error())
+	 LogError(0,"%s",job->ErrorText());
+      else
+	 fi->SetChecksum(job->GetAlgoName(),job->GetHex());
+      fi->NoNeed(fi->CHECKSUM);
+      checksum_jobs.remove(i);
+      checksum_files.remove(i);
+      i--;
+   }
+   int parallel=ResMgr::Query("file:parallel-checksums",0);
+   if(parallel<1)
+      parallel=1;
    for(FileInfo *fi=fileset_for_info->curr(); fi; fi=fileset_for_info->next())
+   {
+      if((fi->need&fi->CHECKSUM) && checksum_jobs.count()>=parallel)
+	 return false;
       fi->LocalFile(fi->name,(fi->filetype!=fi->SYMLINK));
+      if(fi->need&fi->CHECKSUM)
+	 start_checksum(fi);
+   }
+   return checksum_jobs.count()==0;
+}
+
+// the files are hashed by child processes, file:parallel-checksums at once.
+void LocalAccess::start_checksum(FileInfo *fi)
+{
+   Checksum::algo_t a=Checksum::FindAlgo(ChooseChecksumAlgo(Checksum::Supported()));
+   if(a==Checksum::NONE || !fi->TypeIs(fi->NORMAL))
+   {
+      fi->NoNeed(fi->CHECKSUM);
+      return;
+   }
+   checksum_jobs.append(new ChecksumFile(dir_file(cwd,fi->name),a));
+   checksum_files.append(fi);
 }
 
 int LocalAccess::Read(Buffer *buf0,int size)
@@ -500,6 +543,8 @@ void LocalAccess::Close()
    done=false;
    error_code=OK;
    stream=0;
+   checksum_jobs.truncate();
+   checksum_files.truncate();
    FileAccess::Close();
 }
 
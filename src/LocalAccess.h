@@ -22,13 +22,17 @@
 
 #include "FileAccess.h"
 #include "Filter.h"
+#include "Checksum.h"
 
 class LocalAccess : public FileAccess
 {
    Ref<FDStream> stream;
+   TaskRefArray<ChecksumFile> checksum_jobs;
+   xarray<FileInfo*> checksum_files;  // the files of checksum_jobs
    bool done;
    void errno_handle();
-   void fill_array_info();
+   bool fill_array_info();
+   void start_checksum(FileInfo *fi);
 
 public:
    void Init();
@@ -44,6 +48,7 @@ public:
    FileAccess *Clone() const { return new LocalAccess(this); }
    static FileAccess *New();
    bool SameLocationAs(const FileAccess *fa) const;
+   bool ChecksumSupported() const { return true; }
 
    int Read(Buffer *buf,int size);
    int Write(const void *buf,int size);
@@ -39,6 +39,7 @@
 #include "CopyJob.h"
 #include "pgetJob.h"
 #include "log.h"
+#include "LsCache.h"
 
 #define set_state(s) do { state=(s); \
    Log::global->Format(11,"mirror(%p) enters state %s\n", this, #s); } while(0)
@@ -60,10 +61,15 @@ xstring& MirrorJob::FormatStatus(xstring& s,int v,const char *tab)
    case(TARGET_REMOVE_OLD_FIRST):
    case(TARGET_CHMOD):
    case(TARGET_MKDIR):
+   case(TARGET_RENAME):
    case(SOURCE_REMOVING_SAME):
    case(LAST_EXEC):
       break;
 
+   case(WATCHING):
+      s.appendf("\t%s\n",_("Waiting for changes"));
+      break;
+
    case(MAKE_TARGET_DIR):
       s.appendf("\tmkdir `%s' [%s]\n",target_dir.get(),target_session->CurrentStatus());
       break;
@@ -92,6 +98,18 @@ xstring& MirrorJob::FormatStatus(xstring& s,int v,const char *tab)
 	    s.appendf("\t%s\n",source_list_info->Status());
       }
       break;
+
+   case(GETTING_CHECKSUMS):
+      s.appendf("\t%s (%d%%) [%s]\n",_("Comparing checksums"),
+	 ChecksumSession()->InfoArrayPercentDone(),ChecksumSession()->CurrentStatus());
+      break;
+
+   case(PREFETCHING_LISTS):
+      if(source_prefetch && !source_prefetch->Done())
+	 s.appendf("\t%s\n",source_prefetch->Status());
+      if(target_prefetch && !target_prefetch->Done())
+	 s.appendf("\t%s\n",target_prefetch->Status());
+      break;
    }
    return s;
 
@@ -110,6 +128,21 @@ final:
 	 tab,stats.mod_files,stats.mod_symlinks);
    if(stats.bytes)
       s.appendf("%s%s\n",tab,CopyJob::FormatBytesTimeRate(stats.bytes,transfer_time_elapsed));
+   if(stats.bytes>0 && stats.time>=1 && predicted_load.count()>0)
+   {
+      // per-transfer rate is used, as the load is counted per slot.
+      double rate=stats.bytes/stats.time;
+      long predicted=long(PredictedMaxLoad()/rate+.5);
+      long actual=long(transfer_time_elapsed+.5);
+      s.appendf(plural("%sMakespan: %ld $#l#second|seconds$ (predicted %ld)\n",actual),
+	 tab,actual,predicted);
+   }
+   if(stats.renamed_files)
+      s.appendf(plural("%sRenamed: %d file$|s$\n",stats.renamed_files),
+	 tab,stats.renamed_files);
+   if(stats.same_checksum)
+      s.appendf(plural("%sSame checksum: %d file$|s$\n",stats.same_checksum),
+	 tab,stats.same_checksum);
    if(stats.del_dirs || stats.del_files || stats.del_symlinks)
       s.appendf(plural(FlagSet(DELETE) ?
 	       "%sRemoved: %d director$y|ies$, %d file$|s$, %d symlink$|s$\n"
@@ -136,6 +169,7 @@ void  MirrorJob::ShowRunStatus(const SMTaskRef<StatusLine>& s)
    case(TARGET_REMOVE_OLD_FIRST):
    case(TARGET_CHMOD):
    case(TARGET_MKDIR):
+   case(TARGET_RENAME):
    case(SOURCE_REMOVING_SAME):
    case(FINISHING):
    case(DONE):
@@ -143,6 +177,10 @@ void  MirrorJob::ShowRunStatus(const SMTaskRef<StatusLine>& s)
       Job::ShowRunStatus(s);
       break;
 
+   case(WATCHING):
+      s->Show("%s",_("Waiting for changes"));
+      break;
+
    case(MAKE_TARGET_DIR):
       s->Show("mkdir `%s' [%s]",target_dir.get(),target_session->CurrentStatus());
       break;
@@ -181,6 +219,18 @@ void  MirrorJob::ShowRunStatus(const SMTaskRef<StatusLine>& s)
 	    s->Show("%s",status);
       }
       break;
+
+   case(GETTING_CHECKSUMS):
+      s->Show("%s (%d%%) [%s]",_("Comparing checksums"),
+	 ChecksumSession()->InfoArrayPercentDone(),ChecksumSession()->CurrentStatus());
+      break;
+
+   case(PREFETCHING_LISTS):
+      if(source_prefetch && !source_prefetch->Done())
+	 s->Show("%s",source_prefetch->Status());
+      else if(target_prefetch && !target_prefetch->Done())
+	 s->Show("%s",target_prefetch->Status());
+      break;
    }
 }
 
@@ -262,6 +312,12 @@ double MirrorJob::GetTimeSpent()
    return t;
 }
 
+// the entries of to_transfer which can be read once for all the targets.
+static bool fan_out_shared(const FileInfo *fi)
+{
+   return !fi->Has(fi->TYPE) || fi->TypeIs(fi->NORMAL) || fi->TypeIs(fi->REDIRECT);
+}
+
 void  MirrorJob::HandleFile(FileInfo *file)
 {
    int	 res;
@@ -293,6 +349,9 @@ void  MirrorJob::HandleFile(FileInfo *file)
       if(target && target->Has(target->TYPE))
 	 filetype=target->filetype;
    }
+   if(fan_out && fan_out_shared(file)
+   && filetype!=FileInfo::NORMAL && filetype!=FileInfo::REDIRECT)
+      fan_out->Unwant(source_name_rel);
 
    switch(filetype)
    {
@@ -301,9 +360,22 @@ void  MirrorJob::HandleFile(FileInfo *file)
       {
 	 bool remove_target=false;
 	 bool cont_this=false;
+	 bool delta_this=false;
 	 bool use_pget=(pget_n>1) && target_is_local;
+	 int pget_count=pget_n;
 	 if(file->Has(file->SIZE) && file->size<pget_minchunk*2)
 	    use_pget=false;
+	 if(use_pget && balanced_schedule)
+	 {
+	    // split only the final files, over the slots nothing else needs.
+	    int files_left=to_transfer->count()-to_transfer->curr_index();
+	    int free_slots=parallel-transfer_count;
+	    pget_count=(files_left<free_slots ? free_slots/files_left : 1);
+	    if(pget_count>pget_n)
+	       pget_count=pget_n;
+	    if(pget_count<2)
+	       use_pget=false;
+	 }
 	 if(target_is_local)
 	 {
 	    if(lstat(target_name,&st)!=-1)
@@ -339,7 +411,10 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	    }
 	    else if(!to_rm_mismatched->FindByName(file->name))
 	    {
-	       if(!FlagSet(OVERWRITE)) {
+	       if(UseDelta(file,old)) {
+		  delta_this=true;
+		  Report(_("Updating file `%s'"),target_name_rel);
+	       } else if(!FlagSet(OVERWRITE)) {
 		  remove_target=true;
 		  Report(_("Removing old file `%s'"),target_name_rel);
 	       } else {
@@ -366,7 +441,7 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	    if(use_pget)
 	    {
 	       args.Append("-n");
-	       args.Append(pget_n);
+	       args.Append(pget_count);
 	    }
 	    if(cont_this)
 	       args.Append("-c");
@@ -387,16 +462,48 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	 }
 
 	 FileCopyPeer *src_peer=0;
-	 if(source_is_local)
-	    src_peer=new FileCopyPeerFDStream(new FileStream(source_name,O_RDONLY),FileCopyPeer::GET);
-	 else
-	    src_peer=new FileCopyPeerFA(source_session->Clone(),file->name,FA::RETRIEVE);
+	 if(bulk && bulk->GetMode()==FA::RETRIEVE)
+	 {
+	    // the stream cannot seek or be split.
+	    if(!cont_this && !use_pget)
+	       src_peer=bulk->NewPeer(file->name);
+	    else
+	       bulk->Unwant(file->name);
+	 }
+	 if(!src_peer)
+	 {
+	    if(source_is_local)
+	       src_peer=new FileCopyPeerFDStream(new FileStream(source_name,O_RDONLY),FileCopyPeer::GET);
+	    else
+	       src_peer=new FileCopyPeerFA(source_session->Clone(),file->name,FA::RETRIEVE);
+	 }
+	 if(fan_out)
+	 {
+	    // a resumed or split transfer reads the file by itself.
+	    if(!cont_this && !use_pget && !FlagSet(ASCII))
+	       src_peer=fan_out->Source(source_name_rel,src_peer);
+	    else
+	       fan_out->Unwant(source_name_rel);
+	 }
 
 	 FileCopyPeer *dst_peer=0;
-	 if(target_is_local)
-	    dst_peer=new FileCopyPeerFDStream(new FileStream(target_name,O_WRONLY|O_CREAT|(cont_this?0:O_TRUNC)),FileCopyPeer::PUT);
-	 else
-	    dst_peer=new FileCopyPeerFA(target_session->Clone(),dst_name,FA::STORE);
+	 if(bulk && bulk->GetMode()==FA::STORE)
+	 {
+	    // the stream truncates the file and writes it from the start.
+	    if(!cont_this && !remove_target && !delta_this)
+	       dst_peer=bulk->NewPeer(file->name);
+	    else
+	       bulk->Unwant(file->name);
+	 }
+	 if(!dst_peer)
+	 {
+	    if(target_is_local)
+	       dst_peer=new FileCopyPeerFDStream(new FileStream(target_name,O_WRONLY|O_CREAT|(cont_this?0:O_TRUNC)),FileCopyPeer::PUT);
+	    else if(delta_this)
+	       dst_peer=new FileCopyPeerDelta(target_session->Clone(),dst_name,file->size);
+	    else
+	       dst_peer=new FileCopyPeerFA(target_session->Clone(),dst_name,FA::STORE);
+	 }
 
 	 FileCopy *c=FileCopy::New(src_peer,dst_peer,cont_this);
 	 if(remove_source_files)
@@ -405,12 +512,14 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	    c->RemoveTargetFirst();
 	 if(FlagSet(ASCII))
 	    c->Ascii();
-	 CopyJob *cp=(use_pget ? new pgetJob(c,file->name,pget_n) : new CopyJob(c,file->name,"mirror"));
+	 CopyJob *cp=(use_pget ? new pgetJob(c,file->name,pget_count) : new CopyJob(c,file->name,"mirror"));
 	 if(file->Has(file->DATE))
 	    cp->SetDate(file->date);
 	 if(file->Has(file->SIZE) && !FlagSet(IGNORE_SIZE))
 	    cp->SetSize(file->size);
 	 TransferStarted(cp);
+	 if(balanced_schedule && file->Has(file->SIZE))
+	    PredictTransfer(file->size,use_pget?pget_count:1);
 	 cp->cmdline.vset("\\transfer `",source_name_rel,"'",NULL);
 
 	 set_state(WAITING_FOR_TRANSFER);
@@ -475,12 +584,18 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	    source_session->Clone(),target_session->Clone(),
 	    source_name,target_name);
 	 AddWaiting(mj);
+	 running_dirs++;
+	 root_mirror->active_dirs++;
+	 mj->counted_as_active=true;
 	 mj->cmdline.vset("\\mirror `",source_name_rel,"'",NULL);
 
 	 mj->source_relative_dir.set(source_name_rel);
 	 mj->target_relative_dir.set(target_name_rel);
 
 	 mj->create_target_dir=create_target_subdir;
+	 mj->source_prefetched=(source_prefetch && source_prefetch->Fetched(file->name));
+	 mj->target_prefetched=(!create_target_subdir && target_prefetch
+				&& target_prefetch->Fetched(file->name));
 
 	 if(verbose_report>=3) {
 	    if(FlagSet(SCAN_ALL_FIRST))
@@ -574,8 +689,78 @@ void  MirrorJob::HandleFile(FileInfo *file)
    case FileInfo::UNKNOWN:
       break;
    }
-skip:
    return;
+skip:
+   if(fan_out && (filetype==FileInfo::NORMAL || filetype==FileInfo::REDIRECT))
+      fan_out->Unwant(source_name_rel);
+   if(bulk)
+      bulk->Unwant(file->name);
+}
+
+/* The other targets wait for this one to join the shared reads of the
+   files it has announced; give up those it is not going to transfer. */
+void MirrorJob::UnwantShared(int from)
+{
+   fan_out_pending=false;
+   for(int i=from; i<to_transfer->count(); i++)
+   {
+      const FileInfo *fi=(*to_transfer)[i];
+      if(fan_out_shared(fi))
+	 fan_out->Unwant(dir_file(source_relative_dir,fi->name));
+   }
+}
+
+void MirrorJob::InitBulk()
+{
+   ReleaseBulk();
+   if(fan_out || script_only || remove_source_files
+   || FlagSet(ASCII) || FlagSet(TARGET_FLAT))
+      return;
+   long long max_size=ResMgr::Query("mirror:bulk-max-size",0).to_unumber(LLONG_MAX);
+   if(max_size==0)
+      return;
+   if(!source_is_local && source_session->BatchSupported(FA::RETRIEVE))
+      bulk=new FileCopyBulk(source_session->Clone(),FA::RETRIEVE);
+   else if(!target_is_local && target_session->BatchSupported(FA::STORE)
+   && !ResMgr::QueryBool("xfer:use-temp-file",0))
+      bulk=new FileCopyBulk(target_session->Clone(),FA::STORE);
+   else
+      return;
+   bulk->Hold();
+   for(int i=0; i<to_transfer->count(); i++)
+   {
+      const FileInfo *file=(*to_transfer)[i];
+      if(file->TypeIs(file->NORMAL) && file->Has(file->SIZE)
+      && file->size<=max_size)
+	 bulk->Add(file);
+   }
+   if(bulk->Count()<2)
+   {
+      ReleaseBulk();
+      return;
+   }
+   bulk->Start();
+}
+void MirrorJob::ReleaseBulk()
+{
+   if(!bulk)
+      return;
+   bulk->Release();
+   bulk=0;
+}
+
+bool MirrorJob::UseDelta(const FileInfo *file,const FileInfo *old) const
+{
+   if(target_is_local || script_only || FlagSet(ASCII)
+   || !target_session->BlockSumsSupported())
+      return false;
+   if(!old->TypeIs(old->NORMAL) || !old->Has(old->SIZE) || !file->Has(file->SIZE))
+      return false;
+   // the old file is patched in place, a temporary file would be new.
+   if(ResMgr::QueryBool("xfer:use-temp-file",0))
+      return false;
+   long long min_size=ResMgr::Query("mirror:delta-min-size",0).to_unumber(LLONG_MAX);
+   return min_size>0 && file->size>=min_size;
 }
 
 void  MirrorJob::InitSets()
@@ -588,7 +773,7 @@ void  MirrorJob::InitSets()
    to_rm=new FileSet(target_set);
    to_rm->SubtractAny(source_set);
 
-   if(FlagSet(DELETE_EXCLUDED) && target_set_excluded)
+   if(FlagSet(DELETE_EXCLUDED) && target_set_excluded && !stream_part)
       to_rm->Merge(target_set_excluded);
 
    to_transfer=new FileSet(source_set);
@@ -652,6 +837,10 @@ void  MirrorJob::InitSets()
    if(!FlagSet(DELETE))
       to_transfer->SubtractAny(to_rm_mismatched);
 
+   if(FlagSet(DETECT_RENAMES) && FlagSet(DELETE)
+   && !AnyFlagSet(REMOVE_FIRST|TARGET_FLAT))
+      FindRenames();
+
    if(FlagSet(TARGET_FLAT) && !parent_mirror && target_set) {
       source_set->Unsort();
       to_transfer->UnsortFlat();
@@ -669,6 +858,12 @@ void  MirrorJob::InitSets()
       to_transfer->Sort(FileSet::BYDATE);
    else if(!strncmp(sort_by,"size",4))
       to_transfer->Sort(FileSet::BYSIZE,false,true);
+   else if(!strncmp(sort_by,"balanced",8))
+   {
+      // longest files first, so that the small ones fill the gaps at the end.
+      to_transfer->Sort(FileSet::BYSIZE_DIRSLAST);
+      balanced_schedule=true;
+   }
    if(desc)
       to_transfer->ReverseSort();
 
@@ -682,9 +877,405 @@ void  MirrorJob::InitSets()
    }
 }
 
+static int rename_cmp_size(FileInfo *const *a,FileInfo *const *b)
+{
+   if((*a)->size<(*b)->size)
+      return -1;
+   if((*a)->size>(*b)->size)
+      return 1;
+   return strcmp((*a)->name,(*b)->name);
+}
+
+/* Pair new files with files to be removed having the same size and date.
+   A pair is used only when the match is unique on both sides, then the
+   removal is replaced with a rename on the target. The new file stays in
+   to_transfer and is skipped only if the rename succeeds. */
+void MirrorJob::FindRenames()
+{
+   rename_from.Empty();
+   rename_to.Empty();
+   rename_jobs.truncate();
+   renamed.empty();
+   rename_index=0;
+
+   xarray<FileInfo*> old_files;
+   for(int i=0; i<to_rm->count(); i++)
+   {
+      FileInfo *fi=(*to_rm)[i];
+      if(fi->TypeIs(fi->NORMAL) && fi->HasAll(fi->SIZE|fi->DATE))
+	 old_files.append(fi);
+   }
+   if(old_files.count()==0)
+      return;
+   old_files.qsort(rename_cmp_size);
+
+   // the old file matched by each new file, and the count of new files
+   // matching each old one.
+   xarray<int> match_of;
+   xarray<int> matched_by;
+   for(int j=0; j<old_files.count(); j++)
+      matched_by.append(0);
+   for(int i=0; i<new_files_set->count(); i++)
+   {
+      const FileInfo *nf=(*new_files_set)[i];
+      if(!nf->TypeIs(nf->NORMAL) || !nf->HasAll(nf->SIZE|nf->DATE))
+      {
+	 match_of.append(-1);	// keep match_of indexed as new_files_set
+	 continue;
+      }
+      int lo=0,hi=old_files.count();
+      while(lo<hi)
+      {
+	 int mid=(lo+hi)/2;
+	 if(old_files[mid]->size<nf->size)
+	    lo=mid+1;
+	 else
+	    hi=mid;
+      }
+      int match=-1;
+      for(int j=lo; j<old_files.count() && old_files[j]->size==nf->size; j++)
+      {
+	 const FileInfo *of=old_files[j];
+	 time_t prec=nf->date.ts_prec;
+	 if(prec<of->date.ts_prec)
+	    prec=of->date.ts_prec;
+	 if(labs(nf->date-of->date)>prec)
+	    continue;
+	 matched_by[j]++;
+	 if(match==-1)
+	    match=j;
+	 else
+	    match=-2;   // ambiguous
+      }
+      match_of.append(match);
+   }
+
+   for(int i=0; i<new_files_set->count(); i++)
+   {
+      int j=match_of[i];
+      if(j<0 || matched_by[j]!=1)
+	 continue;
+      rename_from.Append(old_files[j]->name);
+      rename_to.Append((*new_files_set)[i]->name);
+      rename_jobs.append(0);
+   }
+
+   // the removal is put back if the rename fails.
+   for(int i=0; i<rename_from.Count(); i++)
+      to_rm->SubtractByName(rename_from[i]);
+}
+
+void MirrorJob::RenameDone(int i,bool ok)
+{
+   const char *from=rename_from[i];
+   const char *to=rename_to[i];
+   if(ok)
+   {
+      stats.renamed_files++;
+      renamed.add(to,true);
+      const FileInfo *fi=to_transfer->FindByName(to);
+      if(fi && fi->Has(fi->SIZE))
+	 AddBytesToTransfer(-fi->size);
+      return;
+   }
+   const char *from_rel=alloca_strdup(dir_file(target_relative_dir,from));
+   Report(_("Rename of `%s' failed, transferring `%s'"),
+      from_rel,dir_file(source_relative_dir,to));
+   const FileInfo *old=target_set->FindByName(from);
+   if(old)
+   {
+      to_rm->Add(new FileInfo(*old));
+      stats.del_files++;
+   }
+}
+
+void MirrorJob::RenameFinished(Job *j)
+{
+   for(int i=0; i<rename_jobs.count(); i++)
+   {
+      if(rename_jobs[i]!=j)
+	 continue;
+      rename_jobs[i]=0;
+      RenameDone(i,j->ExitCode()==0);
+      // a failed rename is not an error, the file is transferred instead.
+      RemoveWaiting(j);
+      Delete(j);
+      transfer_count--;
+      return;
+   }
+   JobFinished(j);
+}
+
+/* Prepares the files which are to be transferred and have the same size
+   on the target for checksum comparison, and starts the first pass. */
+bool MirrorJob::InitChecksums()
+{
+   if(FlagSet(TRANSFER_ALL) || !target_set || script_only)
+      return false;
+   if(!source_session->ChecksumSupported() || !target_session->ChecksumSupported())
+      return false;
+
+   source_checksums=new FileSet;
+   target_checksums=new FileSet;
+   for(int i=0; i<to_transfer->count(); i++)
+   {
+      const FileInfo *sf=(*to_transfer)[i];
+      if(!sf->TypeIs(sf->NORMAL) || !sf->Has(sf->SIZE))
+	 continue;
+      const FileInfo *tf=target_set->FindByName(sf->name);
+      if(!tf || !tf->TypeIs(tf->NORMAL) || !tf->Has(tf->SIZE) || tf->size!=sf->size)
+	 continue;
+      FileInfo *fi=new FileInfo(sf->name);
+      fi->Need(fi->CHECKSUM);
+      source_checksums->Add(fi);
+      fi=new FileInfo(sf->name);
+      fi->Need(fi->CHECKSUM);
+      target_checksums->Add(fi);
+   }
+   if(source_checksums->count()==0)
+   {
+      source_checksums=0;
+      target_checksums=0;
+      return false;
+   }
+   // let the remote side choose the algorithm, a local one supports them all.
+   checksum_target_first=(source_is_local && !target_is_local);
+   checksum_pass=1;
+   ChecksumSession()->SetChecksumAlgo(ResMgr::Query("mirror:checksum-algo",0));
+   ChecksumSession()->GetInfoArray(checksum_target_first?target_checksums.get_non_const():source_checksums.get_non_const());
+   return true;
+}
+
+bool MirrorJob::InitListPrefetch()
+{
+   if(recursion_mode==RECURSION_NEVER || FlagSet(NO_RECURSION))
+      return false;
+
+   Ref<FileSet> source_dirs(new FileSet);
+   Ref<FileSet> target_dirs(new FileSet);
+   for(int i=0; i<to_transfer->count(); i++)
+   {
+      const FileInfo *fi=(*to_transfer)[i];
+      if(!fi->TypeIs(fi->DIRECTORY))
+	 continue;
+      source_dirs->Add(new FileInfo(fi->name));
+      // the sub-mirror lists only existing target directories.
+      const FileInfo *tf=(target_set?target_set->FindByName(fi->name):0);
+      if(tf && tf->TypeIs(tf->DIRECTORY) && !FlagSet(TARGET_FLAT))
+	 target_dirs->Add(new FileInfo(fi->name));
+   }
+   source_prefetch=NewListPrefetch(source_session,source_dirs.borrow());
+   target_prefetch=NewListPrefetch(target_session,target_dirs.borrow());
+   return source_prefetch || target_prefetch;
+}
+
+ListPrefetch *MirrorJob::NewListPrefetch(const FileAccessRef& session,FileSet *dirs)
+{
+   Ref<FileSet> d(dirs);
+   // a single directory is listed as fast by the sub-mirror itself.
+   if(d->count()<2 || !session->BatchSupported(FA::LONG_LIST)
+   || !FileAccess::cache->IsEnabled(session->GetHostName()))
+      return 0;
+   return new ListPrefetch(session,d.borrow());
+}
+
+/* Drives the checksum passes, returns true when the comparison is over
+   and the files with equal checksums are removed from to_transfer. */
+bool MirrorJob::ChecksumsDone()
+{
+   const FileAccessRef& session=ChecksumSession();
+   int res=session->Done();
+   if(res==FA::IN_PROGRESS)
+      return false;
+   session->SetChecksumAlgo(0);
+   session->Close();
+
+   const FileSet *first=(checksum_target_first?target_checksums:source_checksums);
+   xstring algo;
+   for(int i=0; res>=0 && i<first->count() && !algo; i++)
+   {
+      const char *cs=(*first)[i]->checksum;
+      if(cs)
+	 algo.nset(cs,strcspn(cs,":"));
+   }
+   if(checksum_pass==1 && algo)
+   {
+      // use the same algorithm on the other side.
+      checksum_pass=2;
+      ChecksumSession()->SetChecksumAlgo(algo);
+      ChecksumSession()->GetInfoArray(checksum_target_first?source_checksums.get_non_const():target_checksums.get_non_const());
+      return false;
+   }
+   if(checksum_pass==2 && res>=0)
+   {
+      Ref<FileSet> touch(new FileSet);
+      for(int i=0; i<source_checksums->count(); i++)
+      {
+	 const FileInfo *sf=(*source_checksums)[i];
+	 const FileInfo *tf=(*target_checksums)[i];
+	 if(!sf->Has(sf->CHECKSUM) || !tf->Has(tf->CHECKSUM)
+	 || strcmp(sf->checksum,tf->checksum))
+	    continue;
+	 FileInfo *file=to_transfer->FindByName(sf->name);
+	 if(!file)
+	    continue;
+	 if(verbose_report>=2)
+	    Report(_("Skipping file `%s' (same checksum)"),
+	       dir_file(source_relative_dir,file->name));
+	 stats.same_checksum++;
+	 if(same)
+	    same->Add(new FileInfo(*file));
+	 if(target_is_local)
+	    touch->Add(new FileInfo(*file));
+	 to_transfer->SubtractByName(sf->name);
+      }
+      // make the time match, so that the files are not compared again.
+      touch->LocalUtime(target_dir,false,false);
+   }
+   source_checksums=0;
+   target_checksums=0;
+   checksum_pass=0;
+   return true;
+}
+
+void MirrorJob::PredictTransfer(off_t size,int streams)
+{
+   if(parent_mirror)
+   {
+      root_mirror->PredictTransfer(size,streams);
+      return;
+   }
+   while(predicted_load.count()<parallel)
+      predicted_load.append(0);
+   // greedy list scheduling: each stream goes to the least loaded slot.
+   for(int s=0; s<streams; s++)
+   {
+      int min=0;
+      for(int i=1; i<predicted_load.count(); i++)
+	 if(predicted_load[i]<predicted_load[min])
+	    min=i;
+      predicted_load[min]+=size/streams;
+   }
+}
+long long MirrorJob::PredictedMaxLoad() const
+{
+   long long max=0;
+   for(int i=0; i<predicted_load.count(); i++)
+      if(predicted_load[i]>max)
+	 max=predicted_load[i];
+   return max;
+}
+
 void MirrorJob::ExcludeEmptyDir(const char *target_rel_dir)
 {
-   source_set->SubtractByName(basename_ptr(target_rel_dir));
+   if(source_set)
+      source_set->SubtractByName(basename_ptr(target_rel_dir));
+}
+
+/* In streaming mode the number of directories having their file sets
+   in memory is limited. A mirror can always start one sub-mirror, so that
+   the tree depth does not cause a deadlock; more sub-mirrors are started
+   only while the total count is below the parallel transfer count. */
+bool MirrorJob::CanStartSubMirror()
+{
+   if(!FlagSet(STREAMING) || running_dirs==0)
+      return true;
+   return root_mirror->active_dirs<parallel;
+}
+
+/* The listings can be compared in parts only when no step needs the
+   whole directory at once. */
+bool MirrorJob::CanStreamListing()
+{
+   return FlagSet(STREAMING) && !fan_out
+      && !AnyFlagSet(DEPTH_FIRST|SCAN_ALL_FIRST|TARGET_FLAT|REMOVE_FIRST
+		     |DETECT_RENAMES|COMPARE_CHECKSUMS);
+}
+
+/* Takes the source entries which have arrived so far together with the
+   matching target entries, so that they are transferred while the rest
+   of the source listing is coming. */
+bool MirrorJob::TakeListingPart()
+{
+   Ref<FileSet> part(source_list_info->TakePartial());
+   if(!part)
+      return false;
+   part->ExcludeDots();
+   if(part->count()==0)
+      return false;
+   if(!listing_streamed)
+   {
+      listing_streamed=true;
+      target_set_rest=target_set.borrow();
+   }
+   if(target_set_rest)
+   {
+      target_set=new FileSet();
+      part->rewind();
+      for(FileInfo *fi=part->curr(); fi; fi=part->next())
+      {
+	 const FileInfo *t=target_set_rest->FindByName(fi->name);
+	 if(!t)
+	    continue;
+	 target_set->Add(new FileInfo(*t));
+	 target_set_rest->SubtractByName(fi->name);
+      }
+   }
+   source_set=part.borrow();
+   stream_part=true;
+   return true;
+}
+
+static void carry_set(Ref<FileSet>& carried,Ref<FileSet>& set)
+{
+   if(!set)
+      return;
+   if(!carried)
+      carried=new FileSet();
+   carried->Merge(set);
+   set=0;
+}
+static void merge_carried(Ref<FileSet>& set,Ref<FileSet>& carried)
+{
+   if(!carried)
+      return;
+   carried->Merge(set);
+   set=carried.borrow();
+   set->rewind();
+}
+
+/* Keeps the sets of a part whose transfers are still running, so that the
+   next part can be transferred meanwhile. */
+void MirrorJob::CarryPart()
+{
+   carry_set(carried_transfer,to_transfer);
+   carry_set(carried_same,same);
+   carry_set(carried_rm,to_rm);
+   carry_set(carried_rm_src,to_rm_src);
+   carry_set(carried_target,target_set);
+   for(int i=0; i<waiting.count(); i++)
+      carried_jobs.append(waiting[i]);
+}
+// the carried parts are finished together with the current one.
+void MirrorJob::MergeCarried()
+{
+   merge_carried(to_transfer,carried_transfer);
+   merge_carried(same,carried_same);
+   merge_carried(to_rm,carried_rm);
+   merge_carried(to_rm_src,carried_rm_src);
+   merge_carried(target_set,carried_target);
+}
+// a transfer of a carried part is counted as such in any state.
+bool MirrorJob::CarriedJob(Job *j)
+{
+   for(int i=0; i<carried_jobs.count(); i++)
+   {
+      if(carried_jobs[i]!=j)
+	 continue;
+      carried_jobs.remove(i);
+      return true;
+   }
+   return false;
 }
 
 /* root_transfer_count of child mirrors contains the value to add or
@@ -802,7 +1393,9 @@ void MirrorJob::HandleListInfoCreation(const FileAccessRef& session,SMTaskRef<Li
       set_state(FINISHING);
       return;
    }
-   list_info->UseCache(use_cache);
+   // the prefetched listing is as fresh as a new one.
+   list_info->UseCache(use_cache
+      || (&session==&source_session ? source_prefetched : target_prefetched));
    int need=FileInfo::ALL_INFO;
    if(FlagSet(IGNORE_TIME))
       need&=~FileInfo::DATE;
@@ -839,6 +1432,32 @@ void MirrorJob::HandleListInfo(SMTaskRef<ListInfo>& list_info, Ref<FileSet>& set
    set->ExcludeDots(); // don't need .. and .
 }
 
+bool MirrorJob::TakeSharedListing()
+{
+   shared_listing_wait=false;
+   if(!fan_out)
+      return false;
+   switch(fan_out->TakeListing(source_relative_dir,source_set))
+   {
+   case MirrorFanOut::LIST:
+      listing_for_fan_out=true;
+      return false;
+   case MirrorFanOut::WAIT:
+      shared_listing_wait=true;
+      break;
+   }
+   return true;
+}
+void MirrorJob::ShareSourceListing()
+{
+   if(!listing_for_fan_out)
+      return;
+   if(state==GETTING_LIST_INFO && !source_set)
+      return;
+   listing_for_fan_out=false;
+   fan_out->PutListing(source_relative_dir,source_set.get());
+}
+
 int   MirrorJob::Do()
 {
    int	 res;
@@ -954,7 +1573,10 @@ int   MirrorJob::Do()
    pre_GETTING_LIST_INFO:
       set_state(GETTING_LIST_INFO);
       m=MOVED;
-      if(!source_set)
+      target_set_rest=0;
+      listing_streamed=false;
+      WatchSourceDir();
+      if(!source_set && !TakeSharedListing())
 	 HandleListInfoCreation(source_session,source_list_info,source_relative_dir);
       if(!target_set && !create_target_dir
       && (!FlagSet(DEPTH_FIRST) || FlagSet(ONLY_EXISTING))
@@ -965,15 +1587,47 @@ int   MirrorJob::Do()
 	 source_list_info=0;
 	 target_list_info=0;
       }
+      ShareSourceListing();
       return m;	  // give time to other tasks
    case(GETTING_LIST_INFO):
+      while(carried_jobs.count()>0 && (j=FindDoneAwaitedJob())!=0)
+      {
+	 CarriedJob(j);
+	 TransferFinished(j);
+	 m=MOVED;
+      }
+      if(shared_listing_wait && !TakeSharedListing())
+	 HandleListInfoCreation(source_session,source_list_info,source_relative_dir);
       HandleListInfo(source_list_info,source_set);
       HandleListInfo(target_list_info,target_set,&target_set_excluded);
+      ShareSourceListing();
       if(state!=GETTING_LIST_INFO)
 	 return MOVED;
-      if(source_list_info || target_list_info)
+      if(source_list_info && !target_list_info && !shared_listing_wait
+      && CanStreamListing())
+      {
+	 bool first=!listing_streamed;
+	 if(!TakeListingPart())
+	    return m;
+	 if(first)
+	 {
+	    MirrorFinished(); // leave room for transfers.
+	    if(parent_mirror)
+	       stats.dirs++;
+	 }
+	 goto compare_sets;
+      }
+      if(source_list_info || target_list_info || shared_listing_wait)
 	 return m;
 
+      if(listing_streamed)
+      {
+	 // the last part; the target entries left are compared with it,
+	 // so that the old ones get removed.
+	 target_set=target_set_rest.borrow();
+	 goto compare_sets;
+      }
+
       MirrorFinished(); // leave room for transfers.
 
       if(FlagSet(DEPTH_FIRST) && source_set && !target_set)
@@ -1015,6 +1669,7 @@ int   MirrorJob::Do()
 	 goto pre_DONE;
       }
 
+   compare_sets:
       if(source_set_recursive) {
 	 source_set->Merge(source_set_recursive);
 	 source_set_recursive=0;
@@ -1024,25 +1679,61 @@ int   MirrorJob::Do()
 	 target_set_recursive=0;
       }
       InitSets();
+      if(FlagSet(STREAMING) && !FlagSet(DEPTH_FIRST))
+	 source_set=0;	// the derived sets are enough from now on
+      if(FlagSet(COMPARE_CHECKSUMS) && InitChecksums())
+      {
+	 set_state(GETTING_CHECKSUMS);
+	 return MOVED;
+      }
+   pre_PREFETCHING_LISTS:
+      if(InitListPrefetch())
+      {
+	 set_state(PREFETCHING_LISTS);
+	 return MOVED;
+      }
+   pre_SETS_READY:
+      if(fan_out)
+      {
+	 fan_out->Decide(source_relative_dir,to_transfer);
+	 fan_out_pending=true;
+      }
+      InitBulk();
 
-      to_transfer->CountBytes(&bytes_to_transfer);
-      if(parent_mirror)
-	 parent_mirror->AddBytesToTransfer(bytes_to_transfer);
+      {
+	 long long bytes=0;
+	 to_transfer->CountBytes(&bytes);
+	 AddBytesToTransfer(bytes);
+      }
 
       to_rm->Count(&stats.del_dirs,&stats.del_files,&stats.del_symlinks,&stats.del_files);
       to_rm->rewind();
       to_rm_mismatched->Count(&stats.del_dirs,&stats.del_files,&stats.del_symlinks,&stats.del_files);
       to_rm_mismatched->rewind();
 
-      target_set->Merge(target_set_excluded);
-      target_set_excluded=0;
+      if(!stream_part)
+      {
+	 target_set->Merge(target_set_excluded);
+	 target_set_excluded=0;
+      }
 
       set_state(TARGET_REMOVE_OLD_FIRST);
       goto TARGET_REMOVE_OLD_FIRST_label;
 
+   case(GETTING_CHECKSUMS):
+      if(!ChecksumsDone())
+	 return m;
+      goto pre_PREFETCHING_LISTS;
+
+   case(PREFETCHING_LISTS):
+      if((source_prefetch && !source_prefetch->Done())
+      || (target_prefetch && !target_prefetch->Done()))
+	 return m;
+      goto pre_SETS_READY;
+
    pre_TARGET_MKDIR:
       if(!to_mkdir)
-	 goto pre_WAITING_FOR_TRANSFER;
+	 goto pre_TARGET_RENAME;
       to_mkdir->rewind();
       set_state(TARGET_MKDIR);
       m=MOVED;
@@ -1059,7 +1750,7 @@ int   MirrorJob::Do()
       {
 	 file=to_mkdir->curr();
 	 if(!file)
-	    goto pre_WAITING_FOR_TRANSFER;
+	    goto pre_TARGET_RENAME;
 	 to_mkdir->next();
 	 if(!file->TypeIs(file->DIRECTORY))
 	    continue;
@@ -1077,14 +1768,68 @@ int   MirrorJob::Do()
       }
       break;
 
+   pre_TARGET_RENAME:
+      if(rename_index>=rename_to.Count())
+	 goto pre_WAITING_FOR_TRANSFER;
+      set_state(TARGET_RENAME);
+      m=MOVED;
+      /*fallthrough*/
+   case(TARGET_RENAME):
+      while((j=FindDoneAwaitedJob())!=0)
+      {
+	 RenameFinished(j);
+	 m=MOVED;
+      }
+      if(max_error_count>0 && stats.error_count>=max_error_count)
+	 goto pre_FINISHING;
+      // the new names may be in just created directories
+      if(rename_index==0 && waiting_num>0)
+	 break;
+      while(transfer_count<parallel && state==TARGET_RENAME)
+      {
+	 if(rename_index>=rename_to.Count())
+	 {
+	    if(waiting_num>0)
+	       break;
+	    goto pre_WAITING_FOR_TRANSFER;
+	 }
+	 int i=rename_index++;
+	 const char *from=rename_from[i];
+	 const char *to=rename_to[i];
+	 if(script)
+	 {
+	    ArgV args("mv");
+	    args.Append(target_session->GetFileURL(from));
+	    args.Append(target_session->GetFileURL(to));
+	    xstring_ca cmd(args.CombineQuoted());
+	    fprintf(script,"%s\n",cmd.get());
+	 }
+	 const char *from_rel=alloca_strdup(dir_file(target_relative_dir,from));
+	 const char *to_rel=dir_file(target_relative_dir,to);
+	 Report(_("Renaming `%s' to `%s'"),from_rel,to_rel);
+	 if(!script_only)
+	 {
+	    mvJob *j=new mvJob(target_session->Clone(),from,to);
+	    j->cmdline.vset("mv ",from," ",to,NULL);
+	    JobStarted(j);
+	    rename_jobs[i]=j;
+	    m=MOVED;
+	 }
+	 else
+	    RenameDone(i,true);
+      }
+      break;
+
    pre_WAITING_FOR_TRANSFER:
       to_transfer->rewind();
+      deferred_dirs.truncate();
       set_state(WAITING_FOR_TRANSFER);
       m=MOVED;
       /*fallthrough*/
    case(WAITING_FOR_TRANSFER):
       while((j=FindDoneAwaitedJob())!=0)
       {
+	 CarriedJob(j);
 	 TransferFinished(j);
 	 m=MOVED;
       }
@@ -1092,11 +1837,28 @@ int   MirrorJob::Do()
 	 goto pre_FINISHING;
       while(transfer_count<parallel && state==WAITING_FOR_TRANSFER)
       {
+	 if(deferred_dirs.count()>0 && CanStartSubMirror())
+	 {
+	    HandleFile(deferred_dirs[0]);
+	    deferred_dirs.remove(0);
+	    m=MOVED;
+	    continue;
+	 }
 	 file=to_transfer->curr();
 	 if(!file)
 	 {
+	    ReleaseBulk();
+	    fan_out_pending=false;
+	    if(stream_part && waiting_num>0 && deferred_dirs.count()==0)
+	    {
+	       // take the next part while these transfers are running.
+	       CarryPart();
+	       stream_part=false;
+	       set_state(GETTING_LIST_INFO);
+	       return MOVED;
+	    }
 	    // go to the next step only when all transfers have finished
-	    if(waiting_num>0)
+	    if(waiting_num>0 || deferred_dirs.count()>0)
 	       break;
 	    if(FlagSet(DEPTH_FIRST))
 	    {
@@ -1118,6 +1880,21 @@ int   MirrorJob::Do()
 	    }
 	    goto pre_TARGET_REMOVE_OLD;
 	 }
+	 if(renamed.exists(file->name))
+	 {
+	    // it has been renamed on the target already.
+	    if(fan_out && fan_out_shared(file))
+	       fan_out->Unwant(dir_file(source_relative_dir,file->name));
+	    to_transfer->next();
+	    continue;
+	 }
+	 if(file->TypeIs(file->DIRECTORY) && !CanStartSubMirror())
+	 {
+	    // start it later, the files can be transferred meanwhile.
+	    deferred_dirs.append(file);
+	    to_transfer->next();
+	    continue;
+	 }
 	 HandleFile(file);
 	 to_transfer->next();
 	 m=MOVED;
@@ -1125,6 +1902,14 @@ int   MirrorJob::Do()
       break;
 
    pre_TARGET_REMOVE_OLD:
+      MergeCarried();
+      if(FlagSet(STREAMING))
+      {
+	 // these are only needed while transferring files
+	 new_files_set=0;
+	 old_files_set=0;
+	 to_rm_mismatched=0;
+      }
       if(FlagSet(REMOVE_FIRST))
 	 goto pre_TARGET_CHMOD;
       set_state(TARGET_REMOVE_OLD);
@@ -1135,7 +1920,10 @@ int   MirrorJob::Do()
    TARGET_REMOVE_OLD_FIRST_label:
       while((j=FindDoneAwaitedJob())!=0)
       {
-	 JobFinished(j);
+	 if(CarriedJob(j))
+	    TransferFinished(j);
+	 else
+	    JobFinished(j);
 	 m=MOVED;
       }
       if(max_error_count>0 && stats.error_count>=max_error_count)
@@ -1209,6 +1997,8 @@ int   MirrorJob::Do()
       break;
 
    pre_TARGET_CHMOD:
+      if(FlagSet(STREAMING))
+	 to_rm=0;
       if(FlagSet(NO_PERMS))
 	 goto pre_FINISHING_FIX_LOCAL;
 
@@ -1287,9 +2077,22 @@ int   MirrorJob::Do()
 	 if(FlagSet(ALLOW_CHOWN) && same)
 	    same->LocalChown(target_dir,flat);
       }
+      if(FlagSet(STREAMING))
+      {
+	 // free the file sets before waiting for sub-jobs to finish.
+	 to_transfer=0;
+	 target_set=0;
+	 if(!remove_source_files)
+	    same=0;
+      }
       if(remove_source_files && (same || to_rm_src))
 	 goto pre_SOURCE_REMOVING_SAME;
+      if(stream_part)
+	 goto next_part;
    pre_FINISHING:
+      carried_jobs.truncate();
+      if(fan_out_pending)
+	 UnwantShared(state==WAITING_FOR_TRANSFER?to_transfer->curr_index():0);
       set_state(FINISHING);
       m=MOVED;
       /*fallthrough*/
@@ -1331,9 +2134,14 @@ int   MirrorJob::Do()
 
       // all jobs finished and src dir removed, if needed.
 
-      transfer_count++; // parent mirror will decrement it.
+      if(!FanOutFinished())
+	 break;
+
       if(parent_mirror)
+      {
+	 transfer_count++; // parent mirror will decrement it.
 	 parent_mirror->stats.Add(stats);
+      }
       else
       {
 	 if(stats.HaveSomethingDone(flags) && on_change)
@@ -1370,7 +2178,11 @@ int   MirrorJob::Do()
 	 file=same->curr();
 	 same->next();
 	 if(!file)
+	 {
+	    if(stream_part)
+	       goto next_part;
 	    goto pre_FINISHING;
+	 }
 	 if(file->TypeIs(file->DIRECTORY))
 	    continue;
 	 if(script)
@@ -1394,6 +2206,13 @@ int   MirrorJob::Do()
       }
       break;
 
+   next_part:
+      // this part is done, take the next one.
+      same=0;
+      stream_part=false;
+      set_state(GETTING_LIST_INFO);
+      return MOVED;
+
    case(LAST_EXEC):
       while((j=FindDoneAwaitedJob())!=0)
       {
@@ -1407,11 +2226,24 @@ int   MirrorJob::Do()
       set_state(DONE);
       m=MOVED;
       bytes_transferred=0;
+      if(counted_as_active)
+      {
+	 counted_as_active=false;
+	 parent_mirror->running_dirs--;
+	 root_mirror->active_dirs--;
+      }
+      if(!parent_mirror && watch)
+      {
+	 if(stats.HaveSomethingDone(flags) || stats.error_count)
+	    PrintStatus(0,"");
+	 goto pre_WATCHING;
+      }
       if(!parent_mirror && FlagSet(LOOP) && stats.HaveSomethingDone(flags) && !stats.error_count)
       {
 	 PrintStatus(0,"");
 	 printf(_("Retrying mirror...\n"));
 	 stats.Reset();
+	 predicted_load.truncate();
 	 source_set=0;
 	 target_set=0;
 	 goto pre_GETTING_LIST_INFO;
@@ -1419,6 +2251,38 @@ int   MirrorJob::Do()
       /*fallthrough*/
    case(DONE):
       break;
+
+   pre_WATCHING:
+      set_state(WATCHING);
+      m=MOVED;
+      /*fallthrough*/
+   case(WATCHING):
+      if(watch->Error())
+      {
+	 eprintf("mirror: %s\n",watch->ErrorText());
+	 stats.error_count++;
+	 watch=0;
+	 goto pre_DONE;
+      }
+      if(watch->Overflow() || watch_verify.Stopped())
+      {
+	 // some changes could be missed, check everything.
+	 Report(_("Checking the whole tree for changes"));
+	 watch->Forget();
+	 watch_verify.Reset();
+	 stats.Reset();
+	 predicted_load.truncate();
+	 source_set=0;
+	 target_set=0;
+	 goto pre_GETTING_LIST_INFO;
+      }
+      if(!watch->HasChanges())
+	 break;
+      watch->TakeChanges(watch_dirs);
+      stats.Reset();
+      predicted_load.truncate();
+      MirrorChangedDirs();
+      goto pre_FINISHING;
    }
    // give direct parent priority over grand-parents.
    if(transfer_count<parallel && parent_mirror)
@@ -1443,6 +2307,22 @@ MirrorJob::MirrorJob(MirrorJob *parent,
    source_is_local=!strcmp(source_session->GetProto(),"file");
    target_is_local=!strcmp(target_session->GetProto(),"file");
 
+   rename_index=0;
+   checksum_target_first=false;
+   checksum_pass=0;
+   source_prefetched=false;
+   target_prefetched=false;
+   fan_out=0;
+   fan_out_pending=false;
+   bulk=0;
+   shared_listing_wait=false;
+   listing_for_fan_out=false;
+   running_dirs=0;
+   active_dirs=0;
+   counted_as_active=false;
+   listing_streamed=false;
+   stream_part=false;
+
    create_target_dir=true;
    no_target_dir=false;
    remove_this_source_dir=false;
@@ -1452,6 +2332,7 @@ MirrorJob::MirrorJob(MirrorJob *parent,
    max_error_count=0;
 
    exclude=0;
+   top_exclude=0;
 
    set_state(INITIAL_STATE);
 
@@ -1471,6 +2352,7 @@ MirrorJob::MirrorJob(MirrorJob *parent,
    parallel=1;
    pget_n=1;
    pget_minchunk=0x10000;
+   balanced_schedule=false;
 
    source_redirections=0;
    target_redirections=0;
@@ -1489,6 +2371,7 @@ MirrorJob::MirrorJob(MirrorJob *parent,
       UseCache(parent->use_cache);
 
       SetExclude(parent->exclude);
+      fan_out=parent->fan_out;
 
       verbose_report=parent->verbose_report;
       newer_than=parent->newer_than;
@@ -1515,6 +2398,7 @@ MirrorJob::MirrorJob(MirrorJob *parent,
 
 MirrorJob::~MirrorJob()
 {
+   ReleaseBulk();
    if(script && script_needs_closing)
       fclose(script);
 }
@@ -1609,14 +2493,69 @@ void MirrorJob::Fg()
    Job::Fg();
    source_session->SetPriority(1);
    target_session->SetPriority(1);
+   for(int i=0; i<fan_out_jobs.count(); i++)
+      fan_out_jobs[i]->Fg();
 }
 void MirrorJob::Bg()
 {
+   for(int i=0; i<fan_out_jobs.count(); i++)
+      fan_out_jobs[i]->Bg();
    source_session->SetPriority(0);
    target_session->SetPriority(0);
    Job::Bg();
 }
 
+void MirrorJob::AddFanOutTarget(FileAccess *target,const char *new_target_dir)
+{
+   if(!fan_out)
+   {
+      fan_out_ref=new MirrorFanOut();
+      fan_out=fan_out_ref.get_non_const();
+      fan_out->AddTarget();
+   }
+   MirrorJob *j=new MirrorJob(0,source_session->Clone(),target,source_dir,new_target_dir);
+   j->fan_out=fan_out;
+   fan_out->AddTarget();
+
+   // the same settings as this mirror has.
+   j->SetFlags(flags,1);
+   j->UseCache(use_cache);
+   j->SetExclude(exclude);
+   j->top_exclude=top_exclude;
+   j->verbose_report=verbose_report;
+   j->newer_than=newer_than;
+   j->older_than=older_than;
+   j->size_range=size_range;
+   j->parallel=parallel;
+   j->pget_n=pget_n;
+   j->pget_minchunk=pget_minchunk;
+   j->skip_noaccess=skip_noaccess;
+   j->recursion_mode=recursion_mode;
+   j->script=script;
+   j->script_name.set(script_name);
+   j->script_only=script_only;
+   j->max_error_count=max_error_count;
+
+   j->cmdline.vset("\\mirror `",target->GetFileURL(new_target_dir).get(),"'",NULL);
+   j->SetParent(this);
+   fan_out_jobs.append(j);
+}
+
+// wait for the mirrors to the other targets and add up their statistics.
+bool MirrorJob::FanOutFinished()
+{
+   for(int i=0; i<fan_out_jobs.count(); i++)
+      if(!fan_out_jobs[i]->Done())
+	 return false;
+   for(int i=0; i<fan_out_jobs.count(); i++)
+   {
+      stats.Add(fan_out_jobs[i]->stats);
+      Delete(fan_out_jobs[i]);
+   }
+   fan_out_jobs.truncate();
+   return true;
+}
+
 MirrorJob::Statistics::Statistics()
 {
    Reset();
@@ -1626,7 +2565,7 @@ MirrorJob::Statistics::Statistics()
 }
 void MirrorJob::Statistics::Reset()
 {
-   tot_files=new_files=mod_files=del_files=
+   tot_files=new_files=mod_files=del_files=renamed_files=same_checksum=
    tot_symlinks=new_symlinks=mod_symlinks=del_symlinks=
    dirs=del_dirs=0;
 }
@@ -1636,6 +2575,8 @@ void MirrorJob::Statistics::Add(const Statistics &s)
    new_files   +=s.new_files;
    mod_files   +=s.mod_files;
    del_files   +=s.del_files;
+   renamed_files+=s.renamed_files;
+   same_checksum+=s.same_checksum;
    tot_symlinks+=s.tot_symlinks;
    new_symlinks+=s.new_symlinks;
    mod_symlinks+=s.mod_symlinks;
@@ -1649,7 +2590,7 @@ void MirrorJob::Statistics::Add(const Statistics &s)
 bool MirrorJob::Statistics::HaveSomethingDone(unsigned flags)
 {
    bool del=(flags&MirrorJob::DELETE);
-   return new_files|mod_files|(del_files*del)|new_symlinks|mod_symlinks|(del_symlinks*del)|(del_dirs*del);
+   return new_files|mod_files|renamed_files|(del_files*del)|new_symlinks|mod_symlinks|(del_symlinks*del)|(del_dirs*del);
 }
 
 const char *MirrorJob::SetScriptFile(const char *n)
@@ -1676,6 +2617,61 @@ void MirrorJob::SetOnChange(const char *oc)
    on_change.set(oc);
 }
 
+const char *MirrorJob::Watch()
+{
+   if(!source_is_local)
+      return _("--watch requires a local source directory");
+   watch=new DirWatch();
+   if(watch->Error())
+      return watch->ErrorText();
+   watch_verify.SetResource("mirror:watch-verify-interval",0);
+   watch_verify.Reset();
+   return 0;
+}
+
+void MirrorJob::WatchSourceDir()
+{
+   // the first pass and the verification passes add all the directories,
+   // the directories created later are added when they are mirrored.
+   if(root_mirror->watch && !source_set)
+      root_mirror->watch->Add(source_dir,source_relative_dir);
+}
+
+void MirrorJob::MirrorChangedDirs()
+{
+   for(int i=0; i<watch_dirs.Count(); i++)
+   {
+      const char *dir=watch_dirs[i];
+      xstring_c source_name(dir_file(source_dir,dir));
+      xstring_c target_name(dir_file(target_dir,dir));
+
+      // a removed directory is handled by mirroring its parent.
+      struct stat st;
+      if(stat(source_name,&st)==-1 || !S_ISDIR(st.st_mode))
+	 continue;
+
+      MirrorJob *mj=new MirrorJob(this,
+	 source_session->Clone(),target_session->Clone(),
+	 source_name,target_name);
+      AddWaiting(mj);
+      running_dirs++;
+      root_mirror->active_dirs++;
+      mj->counted_as_active=true;
+      mj->cmdline.vset("\\mirror `",dir[0]?dir:".","'",NULL);
+      if(dir[0])
+      {
+	 mj->source_relative_dir.set(dir);
+	 mj->target_relative_dir.set(dir);
+      }
+      // existing subdirectories are watched on their own,
+      // so only the new ones need to be descended into.
+      if(mj->recursion_mode==RECURSION_ALWAYS && !FlagSet(DEPTH_FIRST))
+	 mj->recursion_mode=RECURSION_MISSING;
+
+      Report(_("Mirroring changes in `%s'"),dir[0]?dir:".");
+   }
+}
+
 const char *MirrorJob::AddPattern(Ref<PatternSet>& exclude,char opt,const char *optarg)
 {
    PatternSet::Type type=
@@ -1764,6 +2760,156 @@ const char *MirrorJob::SetRecursionMode(const char *m)
    return xstring::format(_("%s must be one of: %s"),"--recursion",list.get());
 }
 
+// MirrorFanOut
+bool MirrorFanOut::AllDecided(const char *dir) const
+{
+   const Dir *d=dirs.lookup(dir);
+   return !d || d->decided>=targets;
+}
+int MirrorFanOut::TakeListing(const char *dir,Ref<FileSet>& set)
+{
+   if(!dir)
+      dir="";
+   Dir *d=dirs.lookup(dir);
+   if(!d)
+   {
+      d=new Dir;
+      dirs.add(dir,d);
+   }
+   if(d->listing_pending)
+      return WAIT;
+   d->taken++;
+   if(!d->listing)
+   {
+      // the first target lists the directory for all.
+      d->listing_pending=true;
+      return LIST;
+   }
+   set=new FileSet(d->listing);
+   if(d->taken>=targets)
+      d->listing=0;
+   return GOT;
+}
+void MirrorFanOut::PutListing(const char *dir,const FileSet *set)
+{
+   if(!dir)
+      dir="";
+   Dir *d=dirs.lookup(dir);
+   if(!d)
+      return;
+   d->listing_pending=false;
+   if(!set)
+   {
+      // failed, the next target will try to list the directory itself.
+      Decide(dir,0);
+      return;
+   }
+   if(d->taken<targets)
+      d->listing=new FileSet(set);
+}
+void MirrorFanOut::Decide(const char *dir,const FileSet *to_transfer)
+{
+   if(!dir)
+      dir="";
+   for(int i=0; to_transfer && i<to_transfer->count(); i++)
+   {
+      const FileInfo *fi=(*to_transfer)[i];
+      if(!fan_out_shared(fi))
+	 continue;
+      const char *name=dir_file(dir,fi->name);
+      File *f=files.lookup(name);
+      if(!f)
+      {
+	 f=new File(name,dir);
+	 files.add(name,f);
+      }
+      f->wanted++;
+   }
+   Dir *d=dirs.lookup(dir);
+   if(!d)
+   {
+      d=new Dir;
+      dirs.add(dir,d);
+   }
+   d->decided++;
+   if(d->decided>=targets && d->taken>=targets && !d->listing_pending)
+      dirs.remove(xstring::get_tmp(dir));
+}
+FileCopyPeer *MirrorFanOut::Source(const char *name,FileCopyPeer *src)
+{
+   File *f=files.lookup(name);
+   if(!f)
+      return src;
+   f->joined++;
+   if(f->tee)
+   {
+      Delete(src);
+      return f->tee->NewPeer();
+   }
+   if(f->joined<f->wanted)
+   {
+      // other targets need the file too, give them time to join.
+      f->tee=new FileCopyTee(src);
+      f->tee->Hold();
+      f->gather.Reset();
+      gathering.append(f);
+      return f->tee->NewPeer();
+   }
+   Resolved(f);
+   return src;
+}
+void MirrorFanOut::Unwant(const char *name)
+{
+   File *f=files.lookup(name);
+   if(!f)
+      return;
+   f->wanted--;
+   Resolved(f);
+}
+void MirrorFanOut::Resolved(File *f)
+{
+   if(!f->tee && f->joined>=f->wanted)
+      files.remove(xstring::get_tmp(f->name));
+}
+void MirrorFanOut::StartTee(int i)
+{
+   File *f=gathering[i];
+   gathering.remove(i);
+   f->tee->Start();
+   f->tee->Release();
+   f->tee=0;
+   Resolved(f);
+}
+int MirrorFanOut::Do()
+{
+   int m=STALL;
+   for(int i=0; i<gathering.count(); i++)
+   {
+      File *f=gathering[i];
+      if(!f->gather.Stopped()
+      && (f->joined<f->wanted || !AllDecided(f->dir)))
+	 continue;
+      StartTee(i--);
+      m=MOVED;
+   }
+   return m;
+}
+void MirrorFanOut::PrepareToDie()
+{
+   while(gathering.count()>0)
+      StartTee(0);
+}
+
+static bool fxp_possible(const FileAccess *s,const FileAccess *t)
+{
+   const char *sp=s->GetProto();
+   const char *tp=t->GetProto();
+   return (!strcmp(sp,"ftp") || !strcmp(sp,"ftps"))
+      && (!strcmp(tp,"ftp") || !strcmp(tp,"ftps"))
+      && ResMgr::QueryBool("ftp:use-fxp",s->GetHostName())
+      && ResMgr::QueryBool("ftp:use-fxp",t->GetHostName());
+}
+
 CMD(mirror)
 {
 #define args (parent->args)
@@ -1802,6 +2948,11 @@ CMD(mirror)
       OPT_TRANSFER_ALL,
       OPT_TARGET_FLAT,
       OPT_DELETE_EXCLUDED,
+      OPT_STREAMING,
+      OPT_DETECT_RENAMES,
+      OPT_FAN_OUT,
+      OPT_WATCH,
+      OPT_CHECKSUM,
    };
    static const struct option mirror_opts[]=
    {
@@ -1864,6 +3015,11 @@ CMD(mirror)
       {"transfer-all",no_argument,0,OPT_TRANSFER_ALL},
       {"flat",no_argument,0,OPT_TARGET_FLAT},
       {"delete-excluded",no_argument,0,OPT_DELETE_EXCLUDED},
+      {"streaming",no_argument,0,OPT_STREAMING},
+      {"detect-renames",no_argument,0,OPT_DETECT_RENAMES},
+      {"fan-out",required_argument,0,OPT_FAN_OUT},
+      {"watch",no_argument,0,OPT_WATCH},
+      {"checksum",no_argument,0,OPT_CHECKSUM},
       {0}
    };
 
@@ -1893,6 +3049,7 @@ CMD(mirror)
    const char *recursion_mode=0;
    bool single_file=false;
    bool single_dir=false;
+   StringSet fan_out_targets;
 
    Ref<PatternSet> exclude;
    Ref<PatternSet> top_exclude;
@@ -2117,6 +3274,21 @@ CMD(mirror)
       case(OPT_DELETE_EXCLUDED):
 	 flags|=MirrorJob::DELETE_EXCLUDED;
 	 break;
+      case(OPT_STREAMING):
+	 flags|=MirrorJob::STREAMING;
+	 break;
+      case(OPT_DETECT_RENAMES):
+	 flags|=MirrorJob::DETECT_RENAMES;
+	 break;
+      case(OPT_FAN_OUT):
+	 fan_out_targets.Append(optarg);
+	 break;
+      case(OPT_WATCH):
+	 flags|=MirrorJob::WATCH;
+	 break;
+      case(OPT_CHECKSUM):
+	 flags|=MirrorJob::COMPARE_CHECKSUMS;
+	 break;
       case('?'):
 	 eprintf(_("Try `help %s' for more information.\n"),args->a0());
       no_job:
@@ -2238,6 +3410,23 @@ CMD(mirror)
       return 0;
    }
 
+   if((flags&MirrorJob::STREAMING) && (flags&MirrorJob::SCAN_ALL_FIRST)) {
+      eprintf(_("%s: --streaming conflicts with --scan-all-first and --flat\n"),args->a0());
+      return 0;
+   }
+   if(fan_out_targets.Count()>0
+   && ((flags&MirrorJob::LOOP) || remove_source_files || remove_source_dirs)) {
+      eprintf(_("%s: --fan-out conflicts with --loop and --Remove-source-*\n"),args->a0());
+      return 0;
+   }
+   if((flags&MirrorJob::WATCH)
+   && ((flags&(MirrorJob::LOOP|MirrorJob::TARGET_FLAT|MirrorJob::SCAN_ALL_FIRST))
+       || remove_source_files || remove_source_dirs || script_only
+       || fan_out_targets.Count()>0)) {
+      eprintf(_("%s: --watch conflicts with --loop, --flat, --scan-all-first, --fan-out, --dry-run and --Remove-source-*\n"),args->a0());
+      return 0;
+   }
+
    if(parallel<0) {
       int parallel1=ResMgr::Query("mirror:parallel-transfer-count",source_session->GetHostName());
       int parallel2=ResMgr::Query("mirror:parallel-transfer-count",target_session->GetHostName());
@@ -2245,6 +3434,15 @@ CMD(mirror)
 	 parallel=parallel1;
       if(parallel2>0 && (parallel<0 || parallel>parallel2))
 	 parallel=parallel2;
+      if(parallel<0 && fxp_possible(source_session,target_session)) {
+	 // site-to-site copies don't use local bandwidth, so more of them
+	 // can be kept in flight to hide per-file command round trips.
+	 int fxp1=ResMgr::Query("ftp:fxp-parallel",source_session->GetHostName());
+	 int fxp2=ResMgr::Query("ftp:fxp-parallel",target_session->GetHostName());
+	 int fxp=(fxp1<fxp2?fxp1:fxp2);
+	 if(fxp>0)
+	    parallel=fxp;
+      }
    }
    if(use_pget<0) {
       int use_pget1=ResMgr::Query("mirror:use-pget-n",source_session->GetHostName());
@@ -2311,6 +3509,48 @@ CMD(mirror)
    j->SetMaxErrorCount(max_error_count);
    if(on_change)
       j->SetOnChange(on_change);
+   if(flags&MirrorJob::WATCH)
+   {
+      const char *err=j->Watch();
+      if(err)
+      {
+	 eprintf("%s: %s\n",args->a0(),err);
+	 return 0;
+      }
+   }
+
+   for(int i=0; i<fan_out_targets.Count(); i++)
+   {
+      const char *dir=fan_out_targets[i];
+      FileAccess *session=0;
+      ParsedURL url(dir);
+      if(url.proto && url.path)
+      {
+	 session=FileAccess::New(&url);
+	 if(!session)
+	 {
+	    eprintf("%s: %s%s\n",args->a0(),url.proto.get(),
+		     _(" - not supported protocol"));
+	    return 0;
+	 }
+	 dir=url.path;
+      }
+      else if(!reverse)
+	 session=FileAccess::New("file");
+      else
+	 session=parent->session->Clone();
+      xstring fan_out_dir;
+      fan_out_dir.set(dir);
+      if(last_char(fan_out_dir)=='/' && basename_ptr(fan_out_dir)[0]!='/'
+      && last_char(source_dir)!='/')
+      {
+	 // user wants source dir name appended, as for the target.
+	 const char *base=basename_ptr(source_dir);
+	 if(base[0]!='/' && strcmp(base,basename_ptr(fan_out_dir)))
+	    fan_out_dir.append(base);
+      }
+      j->AddFanOutTarget(session,fan_out_dir);
+   }
 
    return j.borrow();
 
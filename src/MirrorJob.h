@@ -24,7 +24,67 @@
 #include "FileSet.h"
 #include "Job.h"
 #include "PatternSet.h"
+#include "StringSet.h"
+#include "Timer.h"
+#include "xmap.h"
 #include "misc.h"
+#include "DirWatch.h"
+
+class FileCopyPeer;
+class FileCopyTee;
+class FileCopyBulk;
+
+/* Shares work between the mirrors of one source to several targets
+ * (mirror --fan-out). Each source directory is listed once, and a file
+ * needed by several targets is read once and fed to all of them. */
+class MirrorFanOut : public SMTask
+{
+   int targets;
+
+   struct Dir
+   {
+      Ref<FileSet> listing;
+      bool listing_pending;
+      int taken;    // targets which have got the listing
+      int decided;  // targets which know what to transfer
+      Dir() : listing_pending(false), taken(0), decided(0) {}
+   };
+   xmap_p<Dir> dirs;
+   bool AllDecided(const char *dir) const;
+
+   struct File
+   {
+      xstring_c name;
+      xstring_c dir;
+      int wanted;   // targets which are going to transfer the file
+      int joined;   // targets which have started the transfer
+      FileCopyTee *tee;
+      Timer gather;
+      File(const char *n,const char *d)
+	 : name(n), dir(d), wanted(0), joined(0), tee(0),
+	   gather("mirror:fan-out-wait",0) {}
+   };
+   xmap_p<File> files;
+   xarray<File*> gathering;   // files with a tee waiting for more targets
+   void Resolved(File *f);
+   void StartTee(int i);
+
+protected:
+   void PrepareToDie();
+
+public:
+   enum { LIST, WAIT, GOT };
+
+   MirrorFanOut() : targets(0) {}
+   void AddTarget() { targets++; }
+   int Do();
+
+   int TakeListing(const char *dir,Ref<FileSet>& set);
+   void PutListing(const char *dir,const FileSet *set);
+   void Decide(const char *dir,const FileSet *to_transfer);
+   FileCopyPeer *Source(const char *name,FileCopyPeer *src);
+   void Unwant(const char *name);
+};
 
 class MirrorJob : public Job
 {
@@ -44,14 +104,18 @@ private:
       CHANGING_DIR_SOURCE,
       CHANGING_DIR_TARGET,
       GETTING_LIST_INFO,
+      GETTING_CHECKSUMS,
+      PREFETCHING_LISTS,
       WAITING_FOR_TRANSFER,
       TARGET_REMOVE_OLD,
       TARGET_REMOVE_OLD_FIRST,
       TARGET_CHMOD,
       TARGET_MKDIR,
+      TARGET_RENAME,
       SOURCE_REMOVING_SAME,
       FINISHING,
       LAST_EXEC,
+      WATCHING,
       DONE
    };
    state_t state;
@@ -79,8 +143,19 @@ private:
    Ref<FileSet> new_files_set;
    Ref<FileSet> to_rm_src;
    void InitSets(); // deduce above sets from source_set and target_set
+
+   // files to be renamed on the target instead of transferred anew.
+   StringSet rename_from;
+   StringSet rename_to;
+   int rename_index;
+   xarray<Job*> rename_jobs;	// by rename index
+   xmap<bool> renamed;	// the new names which need no transfer
+   void FindRenames();
+   void RenameFinished(Job *j);
+   void RenameDone(int i,bool ok);
    void ExcludeEmptyDir(const char *target_rel_dir);
    bool only_dirs;  // to_transfer (or to_mkdir) contains directories only
+   bool balanced_schedule;  // mirror:sort-by=balanced
 
    void RemoveSourceLater(const FileInfo *fi) {
       if(!remove_source_files)
@@ -103,6 +178,36 @@ private:
 
    void	 HandleFile(FileInfo *);
 
+   /* number of sub-mirrors alive under this mirror (running_dirs),
+    * and in the whole tree (active_dirs, root mirror only). */
+   int running_dirs;
+   int active_dirs;
+   bool counted_as_active;
+   bool CanStartSubMirror();
+   xarray<FileInfo*> deferred_dirs;  // in to_transfer, waiting for CanStartSubMirror
+
+   /* with --streaming the source entries are compared with the target
+    * listing in parts, as they arrive. target_set_rest keeps the target
+    * entries not compared yet, stream_part is set while the sets hold
+    * a part which is not the last one. */
+   Ref<FileSet> target_set_rest;
+   bool listing_streamed;
+   bool stream_part;
+   bool CanStreamListing();
+   bool TakeListingPart();
+
+   /* the next part is taken while the transfers of the previous ones are
+    * running; the sets used after the transfers are kept here until then. */
+   Ref<FileSet> carried_transfer;
+   Ref<FileSet> carried_same;
+   Ref<FileSet> carried_rm;
+   Ref<FileSet> carried_rm_src;
+   Ref<FileSet> carried_target;
+   xarray<Job*> carried_jobs;
+   void CarryPart();
+   void MergeCarried();
+   bool CarriedJob(Job *j);
+
    bool create_target_dir;
    bool	no_target_dir;	   // target directory does not exist (for script_only)
    bool remove_this_source_dir;
@@ -110,6 +215,58 @@ private:
    SMTaskRef<ListInfo> source_list_info;
    SMTaskRef<ListInfo> target_list_info;
 
+   // shared with the mirrors to other targets, see MirrorFanOut.
+   MirrorFanOut *fan_out;
+   SMTaskRef<MirrorFanOut> fan_out_ref;	  // owned by the first root mirror
+   xarray<MirrorJob*> fan_out_jobs;	  // the root mirrors to other targets
+   bool shared_listing_wait;
+   bool listing_for_fan_out;
+   bool fan_out_pending;   // announced files of to_transfer not handled yet
+   void UnwantShared(int from);
+   bool TakeSharedListing();
+   void ShareSourceListing();
+   bool FanOutFinished();
+
+   // small files are copied in one stream over a batch of the source or
+   // the target session, when the protocol can do it (mirror:bulk-max-size).
+   FileCopyBulk *bulk;
+   void InitBulk();
+   void ReleaseBulk();
+
+   // an existing target file can be updated in place, sending only the
+   // changed blocks (mirror:delta-min-size).
+   bool UseDelta(const FileInfo *file,const FileInfo *old) const;
+
+   // mirror --watch: the source directories are watched for changes
+   // after the first pass, and only the changed ones are mirrored again.
+   SMTaskRef<DirWatch> watch;
+   Timer watch_verify;	  // time for a full pass
+   StringSet watch_dirs;
+   void WatchSourceDir();
+   void MirrorChangedDirs();
+
+   // mirror --checksum: files of equal size are compared by checksums
+   // instead of being transferred. The remote side is asked first, then
+   // the other side calculates the checksums with the same algorithm.
+   Ref<FileSet> source_checksums;
+   Ref<FileSet> target_checksums;
+   bool checksum_target_first;
+   int checksum_pass;
+   const FileAccessRef& ChecksumSession() const {
+      return (checksum_pass==1)==checksum_target_first ? target_session : source_session;
+   }
+   bool InitChecksums();
+   bool ChecksumsDone();
+
+   // the listings of the subdirectories are fetched in batches before the
+   // sub-mirrors start, when the protocol can do it.
+   SMTaskRef<ListPrefetch> source_prefetch;
+   SMTaskRef<ListPrefetch> target_prefetch;
+   bool source_prefetched;   // the listing of this directory is in the cache
+   bool target_prefetched;
+   bool InitListPrefetch();
+   static ListPrefetch *NewListPrefetch(const FileAccessRef& session,FileSet *dirs);
+
    xstring_c source_dir;
    xstring_c source_relative_dir;
    xstring_c target_dir;
@@ -117,7 +274,7 @@ private:
 
    struct Statistics
    {
-      int tot_files,new_files,mod_files,del_files;
+      int tot_files,new_files,mod_files,del_files,renamed_files,same_checksum;
       int dirs,del_dirs;
       int tot_symlinks,new_symlinks,mod_symlinks,del_symlinks;
       int error_count;
@@ -133,6 +290,13 @@ private:
    double transfer_time_elapsed;
    TimeDate transfer_start_ts;
 
+   /* bytes assigned to each of parallel transfer slots by the balanced
+    * scheduler, maintained in the root mirror. The largest value divided
+    * by the average per-transfer rate gives the predicted makespan. */
+   xarray<long long> predicted_load;
+   void PredictTransfer(off_t size,int streams);
+   long long PredictedMaxLoad() const;
+
    /* root_transfer_count is the global counter in the root mirror,
     * and weight of a non-root mirror in global transfer_count otherwise. */
    int	 root_transfer_count;
@@ -141,7 +305,8 @@ private:
    recursion_mode_t recursion_mode;
    int	 max_error_count;
 
-   Ref<PatternSet> top_exclude;
+   Ref<PatternSet> my_top_exclude;
+   const PatternSet *top_exclude;
    Ref<PatternSet> my_exclude;
    const PatternSet *exclude;
 
@@ -221,6 +386,10 @@ public:
       TRANSFER_ALL=1<<22,
       TARGET_FLAT=1<<23,
       DELETE_EXCLUDED=1<<24,
+      STREAMING=1<<25,
+      DETECT_RENAMES=1<<26,
+      WATCH=1<<27,
+      COMPARE_CHECKSUMS=1<<28,
    };
    void SetFlags(unsigned f,bool v)
    {
@@ -249,7 +418,7 @@ public:
    void	 SetExclude(const PatternSet *x) { exclude=x; }
    void	 SetSizeRange(Range *r) { my_size_range=r; size_range=my_size_range; }
    void	 SetSizeRange(const Range *r) { size_range=r; }
-   void	 SetTopExclude(PatternSet *x) { top_exclude=x; }
+   void	 SetTopExclude(PatternSet *x) { my_top_exclude=x; top_exclude=my_top_exclude; }
 
    void	 SetVerbose(int v) { verbose_report=v; }
 
@@ -277,6 +446,8 @@ public:
       }
    void SetMaxErrorCount(int ec) { max_error_count=ec; }
    void SetOnChange(const char *oc);
+   void AddFanOutTarget(FileAccess *target,const char *new_target_dir);
+   const char *Watch();
    static const char *AddPattern(Ref<PatternSet>& exclude,char opt,const char *optarg);
    static const char *AddPatternsFrom(Ref<PatternSet>& exclude,char opt,const char *file);
 };
@@ -56,6 +56,8 @@ void NetAccess::Init()
    connection_limit=0;	// no limit.
    connection_takeover=false;
 
+   spare=false;
+
    Reconfig(0);
    reconnect_interval_current=reconnect_interval;
 }
@@ -268,6 +270,124 @@ void NetAccess::Open(const char *fn,int mode,off_t offs)
 {
    timeout_timer.Reset();
    super::Open(fn,mode,offs);
+
+   if(!spare && hostname && mode!=CONNECT_VERIFY && !IsConnected()
+   && SpareSessionsSupported())
+   {
+      SiteData *data=GetSiteData();
+      if(!data->spare_sessions)
+	 data->spare_sessions=new SpareSessions();
+      data->spare_sessions->RampUp(this);
+   }
+}
+
+void NetAccess::SpareSessions::RampUp(const NetAccess *session)
+{
+   const char *host=session->GetHostName();
+   int max=ResMgr::Query("net:spare-sessions-max",host);
+   if(max<=0)
+      return;
+   int min=ResMgr::Query("net:spare-sessions-min",host);
+   if(min>max)
+      min=max;
+
+   if(!proto)
+   {
+      NetAccess *p=(NetAccess*)session->Clone();
+      p->spare=true;
+      proto=p;
+   }
+   // a new connection is needed while there are no idle ones,
+   // more parallel sessions are likely to follow.
+   if(CountReady(session)==0)
+   {
+      target++;
+      if(target<min)
+	 target=min;
+      if(target>max)
+	 target=max;
+   }
+}
+
+int NetAccess::SpareSessions::CountReady(const FileAccess *except)
+{
+   int count=0;
+   for(FileAccess *o=proto->FirstSameSite(); o!=0; o=proto->NextSameSite(o))
+   {
+      if(o!=except && o->IsConnected() && !o->IsOpen())
+	 count++;
+   }
+   return count;
+}
+
+bool NetAccess::SpareSessions::SiteBusy()
+{
+   for(FileAccess *fo=proto->FirstSameSite(); fo!=0; fo=proto->NextSameSite(fo))
+   {
+      NetAccess *o=(NetAccess*)fo; // we are sure it is NetAccess.
+      if(!o->spare && o->IsOpen())
+	 return true;
+   }
+   return false;
+}
+
+int NetAccess::SpareSessions::Do()
+{
+   int m=STALL;
+   if(!proto)
+      return m;
+
+   for(int i=0; i<spares.count(); i++)
+   {
+      Spare *s=spares[i];
+      if(s->session->IsOpen())
+      {
+	 int res=s->session->Done();
+	 if(res==IN_PROGRESS)
+	    continue;
+	 // a failed chdir still leaves the session logged in.
+	 s->session->Close();
+	 s->idle.Reset();
+	 m=MOVED;
+	 if(!s->session->IsConnected())
+	 {
+	    Log::global->Format(9,"---- spare session to %s failed, ramping down\n",
+	       proto->GetHostName());
+	    target=0;
+	 }
+      }
+      if(!s->session->IsConnected())
+      {
+	 // the connection was taken over by another session or lost.
+	 spares.remove(i--);
+	 m=MOVED;
+      }
+      else if(s->idle.Stopped())
+      {
+	 if(target>0)
+	    target--;
+	 spares.remove(i--);
+	 m=MOVED;
+      }
+   }
+
+   if(spares.count()<target && SiteBusy())
+   {
+      NetAccess *p=proto.get_non_const();
+      int limit=p->GetConnectionLimit();
+      if(limit>0 && limit<=p->CountConnections())
+	 return m;
+      NetAccess *s=(NetAccess*)p->Clone();
+      s->spare=true;
+      s->SetPriority(0);
+      // opening the directory makes the session connect and log in.
+      s->Chdir(p->GetCwd().path);
+      spares.append(new Spare(s,p->GetHostName()));
+      Log::global->Format(9,"---- opening spare session %d of %d to %s\n",
+	 spares.count(),target,p->GetHostName());
+      m=MOVED;
+   }
+   return m;
 }
 
 int NetAccess::Resolve(const char *defp,const char *ser,const char *pr)
@@ -530,7 +650,19 @@ do_again:
       }
 
       if(!ubuf->Eof())
+      {
+	 // parse the listing while it is being received.
+	 const char *b;
+	 int len;
+	 ubuf->Get(&b,&len);
+	 int consumed=(len>0?ParseMore(b,len):0);
+	 if(consumed>0)
+	 {
+	    ubuf->Skip(consumed);
+	    m=MOVED;
+	 }
 	 return m;
+      }
 
       // now we have all the index in ubuf; parse it.
       const char *b;
@@ -539,8 +671,8 @@ do_again:
       old_mode=mode;
       set=Parse(b,len);
 
-      // cache the list and the set.
-      FileAccess::cache->Add(session,"",old_mode,FA::OK,ubuf,set);
+      // cache the list and the set (the set lacks the entries taken early).
+      FileAccess::cache->Add(session,"",old_mode,FA::OK,ubuf,partial_taken?0:set.get());
 
 got_fileset:
       if(set)
@@ -567,6 +699,14 @@ got_fileset:
 	 else
 	    result=set.borrow();
       }
+      if(held)
+      {
+	 if(result)
+	    result->Merge(held);
+	 else
+	    result=held.borrow();
+	 held=0;
+      }
 
       ubuf=0;
       m=MOVED;
@@ -582,45 +722,81 @@ got_fileset:
 	 result->Exclude(exclude_prefix,exclude,excluded.get_non_const());
       result->rewind();
       for(file=result->curr(); file!=0; file=result->next())
-      {
-	 file->need=0;
-	 if(need_size && !file->Has(file->SIZE))
-	    file->Need(file->SIZE);
-	 if(need_time && (!file->Has(file->DATE)
-                          || (file->date.ts_prec>0 && can_get_prec_time)))
-	    file->Need(file->DATE);
-
-	 if(file->defined & file->TYPE)
-	 {
-	    if(file->filetype==file->SYMLINK && follow_symlinks)
-	    {
-	       file->filetype=file->UNKNOWN;
-	       file->defined &= ~(file->SIZE|file->SYMLINK_DEF|file->MODE|file->DATE|file->TYPE);
-	       file->Need(file->SIZE|file->DATE);
-	    }
-	    else if(file->filetype==file->SYMLINK)
-	    {
-	       // don't need these for symlinks
-	       file->NoNeed(file->SIZE|file->DATE);
-	       // but need the link target
-	       if(!file->Has(file->SYMLINK_DEF))
-		  file->Need(file->SYMLINK_DEF);
-	    }
-	    else if(file->filetype==file->DIRECTORY)
-	    {
-	       if(!get_time_for_dirs)
-		  continue;
-	       // don't need size for directories
-	       file->NoNeed(file->SIZE);
-	    }
-	 }
-      }
+	 SetNeed(file);
       session->GetInfoArray(result.get_non_const());
       session->Roll();
    }
    return m;
 }
 
+void GenericParseListInfo::SetNeed(FileInfo *file)
+{
+   file->need=0;
+   if(need_size && !file->Has(file->SIZE))
+      file->Need(file->SIZE);
+   if(need_time && (!file->Has(file->DATE)
+		    || (file->date.ts_prec>0 && can_get_prec_time)))
+      file->Need(file->DATE);
+
+   if(file->defined & file->TYPE)
+   {
+      if(file->filetype==file->SYMLINK && follow_symlinks)
+      {
+	 file->filetype=file->UNKNOWN;
+	 file->defined &= ~(file->SIZE|file->SYMLINK_DEF|file->MODE|file->DATE|file->TYPE);
+	 file->Need(file->SIZE|file->DATE);
+      }
+      else if(file->filetype==file->SYMLINK)
+      {
+	 // don't need these for symlinks
+	 file->NoNeed(file->SIZE|file->DATE);
+	 // but need the link target
+	 if(!file->Has(file->SYMLINK_DEF))
+	    file->Need(file->SYMLINK_DEF);
+      }
+      else if(file->filetype==file->DIRECTORY)
+      {
+	 if(!get_time_for_dirs)
+	    return;
+	 // don't need size for directories
+	 file->NoNeed(file->SIZE);
+      }
+   }
+}
+
+/* Returns the entries parsed while the listing is being received, which
+   need no more info. The others are kept until the listing is done. */
+FileSet *GenericParseListInfo::TakePartial()
+{
+   if(done || !ubuf || ubuf->Eof() || redir_resolution)
+      return 0;
+   Ref<FileSet> set(TakeParsed());
+   if(!set)
+      return 0;
+   partial_taken=true;
+   FileSet *ready=new FileSet;
+   set->rewind();
+   for(FileInfo *file=set->curr(); file!=0; file=set->next())
+   {
+      SetNeed(file);
+      // tilde is special, redirections have to be resolved.
+      bool later=(file->need || file->name[0]=='~'
+		  || ((file->defined & file->TYPE) && file->filetype==file->REDIRECT));
+      file=set->borrow_curr();
+      if(later)
+      {
+	 if(!held)
+	    held=new FileSet;
+	 held->Add(file);
+      }
+      else
+	 ready->Add(file);
+   }
+   if(exclude)
+      ready->Exclude(exclude_prefix,exclude,excluded.get_non_const());
+   return ready;
+}
+
 bool GenericParseListInfo::ResolveRedirect(const FileInfo *fi)
 {
    if(fi->filetype!=fi->REDIRECT || redir_count>=max_redir)
@@ -673,7 +849,8 @@ bool GenericParseListInfo::ResolveRedirect(const FileInfo *fi)
 
 GenericParseListInfo::GenericParseListInfo(FileAccess *s,const char *p)
    : ListInfo(s,p), redir_resolution(false), redir_count(0),
-     max_redir(ResMgr::Query("xfer:max-redirections",0))
+     max_redir(ResMgr::Query("xfer:max-redirections",0)),
+     partial_taken(false)
 {
    get_time_for_dirs=true;
    can_get_prec_time=true;
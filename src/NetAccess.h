@@ -28,6 +28,32 @@
 class NetAccess : public FileAccess, public Networker
 {
 protected:
+   /* Logged in idle sessions kept ready for new sessions of a site, so
+      that they can take over a connection instead of making a new one.
+      The number of spares grows when sessions have to connect anew and
+      shrinks when spares stay unused (net:spare-sessions-*). */
+   class SpareSessions : public SMTask
+   {
+      struct Spare
+      {
+	 SMTaskRef<FileAccess> session;
+	 Timer idle;
+	 Spare(FileAccess *s,const char *host)
+	    : session(s), idle("net:spare-sessions-idle",host) {}
+      };
+      xarray_p<Spare> spares;
+      SMTaskRef<NetAccess> proto;
+      int target;
+
+      bool SiteBusy();
+      int CountReady(const FileAccess *except);
+
+   public:
+      SpareSessions() : target(0) {}
+      void RampUp(const NetAccess *session);
+      int Do();
+   };
+
    class SiteData
    {
       int current_connection_limit;
@@ -35,6 +61,8 @@ protected:
       Timer connection_limit_timer;
 
    public:
+      SMTaskRef<SpareSessions> spare_sessions;
+
       SiteData(const xstring &site)
 	 : current_connection_limit(0), connection_limit(0),
 	   connection_limit_timer("net:connection-limit-timer",site) {}
@@ -102,6 +130,9 @@ protected:
    int	 connection_limit;
    bool	 connection_takeover;
 
+   bool	 spare;	  // this is a spare session, it should not take over others
+   virtual bool SpareSessionsSupported() const { return false; }
+
    Ref<RateLimit> rate_limit;
 
    int	 socket_buffer;
@@ -174,6 +205,10 @@ class GenericParseListInfo : public ListInfo
    Ref<FileSet> redir_fs;
    bool ResolveRedirect(const FileInfo *fi);
 
+   Ref<FileSet> held;	// parsed early, but need more info
+   bool partial_taken;
+   void SetNeed(FileInfo *file);
+
 protected:
    int mode;
    SMTaskRef<IOBuffer> ubuf;
@@ -183,11 +218,18 @@ protected:
 
    virtual FileSet *Parse(const char *buf,int len)
       { return session->ParseLongList(buf,len); }
+   // called with the data received so far, can parse complete lines
+   // and return the number of bytes consumed; Parse() gets the rest.
+   virtual int ParseMore(const char *buf,int len) { return 0; }
+   // the entries parsed by ParseMore which are not going to change,
+   // Parse() does not return them then.
+   virtual FileSet *TakeParsed() { return 0; }
 
 public:
    GenericParseListInfo(FileAccess *session,const char *path);
    int Do();
    const char *Status();
+   FileSet *TakePartial();
 };
 
 #endif//NETACCESS_H
@@ -25,6 +25,7 @@
 #include "FileGlob.h"
 #include "misc.h"
 #include "LsCache.h"
+#include "Checksum.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -38,6 +39,9 @@ bool SFtp::GetBetterConnection(int level,bool limit_reached)
 {
    bool need_sleep=false;
 
+   if(spare)
+      return need_sleep; // spare sessions are there to be taken over
+
    for(FA *fo=FirstSameSite(); fo!=0; fo=NextSameSite(fo))
    {
       SFtp *o=(SFtp*)fo; // we are sure it is SFtp.
@@ -142,6 +146,9 @@ int SFtp::Do()
       if(!ReconnectAllowed())
 	 return m;
 
+      if(WaitSharedConnection())
+	 return m;
+
       if(!NextTry())
 	 return MOVED;
 
@@ -159,6 +166,7 @@ int SFtp::Do()
       }
       else
 	 init=xstring::cat("echo SFTP: >&2;",init,NULL);
+      AddSharedConnectionOptions(args);
       if(user)
       {
 	 args.Add("-l");
@@ -218,11 +226,13 @@ int SFtp::Do()
 	 return m;
       if(home_auto==0)
 	 SendRequest(new Request_REALPATH("."),Expect::HOME_PATH);
+      if(extensions&EXT_LIMITS)
+	 SendRequest(new Request_LIMITS(),Expect::LIMITS);
       state=CONNECTED;
       m=MOVED;
 
    case CONNECTED:
-      if(home.path==0 && !RespQueueIsEmpty())
+      if((home.path==0 || HasExpect(Expect::LIMITS)) && !RespQueueIsEmpty())
 	 return m;
 
       if(mode==CLOSED)
@@ -254,9 +264,9 @@ int SFtp::Do()
       file_buf->Get(&b,&s);
       if(s==0 && !eof)
 	 return m;
-      if(s<size_write && !eof && !flush_timer.Stopped())
+      if(s<WriteSize() && !eof && !flush_timer.Stopped())
 	 return m;   // wait for more data before sending.
-      if(RespQueueSize()>max_packets_in_flight)
+      if(RespQueueSize()>packets_in_flight)
 	 return m;
       if(s==0)
       {
@@ -266,16 +276,19 @@ int SFtp::Do()
 	    req->attrs.mtime=entity_date;
 	    req->attrs.flags|=SSH_FILEXFER_ATTR_MODIFYTIME;
 	 }
-	 req->attrs.size=pos;
-	 req->attrs.flags|=SSH_FILEXFER_ATTR_SIZE;
+	 // a part of a parallel upload must not cut the file.
+	 if(entity_size<0 || pos>=entity_size) {
+	    req->attrs.size=pos;
+	    req->attrs.flags|=SSH_FILEXFER_ATTR_SIZE;
+	 }
 	 SendRequest(req,Expect::IGNORE);
 	 CloseHandle(Expect::DEFAULT);
 	 state=WAITING;
 	 m=MOVED;
 	 break;
       }
-      if(s>size_write)
-	 s=size_write;
+      if(s>WriteSize())
+	 s=WriteSize();
       SendRequest(new Request_WRITE(handle,request_pos,b,s),Expect::WRITE_STATUS);
       file_buf->Skip(s);
       request_pos+=s;
@@ -285,6 +298,10 @@ int SFtp::Do()
    case WAITING:
       if(mode==ARRAY_INFO)
 	 SendArrayInfoRequests();
+      else if(mode==BATCH && batch_mode==LONG_LIST)
+	 SendBatchListRequests();
+      else if(mode==BATCH)
+	 SendBatchRequests();
       break;
    case DONE:
       break;
@@ -302,6 +319,13 @@ void SFtp::MoveConnectionHere(SFtp *o)
    expect_queue.move_here(o->expect_queue);
    timeout_timer.Reset(o->timeout_timer);
    ssh_id=o->ssh_id;
+   packets_in_flight=o->packets_in_flight;
+   min_rtt=o->min_rtt;
+   extensions=o->extensions;
+   check_file_algos.move_here(o->check_file_algos);
+   server_max_read=o->server_max_read;
+   server_max_write=o->server_max_write;
+   server_max_handles=o->server_max_handles;
    state=CONNECTED;
    o->Disconnect();
    if(!home)
@@ -315,6 +339,7 @@ void SFtp::DisconnectLL()
    handle.set(0);
    file_buf=0;
    EmptyRespQueue();
+   batch_dirs.truncate();
    state=DISCONNECTED;
    if(mode==STORE)
       SetError(STORE_FAILED);
@@ -322,10 +347,18 @@ void SFtp::DisconnectLL()
    send_translate=0;
    recv_translate=0;
    ssh_id=0;
+   packets_in_flight=max_packets_in_flight;
+   min_rtt=0;
+   extensions=0;
+   check_file_algos.set(0);
+   server_max_read=server_max_write=server_max_handles=0;
+   copy_handle.set(0);
    home_auto.set(FindHomeAuto());
    // may have to resend file info queries.
    if(fileset_for_info)
       fileset_for_info->rewind();
+   if(fileset_for_batch)
+      fileset_for_batch->rewind();
 }
 
 void SFtp::Init()
@@ -343,6 +376,14 @@ void SFtp::Init()
    size_read=0x8000;
    size_write=0x8000;
    use_full_path=false;
+   auto_window=false;
+   window_max=0;
+   packets_in_flight=max_packets_in_flight;
+   min_rtt=0;
+   window_sample_bytes=0;
+   extensions=0;
+   server_max_read=server_max_write=0;
+   space_check_size=0;
    flush_timer.Set(0,500);
 }
 
@@ -469,6 +510,9 @@ SFtp::unpack_status_t SFtp::UnpackPacket(Buffer *b,SFtp::Packet **p)
    case SSH_FXP_DATA:
       pp=new Reply_DATA();
       break;
+   case SSH_FXP_EXTENDED_REPLY:
+      pp=new Reply_EXTENDED();
+      break;
    case SSH_FXP_INIT:
    case SSH_FXP_OPEN:
    case SSH_FXP_CLOSE:
@@ -494,9 +538,6 @@ SFtp::unpack_status_t SFtp::UnpackPacket(Buffer *b,SFtp::Packet **p)
    case SSH_FXP_EXTENDED:
       LogError(0,"request in reply??");
       return UNPACK_WRONG_FORMAT;
-   case SSH_FXP_EXTENDED_REPLY:
-      LogError(0,"unexpected SSH_FXP_EXTENDED_REPLY");
-      return UNPACK_WRONG_FORMAT;
    }
    res=pp->Unpack(b);
    if(res!=UNPACK_SUCCESS)
@@ -559,6 +600,7 @@ const char *SFtp::WirePath(const char *path)
 void SFtp::SendRequest()
 {
    max_packets_in_flight_slow_start=1;
+   StartWindowSample();
    ExpandTildeInCWD();
    switch((open_mode)mode)
    {
@@ -579,16 +621,37 @@ void SFtp::SendRequest()
       state=WAITING;
       break;
    case STORE:
-      SendRequest(
-	 new Request_OPEN(WirePath(file),
-	    SSH_FXF_WRITE|SSH_FXF_CREAT|(pos==0?SSH_FXF_TRUNC:0),
-	    ACE4_WRITE_DATA|ACE4_WRITE_ATTRIBUTES,
-	    pos==0?SSH_FXF_CREATE_TRUNCATE:SSH_FXF_OPEN_OR_CREATE,
-	    protocol_version),
-	 Expect::HANDLE);
+      // check free space before a big upload, the file is not truncated
+      // until the reply comes.
+      if((extensions&EXT_STATVFS) && space_check_size>0
+      && entity_size>=0 && entity_size-pos>=space_check_size)
+      {
+	 xstring_c dir(dirname(file));
+	 SendRequest(new Request_STATVFS(WirePath(dir)),Expect::STATVFS);
+      }
+      else
+	 SendOpenForStore();
+      state=WAITING;
+      break;
+   case COPY:
+      if(!(extensions&EXT_COPY_DATA))
+      {
+	 SetError(NOT_SUPP,_("server does not support copy-data"));
+	 break;
+      }
+      if(!strcmp(xstring(dir_file(cwd,file)),dir_file(cwd,file1)))
+      {
+	 // opening the target would truncate the source.
+	 SetError(NO_FILE,_("source and target are the same file"));
+	 break;
+      }
+      // the target is opened (and truncated) when the source is open.
+      SendRequest(new Request_OPEN(WirePath(file),SSH_FXF_READ,
+	 ACE4_READ_DATA|ACE4_READ_ATTRIBUTES,SSH_FXF_OPEN_EXISTING,protocol_version),Expect::HANDLE,0);
       state=WAITING;
       break;
    case ARRAY_INFO:
+   case BATCH:
       state=WAITING;
       break;
    case RENAME:
@@ -656,6 +719,7 @@ void SFtp::SendRequest()
       break;
    case QUOTE_CMD:
    case MP_LIST:
+   case BLOCK_SUMS:
       SetError(NOT_SUPP);
       break;
    case CONNECT_VERIFY:
@@ -664,6 +728,17 @@ void SFtp::SendRequest()
    }
 }
 
+void SFtp::SendOpenForStore()
+{
+   SendRequest(
+      new Request_OPEN(WirePath(file),
+	 SSH_FXF_WRITE|SSH_FXF_CREAT|(pos==0?SSH_FXF_TRUNC:0),
+	 ACE4_WRITE_DATA|ACE4_WRITE_ATTRIBUTES,
+	 pos==0?SSH_FXF_CREATE_TRUNCATE:SSH_FXF_OPEN_OR_CREATE,
+	 protocol_version),
+      Expect::HANDLE);
+}
+
 void SFtp::SendArrayInfoRequests()
 {
    for(FileInfo *fi=fileset_for_info->curr();
@@ -682,11 +757,292 @@ void SFtp::SendArrayInfoRequests()
       if(fi->need&fi->SYMLINK_DEF && protocol_version>=3)
 	 SendRequest(new Request_READLINK(WirePath(fi->name)),
 	    Expect::INFO_READLINK,fileset_for_info->curr_index());
+      if(fi->need&fi->CHECKSUM)
+	 SendChecksumRequest(fi);
    }
    if(RespQueueIsEmpty())
       state=DONE;
 }
 
+void SFtp::SendBatchRequests()
+{
+   for(FileInfo *fi=fileset_for_batch->curr();
+      fi && RespQueueSize()<max_packets_in_flight;
+      fi=fileset_for_batch->next())
+   {
+      int i=fileset_for_batch->curr_index();
+      if(GetBatchResult(i)!=IN_PROGRESS)
+	 continue;   // got the reply before reconnect
+      Packet *req=0;
+      switch(batch_mode)
+      {
+      case REMOVE:
+	 req=new Request_REMOVE(WirePath(fi->name));
+	 break;
+      case REMOVE_DIR:
+	 req=new Request_RMDIR(WirePath(fi->name));
+	 break;
+      case MAKE_DIR:
+	 req=new Request_MKDIR(WirePath(fi->name),protocol_version);
+	 break;
+      case CHANGE_MODE:
+      {
+	 Request_SETSTAT *setstat=new Request_SETSTAT(WirePath(fi->name),protocol_version);
+	 setstat->attrs.permissions=fi->mode;
+	 setstat->attrs.flags|=SSH_FILEXFER_ATTR_PERMISSIONS;
+	 req=setstat;
+	 break;
+      }
+      default:
+	 abort();
+      }
+      SendRequest(req,Expect::BATCH,i);
+   }
+   if(RespQueueIsEmpty())
+      state=DONE;
+}
+
+bool SFtp::BatchSupported(open_mode m) const
+{
+   return m==REMOVE || m==REMOVE_DIR || m==MAKE_DIR || m==CHANGE_MODE
+      || m==LONG_LIST;
+}
+
+int SFtp::BatchDirsMax() const
+{
+   // leave some handles for other requests.
+   if(server_max_handles>0 && server_max_handles/2<BATCH_DIRS_MAX)
+      return server_max_handles/2>1?server_max_handles/2:1;
+   return BATCH_DIRS_MAX;
+}
+
+int SFtp::FindBatchDir(int i) const
+{
+   for(int j=0; j<batch_dirs.count(); j++)
+      if(batch_dirs[j]->i==i)
+	 return j;
+   return -1;
+}
+
+void SFtp::SendBatchListRequests()
+{
+   for(FileInfo *fi=fileset_for_batch->curr();
+      fi && batch_dirs.count()<BatchDirsMax()
+      && RespQueueSize()<max_packets_in_flight;
+      fi=fileset_for_batch->next())
+   {
+      int i=fileset_for_batch->curr_index();
+      if(GetBatchResult(i)!=IN_PROGRESS)
+	 continue;   // got the listing before reconnect
+      batch_dirs.append(new BatchDir(i));
+      SendRequest(new Request_OPENDIR(WirePath(fi->name)),Expect::BATCH,i);
+   }
+   if(RespQueueIsEmpty() && batch_dirs.count()==0)
+      state=DONE;
+}
+
+void SFtp::HandleBatchList(Expect *e)
+{
+   int d_i=FindBatchDir(e->i);
+   if(d_i==-1)
+      return;
+   BatchDir *d=batch_dirs[d_i];
+   const char *dir=(*fileset_for_batch)[e->i]->name;
+   Packet *reply=e->reply.get_non_const();
+   if(e->request->TypeIs(SSH_FXP_OPENDIR))
+   {
+      if(!reply->TypeIs(SSH_FXP_HANDLE))
+      {
+	 SetBatchResult(e->i,NO_FILE,ReplyErrorText(reply));
+	 batch_dirs.remove(d_i);
+	 return;
+      }
+      d->handle.set(((Reply_HANDLE*)reply)->GetHandle());
+      // two READDIR requests keep the directory stream going.
+      for(int k=0; k<2; k++)
+	 SendRequest(new Request_READDIR(d->handle),Expect::BATCH,e->i);
+      d->pending+=2;
+      return;
+   }
+   d->pending--;
+   if(e->request->TypeIs(SSH_FXP_READLINK))
+   {
+      if(reply->TypeIs(SSH_FXP_NAME) && ((Reply_NAME*)reply)->GetCount()>0)
+      {
+	 const char *path=e->request.Cast<Request_READLINK>()->GetPath();
+	 FileInfo *fi=d->set->FindByName(utf8_to_lc(basename_ptr(path)));
+	 if(fi)
+	    fi->SetSymlink(utf8_to_lc(((Reply_NAME*)reply)->GetNameAttrs(0)->name));
+      }
+   }
+   else if(reply->TypeIs(SSH_FXP_NAME))
+   {
+      Reply_NAME *r=(Reply_NAME*)reply;
+      for(int j=0; j<r->GetCount(); j++)
+      {
+	 FileInfo *info=MakeFileInfo(r->GetNameAttrs(j));
+	 if(!info)
+	    continue;
+	 if(!info->longname)
+	    info->MakeLongName();
+	 d->list.append(info->longname);
+	 d->list.append('\n');
+	 if(info->TypeIs(info->SYMLINK) && !info->Has(info->SYMLINK_DEF)
+	 && protocol_version>=3)
+	 {
+	    // ListInfo would ask for the target after the listing.
+	    xstring_c path(dir_file(dir,info->name));
+	    SendRequest(new Request_READLINK(WirePath(path)),Expect::BATCH,e->i);
+	    d->pending++;
+	 }
+	 d->set->Add(info);
+      }
+      if(r->Eof())
+	 d->eof=true;
+      else if(!d->eof)
+      {
+	 SendRequest(new Request_READDIR(d->handle),Expect::BATCH,e->i);
+	 d->pending++;
+      }
+   }
+   else
+   {
+      // any status ends the directory, no more READDIR on a failed handle.
+      d->eof=true;
+      if(!(reply->TypeIs(SSH_FXP_STATUS)
+	   && ((Reply_STATUS*)reply)->GetCode()==SSH_FX_EOF)
+      && GetBatchResult(e->i)==IN_PROGRESS)
+	 SetBatchResult(e->i,NO_FILE,ReplyErrorText(reply));
+   }
+
+   if(d->pending>0)
+      return;
+   SendRequest(new Request_CLOSE(d->handle),Expect::IGNORE);
+   if(GetBatchResult(e->i)==IN_PROGRESS)
+   {
+      Path path(&cwd);
+      path.ExpandTilde(home);
+      path.Change(dir);
+      SMTaskRef<FileAccess> loc(Clone());
+      loc->SetCwd(path);
+      cache->Add(loc,"",LONG_LIST,OK,d->list,d->list.length(),d->set);
+      SetBatchResult(e->i,OK);
+   }
+   batch_dirs.remove(d_i);
+}
+
+void SFtp::CloseBatchDirs()
+{
+   for(int j=0; j<batch_dirs.count(); j++)
+      if(batch_dirs[j]->handle)
+	 SendRequest(new Request_CLOSE(batch_dirs[j]->handle),Expect::IGNORE);
+   batch_dirs.truncate();
+}
+
+// hash algorithm names of check-file extension.
+static const char *const check_file_algo_map[][2]={
+   {"MD5","md5"},
+   {"SHA-1","sha1"},
+   {"SHA-256","sha256"},
+   {"CRC32","crc32"},
+   {0,0}
+};
+
+/* Returns the list of check-file algorithms in the order of preference,
+   restricted to the ones announced by the server if it did. */
+const char *SFtp::CheckFileAlgos() const
+{
+   xstring& list=xstring::get_tmp("");
+   const char *pref=ChecksumAlgoList();
+   while(*pref)
+   {
+      pref+=strspn(pref,",; ");
+      int len=strcspn(pref,",;");
+      for(int i=0; check_file_algo_map[i][0]; i++)
+      {
+	 const char *name=check_file_algo_map[i][1];
+	 if(strncasecmp(pref,check_file_algo_map[i][0],len)
+	 || check_file_algo_map[i][0][len]!=0)
+	    continue;
+	 if(check_file_algos && !Checksum::Choose(name,check_file_algos))
+	    continue;
+	 if(list.length()>0)
+	    list.append(',');
+	 list.append(name);
+      }
+      pref+=len;
+   }
+   return list.length()>0?list.get():0;
+}
+
+void SFtp::SendChecksumRequest(FileInfo *fi)
+{
+   int i=fileset_for_info->curr_index();
+   xstring_c algos(extensions&EXT_CHECK_FILE?CheckFileAlgos():0);
+   if(algos)
+      SendRequest(new Request_CHECK_FILE(WirePath(fi->name),algos),Expect::CHECKSUM,i);
+   else if((extensions&EXT_MD5_HASH) && ChooseChecksumAlgo("MD5"))
+      SendRequest(new Request_MD5_HASH(WirePath(fi->name)),Expect::CHECKSUM,i);
+   else
+      fi->NoNeed(fi->CHECKSUM);
+}
+
+bool SFtp::ChecksumSupported() const
+{
+   // not known until VERSION reply.
+   if(protocol_version==0)
+      return true;
+   return (extensions&(EXT_CHECK_FILE|EXT_MD5_HASH))!=0;
+}
+
+void SFtp::SetExtensions(const Reply_VERSION *v)
+{
+   static const struct {
+      const char *name;
+      unsigned flag;
+   } known[]={
+      {"limits@openssh.com", EXT_LIMITS},
+      {"statvfs@openssh.com",EXT_STATVFS},
+      {"check-file",	     EXT_CHECK_FILE},
+      {"check-file-name",    EXT_CHECK_FILE},
+      {"md5-hash",	     EXT_MD5_HASH},
+      {"copy-data",	     EXT_COPY_DATA},
+      {0,0}
+   };
+   extensions=0;
+   check_file_algos.set(0);
+   for(int i=0; i<v->GetExtensionCount(); i++)
+   {
+      const char *name=v->GetExtensionName(i);
+      const char *data=v->GetExtensionData(i);
+      LogNote(9,"server extension %s (%s)",name,data);
+      for(int j=0; known[j].name; j++)
+	 if(!strcmp(name,known[j].name))
+	    extensions|=known[j].flag;
+      // the data of check-file is the list of supported algorithms.
+      if(!strcmp(name,"check-file") && data[0])
+	 check_file_algos.set(data);
+   }
+}
+
+int SFtp::BlockSize(int size,long long server_max) const
+{
+   if(server_max<=0)
+      return size;
+   // with the auto window the largest block the server accepts is used.
+   if(auto_window && size<server_max)
+   {
+      long long cap=window_max/max_packets_in_flight;
+      if(cap>size)
+	 size=(cap<server_max?cap:server_max);
+   }
+   if(size>server_max)
+      size=server_max;
+   if(size<16)
+      size=16;
+   return size;
+}
+
 void SFtp::CloseHandle(Expect::expect_t c)
 {
    if(handle)
@@ -714,10 +1070,19 @@ void SFtp::Close()
    }
    CloseExpectQueue();
    state=(recv_buf?CONNECTED:DISCONNECTED);
+   if(recv_buf)
+      CloseBatchDirs();
+   else
+      batch_dirs.truncate();
    eof=false;
    file_buf=0;
    file_set=0;
    CloseHandle(Expect::IGNORE);
+   if(copy_handle)
+   {
+      SendRequest(new Request_CLOSE(copy_handle),Expect::IGNORE);
+      copy_handle.set(0);
+   }
    super::Close();
    // don't need these out-of-order packets anymore
    ooo_chain.truncate();
@@ -777,6 +1142,7 @@ void SFtp::HandleExpect(Expect *e)
       {
 	 protocol_version=((Reply_VERSION*)reply)->GetVersion();
 	 LogNote(9,"protocol version set to %d",protocol_version);
+	 SetExtensions((Reply_VERSION*)reply);
 	 const char *charset=0;
 	 if(protocol_version>=4)
 	    charset="UTF-8";
@@ -835,6 +1201,25 @@ void SFtp::HandleExpect(Expect *e)
 	 SetError(NO_FILE,reply);
       break;
    case Expect::HANDLE:
+      if(mode==COPY)
+      {
+	 if(!reply->TypeIs(SSH_FXP_HANDLE))
+	 {
+	    SetError(NO_FILE,reply);
+	    break;
+	 }
+	 // e->i is 0 for the source and 1 for the target.
+	 if(e->i==0)
+	 {
+	    handle.set(((Reply_HANDLE*)reply)->GetHandle());
+	    SendRequest(new Request_OPEN(WirePath(file1),SSH_FXF_WRITE|SSH_FXF_CREAT|SSH_FXF_TRUNC,
+	       ACE4_WRITE_DATA|ACE4_WRITE_ATTRIBUTES,SSH_FXF_CREATE_TRUNCATE,protocol_version),Expect::HANDLE,1);
+	    break;
+	 }
+	 copy_handle.set(((Reply_HANDLE*)reply)->GetHandle());
+	 SendRequest(new Request_COPY_DATA(handle,copy_handle),Expect::COPY);
+	 break;
+      }
       if(reply->TypeIs(SSH_FXP_HANDLE))
       {
 	 handle.set(((Reply_HANDLE*)reply)->GetHandle());
@@ -864,7 +1249,7 @@ void SFtp::HandleExpect(Expect *e)
       }
       break;
    case Expect::DATA:
-      if(max_packets_in_flight_slow_start<max_packets_in_flight)
+      if(max_packets_in_flight_slow_start<packets_in_flight)
 	 max_packets_in_flight_slow_start++;
       if(reply->TypeIs(SSH_FXP_DATA))
       {
@@ -875,6 +1260,7 @@ void SFtp::HandleExpect(Expect *e)
 	    const char *b; int s;
 	    d->GetData(&b,&s);
 	    LogNote(9,"data packet: pos=%lld, size=%d",(long long)r->pos,s);
+	    TuneWindow(e,s);
 	    file_buf->Put(b,s);
 	    if(d->Eof() || eof)
 	       goto eof;
@@ -892,12 +1278,13 @@ void SFtp::HandleExpect(Expect *e)
 	 {
 	    LogNote(9,"put a packet with id=%d on out-of-order chain (need_pos=%lld packet_pos=%lld)",
 	       reply->GetID(),(long long)(pos+file_buf->Size()),(long long)r->pos);
-	    if(ooo_chain.count()>=64)
+	    if(ooo_chain.count()>=64 && ooo_chain.count()>=packets_in_flight)
 	    {
 	       LogError(0,"Too many out-of-order packets");
 	       Disconnect();
 	       return;
 	    }
+	    d->Detach();
 	    ooo_chain.append(e);
 	    return;
 	 }
@@ -1002,6 +1389,7 @@ void SFtp::HandleExpect(Expect *e)
       if(reply->TypeIs(SSH_FXP_STATUS))
       {
 	 if(((Reply_STATUS*)reply)->GetCode()==SSH_FX_OK) {
+	    TuneWindow(e,e->request.Cast<Request_WRITE>()->data.length());
 	    TrySuccess();
 	    break;
 	 }
@@ -1019,17 +1407,181 @@ void SFtp::HandleExpect(Expect *e)
       }
       SetError(NO_FILE,reply);
       break;
+   case Expect::BATCH:
+      if(batch_mode==LONG_LIST)
+      {
+	 HandleBatchList(e);
+	 break;
+      }
+      if(reply->TypeIs(SSH_FXP_STATUS)
+      && ((Reply_STATUS*)reply)->GetCode()==SSH_FX_OK)
+	 SetBatchResult(e->i,OK);
+      else
+	 SetBatchResult(e->i,NO_FILE,ReplyErrorText(reply));
+      break;
+   case Expect::LIMITS:
+      if(reply->TypeIs(SSH_FXP_EXTENDED_REPLY))
+      {
+	 const Buffer *d=((Reply_EXTENDED*)reply)->GetData();
+	 if(d->Size()<32)
+	    break;
+	 // max-packet-length, max-read-length, max-write-length, max-open-handles
+	 server_max_read=d->UnpackUINT64BE(8);
+	 server_max_write=d->UnpackUINT64BE(16);
+	 server_max_handles=d->UnpackUINT64BE(24);
+	 LogNote(9,"server limits: read=%lld write=%lld handles=%lld",
+	    server_max_read,server_max_write,server_max_handles);
+	 if(server_max_read>0x7fffffff)
+	    server_max_read=0x7fffffff;
+	 if(server_max_write>0x7fffffff)
+	    server_max_write=0x7fffffff;
+      }
+      break;
+   case Expect::STATVFS:
+      if(reply->TypeIs(SSH_FXP_EXTENDED_REPLY))
+      {
+	 const Buffer *d=((Reply_EXTENDED*)reply)->GetData();
+	 if(d->Size()>=88)
+	 {
+	    // f_bsize, f_frsize, f_blocks, f_bfree, f_bavail, ...
+	    unsigned long long frsize=d->UnpackUINT64BE(8);
+	    unsigned long long bavail=d->UnpackUINT64BE(32);
+	    unsigned long long avail=frsize*bavail;
+	    LogNote(9,"free space on the server: %llu bytes",avail);
+	    if(frsize>0 && avail<(unsigned long long)(entity_size-pos))
+	    {
+	       SetError(NO_FILE,_("not enough free space on the server"));
+	       break;
+	    }
+	 }
+      }
+      // go on with the upload if the space could not be checked.
+      SendOpenForStore();
+      break;
+   case Expect::CHECKSUM:
+      if(mode==ARRAY_INFO)
+      {
+	 FileInfo *fi=(*fileset_for_info)[e->i];
+	 fi->NoNeed(fi->CHECKSUM);
+	 if(!reply->TypeIs(SSH_FXP_EXTENDED_REPLY))
+	    break;
+	 const Buffer *d=((Reply_EXTENDED*)reply)->GetData();
+	 int offset=0;
+	 xstring algo("md5"),hash;
+	 if(e->request.Cast<Request_EXTENDED>()->NameIs("md5-hash"))
+	 {
+	    // "md5-hash" and the hash.
+	    if(Packet::UnpackString(d,&offset,d->Size(),&hash)!=UNPACK_SUCCESS)
+	       break;
+	    if(hash.eq("md5-hash")
+	    && Packet::UnpackString(d,&offset,d->Size(),&hash)!=UNPACK_SUCCESS)
+	       break;
+	 }
+	 else
+	 {
+	    // "check-file", the algorithm used and the hash, up to the end
+	    // of the reply.
+	    if(Packet::UnpackString(d,&offset,d->Size(),&algo)!=UNPACK_SUCCESS)
+	       break;
+	    if(algo.eq("check-file")
+	    && Packet::UnpackString(d,&offset,d->Size(),&algo)!=UNPACK_SUCCESS)
+	       break;
+	    hash.nset(d->Get()+offset,d->Size()-offset);
+	 }
+	 if(hash.length()==0)
+	    break;
+	 for(int i=0; check_file_algo_map[i][0]; i++)
+	 {
+	    if(strcasecmp(algo,check_file_algo_map[i][1]))
+	       continue;
+	    xstring hex;
+	    hash.hexdump_to(hex);
+	    hex.c_lc();
+	    LogNote(9,"file info: %s %s=%s",fi->name.get(),check_file_algo_map[i][0],hex.get());
+	    fi->SetChecksum(check_file_algo_map[i][0],hex);
+	    break;
+	 }
+      }
+      break;
+   case Expect::COPY:
+      CloseHandle(Expect::IGNORE);
+      SendRequest(new Request_CLOSE(copy_handle),Expect::IGNORE);
+      copy_handle.set(0);
+      if(reply->TypeIs(SSH_FXP_STATUS)
+      && ((Reply_STATUS*)reply)->GetCode()==SSH_FX_OK)
+	 state=DONE;
+      else
+	 SetError(NO_FILE,reply);
+      break;
    case Expect::IGNORE:
       break;
    }
    delete e;
 }
 
+void SFtp::StartWindowSample()
+{
+   window_sample_start=now;
+   window_sample_bytes=0;
+   last_data_time=now;
+}
+
+/* The request window is doubled while the throughput times the round trip
+   time (bandwidth-delay product) fills at least half of it, and halved when
+   it is much larger than needed or when the replies stall. */
+void SFtp::TuneWindow(const Expect *e,int bytes)
+{
+   if(!auto_window)
+      return;
+
+   double rtt=now-e->sent;
+   if(rtt>0 && (min_rtt==0 || rtt<min_rtt))
+      min_rtt=rtt;
+
+   int block=(mode==STORE?WriteSize():ReadSize());
+   int lo=max_packets_in_flight;
+   int hi=window_max/block;
+   if(hi<lo)
+      hi=lo;
+   int old=packets_in_flight;
+
+   double gap=now-last_data_time;
+   last_data_time=now;
+   if(min_rtt>0 && gap>1 && gap>8*min_rtt)
+   {
+      packets_in_flight=(old/2>lo?old/2:lo);
+      if(packets_in_flight!=old)
+	 LogNote(9,"replies stalled for %.1fs, request window decreased to %d",
+	    gap,packets_in_flight);
+      StartWindowSample();
+      return;
+   }
+
+   window_sample_bytes+=bytes;
+   double elapsed=now-window_sample_start;
+   if(min_rtt==0 || elapsed<2*min_rtt || elapsed<0.1)
+      return;
+
+   double rate=window_sample_bytes/elapsed;
+   double bdp=rate*min_rtt;
+   double window=double(old)*block;
+   if(bdp*2>window)
+      packets_in_flight=(old*2<hi?old*2:hi);
+   else if(bdp*8<window)
+      packets_in_flight=(old/2>lo?old/2:lo);
+   if(packets_in_flight!=old)
+      LogNote(9,"rtt=%.3fs rate=%lld B/s, request window changed to %d",
+	 min_rtt,(long long)rate,packets_in_flight);
+   StartWindowSample();
+}
+
 void SFtp::RequestMoreData()
 {
    Enter(this);
    if(mode==RETRIEVE) {
-      int req_len=size_read;
+      int req_len=ReadSize();
+      if(limit!=FILE_END && limit-request_pos<req_len)
+	 req_len=limit-request_pos;
       SendRequest(new Request_READ(handle,request_pos,req_len),Expect::DATA);
       request_pos+=req_len;
    } else if(mode==LIST || mode==LONG_LIST) {
@@ -1100,15 +1652,26 @@ int SFtp::HandleReplies()
       return MOVED;
    }
 
-   reply->DropData(recv_buf.get_non_const());
    Expect *e=FindExpectExclusive(reply);
    if(e==0)
    {
       LogError(3,_("extra server response"));
+      reply->DropData(recv_buf.get_non_const());
       delete reply;
       return MOVED;
    }
+   if(!reply->TypeIs(SSH_FXP_DATA))
+   {
+      reply->DropData(recv_buf.get_non_const());
+      HandleExpect(e);
+      return MOVED;
+   }
+   // the data are put to file_buf right from recv_buf,
+   // the packet is dropped after that.
+   int size=4+reply->GetLength();
    HandleExpect(e);
+   if(recv_buf)
+      recv_buf->Skip(size);
    return MOVED;
 }
 void SFtp::PushExpect(Expect *e)
@@ -1140,6 +1703,18 @@ void SFtp::CloseExpectQueue()
       case Expect::DEFAULT:
       case Expect::DATA:
       case Expect::WRITE_STATUS:
+      case Expect::STATVFS:
+      case Expect::CHECKSUM:
+	 e->tag=Expect::IGNORE;
+	 break;
+      case Expect::BATCH:
+	 // a directory handle of LONG_LIST batch has to be closed.
+	 e->tag=(e->request->TypeIs(SSH_FXP_OPENDIR)?Expect::HANDLE_STALE:Expect::IGNORE);
+	 break;
+      case Expect::LIMITS:
+	 break;
+      case Expect::COPY:
+	 // the handles are closed by Close().
 	 e->tag=Expect::IGNORE;
 	 break;
       case Expect::HANDLE:
@@ -1191,8 +1766,9 @@ int SFtp::Read(Buffer *buf,int size)
    if(state==FILE_RECV)
    {
       // keep some packets in flight.
-      int limit=(entity_size>=0?max_packets_in_flight:max_packets_in_flight_slow_start);
-      if(RespQueueSize()<limit && !file_buf->Eof())
+      int in_flight=(entity_size>=0?packets_in_flight:max_packets_in_flight_slow_start);
+      if(RespQueueSize()<in_flight && !file_buf->Eof()
+      && (limit==FILE_END || request_pos<limit))   // pget chunk end
       {
 	 // but don't request much after possible EOF.
 	 if(entity_size<0 || request_pos<entity_size || RespQueueSize()<2)
@@ -1266,7 +1842,7 @@ int SFtp::Buffered()
 {
    if(file_buf==0)
       return 0;
-   off_t b=file_buf->Size()+send_buf->Size()*size_write/(size_write+20);
+   off_t b=file_buf->Size()+send_buf->Size()*WriteSize()/(WriteSize()+20);
    if(b<0)
       b=0;
    else if(b>real_pos)
@@ -1383,6 +1959,10 @@ void SFtp::Reconfig(const char *name)
       max_packets_in_flight=1;
    if(max_packets_in_flight_slow_start>max_packets_in_flight)
       max_packets_in_flight_slow_start=max_packets_in_flight;
+   auto_window=QueryBool("auto-window",c);
+   window_max=Query("max-window",c);
+   if(!auto_window || packets_in_flight<max_packets_in_flight)
+      packets_in_flight=max_packets_in_flight;
    size_read=Query("size-read",c);
    size_write=Query("size-write",c);
    if(size_read<16)
@@ -1390,6 +1970,7 @@ void SFtp::Reconfig(const char *name)
    if(size_write<16)
       size_write=16;
    use_full_path=QueryBool("use-full-path",c);
+   space_check_size=Query("space-check-size",c).to_unumber(LLONG_MAX);
    if(!xstrcmp(name,"sftp:charset") && protocol_version && protocol_version<4)
    {
       if(!IsSuspended())
@@ -1507,27 +2088,23 @@ const char *SFtp::Reply_STATUS::GetCodeText()
    return 0;
 }
 
-void SFtp::SetError(int code,const Packet *reply)
+const char *SFtp::ReplyErrorText(const Packet *reply)
 {
    if(!reply->TypeIs(SSH_FXP_STATUS))
-   {
-      SetError(code);
-      return;
-   }
+      return 0;
    Reply_STATUS *status=(Reply_STATUS*)reply;
    const char *message=status->GetMessage();
    if(message && *message)
-   {
-      SetError(code,utf8_to_lc(message));
-      return;
-   }
+      return utf8_to_lc(message);
    message=status->GetCodeText();
    if(message)
-   {
-      SetError(code,_(message));
-      return;
-   }
-   SetError(code);
+      return _(message);
+   return 0;
+}
+
+void SFtp::SetError(int code,const Packet *reply)
+{
+   SetError(code,ReplyErrorText(reply));
 }
 
 
@@ -1580,15 +2157,50 @@ SFtp::unpack_status_t SFtp::Reply_NAME::Unpack(const Buffer *b)
 }
 SFtp::unpack_status_t SFtp::Reply_DATA::Unpack(const Buffer *b)
 {
-   unpack_status_t res=PacketSTRING::Unpack(b);
+   unpack_status_t res=Packet::Unpack(b);
    if(res!=UNPACK_SUCCESS)
       return res;
    int *offset=&unpacked;
    int limit=length+4;
+   UNPACK32(data_len);
+   if(data_len<0 || data_len>limit-*offset)
+   {
+      LogError(2,"bad data in reply (invalid length field)");
+      return UNPACK_WRONG_FORMAT;
+   }
+   data=b->Get()+*offset;
+   *offset+=data_len;
    if(*offset<limit)
       UNPACK8(eof);
    return UNPACK_SUCCESS;
 }
+SFtp::unpack_status_t SFtp::Reply_VERSION::Unpack(const Buffer *b)
+{
+   unpack_status_t res=PacketUINT32::Unpack(b);
+   if(res!=UNPACK_SUCCESS)
+      return res;
+   int limit=length+4;
+   while(unpacked<limit)
+   {
+      xstring name,data;
+      if(UnpackString(b,&unpacked,limit,&name)!=UNPACK_SUCCESS
+      || UnpackString(b,&unpacked,limit,&data)!=UNPACK_SUCCESS)
+	 break;	  // ignore broken extension data
+      extension_name.Append(name);
+      extension_data.Append(data);
+   }
+   return UNPACK_SUCCESS;
+}
+SFtp::unpack_status_t SFtp::Reply_EXTENDED::Unpack(const Buffer *b)
+{
+   unpack_status_t res=Packet::Unpack(b);
+   if(res!=UNPACK_SUCCESS)
+      return res;
+   // the format depends on the request, keep the raw data.
+   data.Put(b->Get()+unpacked,length+4-unpacked);
+   unpacked=length+4;
+   return UNPACK_SUCCESS;
+}
 SFtp::unpack_status_t SFtp::NameAttrs::Unpack(const Buffer *b,int *offset,int limit,int protocol_version)
 {
    unpack_status_t res;
@@ -1964,6 +2576,32 @@ void SFtp::Request_LINK::Pack(Buffer *b)
    Packet::PackString(b,oldpath);
    PACK8(symbolic);
 }
+void SFtp::Request_CHECK_FILE::Pack(Buffer *b)
+{
+   Request_EXTENDED::Pack(b);
+   Packet::PackString(b,path,path.length());
+   Packet::PackString(b,algo_list,algo_list.length());
+   PACK64(0);  // start offset
+   PACK64(0);  // length, zero means up to the end of file
+   PACK32(0);  // block size, zero means a single hash
+}
+void SFtp::Request_MD5_HASH::Pack(Buffer *b)
+{
+   Request_EXTENDED::Pack(b);
+   Packet::PackString(b,path,path.length());
+   PACK64(0);  // start offset
+   PACK64(0);  // length, zero means up to the end of file
+   Packet::PackString(b,"",0);	// no quick check hash
+}
+void SFtp::Request_COPY_DATA::Pack(Buffer *b)
+{
+   Request_EXTENDED::Pack(b);
+   Packet::PackString(b,read_handle,read_handle.length());
+   PACK64(0);  // read offset
+   PACK64(0);  // length, zero means up to the end of file
+   Packet::PackString(b,write_handle,write_handle.length());
+   PACK64(0);  // write offset
+}
 
 const char *SFtp::utf8_to_lc(const char *s)
 {
@@ -222,6 +222,7 @@ private:
 
    void	 SendMethod();
    void	 SendArrayInfoRequests();
+   void	 SendBatchRequests();
 
    Ref<DirectedBuffer> send_translate;
    Ref<DirectedBuffer> recv_translate;
@@ -346,20 +347,15 @@ private:
    };
    class Reply_VERSION : public PacketUINT32
    {
-      char **extension_name;
-      char **extension_data;
+      StringSet extension_name;
+      StringSet extension_data;
    public:
       Reply_VERSION() : PacketUINT32(SSH_FXP_VERSION) {}
-      unpack_status_t Unpack(const Buffer *b)
-	 {
-	    unpack_status_t res;
-	    res=PacketUINT32::Unpack(b);
-	    if(res!=UNPACK_SUCCESS)
-	       return res;
-	    // FIXME: unpack extensions.
-	    return res;
-	 }
+      unpack_status_t Unpack(const Buffer *b);
       unsigned GetVersion() { return data; }
+      int GetExtensionCount() const { return extension_name.Count(); }
+      const char *GetExtensionName(int i) const { return extension_name.String(i); }
+      const char *GetExtensionData(int i) const { return extension_data.String(i); }
    };
    class Request_REALPATH : public PacketSTRING
    {
@@ -590,13 +586,20 @@ private:
       void ComputeLength() { PacketSTRING::ComputeLength(); length+=8+4; }
       void Pack(Buffer *b);
    };
-   class Reply_DATA : public PacketSTRING
+   class Reply_DATA : public Packet
    {
       bool eof;
+      // the data are not copied out of the receive buffer, they are valid
+      // until the packet is dropped from it. Detach copies them when the
+      // packet has to be kept longer.
+      const char *data;
+      int data_len;
+      xstring saved;
    public:
-      Reply_DATA() : PacketSTRING(SSH_FXP_DATA) { eof=false; }
-      void GetData(const char **b,int *s) { *b=string; *s=string.length(); }
+      Reply_DATA() : Packet(SSH_FXP_DATA) { eof=false; data=0; data_len=0; }
+      void GetData(const char **b,int *s) { *b=data; *s=data_len; }
       unpack_status_t Unpack(const Buffer *b);
+      void Detach() { if(data!=saved.get()) data=saved.nset(data,data_len); }
       bool Eof() { return eof; }
    };
    class Request_WRITE : public PacketSTRING
@@ -651,6 +654,7 @@ private:
    {
    public:
       Request_READLINK(const char *name) : PacketSTRING(SSH_FXP_READLINK,name) {}
+      const char *GetPath() const { return string; }
    };
    class Request_SYMLINK : public Packet
    {
@@ -681,6 +685,79 @@ private:
 	 }
       void Pack(Buffer *b);
    };
+   class Request_EXTENDED : public Packet
+   {
+      xstring request_name;
+   public:
+      Request_EXTENDED(const char *n)
+      : Packet(SSH_FXP_EXTENDED), request_name(n) {}
+      void ComputeLength() { Packet::ComputeLength(); length+=4+request_name.length(); }
+      void Pack(Buffer *b) { Packet::Pack(b); Packet::PackString(b,request_name,request_name.length()); }
+      bool NameIs(const char *n) const { return !strcmp(request_name,n); }
+   };
+   class Request_LIMITS : public Request_EXTENDED
+   {
+   public:
+      Request_LIMITS() : Request_EXTENDED("limits@openssh.com") {}
+   };
+   class Request_STATVFS : public Request_EXTENDED
+   {
+      xstring path;
+   public:
+      Request_STATVFS(const char *p)
+      : Request_EXTENDED("statvfs@openssh.com"), path(p) {}
+      void ComputeLength() { Request_EXTENDED::ComputeLength(); length+=4+path.length(); }
+      void Pack(Buffer *b) { Request_EXTENDED::Pack(b); Packet::PackString(b,path,path.length()); }
+   };
+   class Request_CHECK_FILE : public Request_EXTENDED
+   {
+      xstring path;
+      xstring algo_list;
+   public:
+      Request_CHECK_FILE(const char *p,const char *a)
+      : Request_EXTENDED("check-file-name"), path(p), algo_list(a) {}
+      void ComputeLength()
+	 {
+	    Request_EXTENDED::ComputeLength();
+	    length+=4+path.length()+4+algo_list.length()+8+8+4;
+	 }
+      void Pack(Buffer *b);
+   };
+   class Request_MD5_HASH : public Request_EXTENDED
+   {
+      xstring path;
+   public:
+      Request_MD5_HASH(const char *p)
+      : Request_EXTENDED("md5-hash"), path(p) {}
+      void ComputeLength()
+	 {
+	    Request_EXTENDED::ComputeLength();
+	    length+=4+path.length()+8+8+4;
+	 }
+      void Pack(Buffer *b);
+   };
+   class Request_COPY_DATA : public Request_EXTENDED
+   {
+      xstring read_handle;
+      xstring write_handle;
+   public:
+      Request_COPY_DATA(const xstring &r,const xstring &w)
+      : Request_EXTENDED("copy-data") { read_handle.set(r); write_handle.set(w); }
+      void ComputeLength()
+	 {
+	    Request_EXTENDED::ComputeLength();
+	    length+=4+read_handle.length()+8+8+4+write_handle.length()+8;
+	 }
+      void Pack(Buffer *b);
+   };
+   class Reply_EXTENDED : public Packet
+   {
+      Buffer data;
+   public:
+      Reply_EXTENDED() : Packet(SSH_FXP_EXTENDED_REPLY) {}
+      unpack_status_t Unpack(const Buffer *b);
+      const Buffer *GetData() const { return &data; }
+   };
 
    struct Expect;
    friend struct SFtp::Expect; // grant access to Packet.
@@ -698,6 +775,11 @@ private:
 	 INFO_READLINK,
 	 DEFAULT,
 	 WRITE_STATUS,
+	 BATCH,
+	 LIMITS,
+	 STATVFS,
+	 CHECKSUM,
+	 COPY,
 	 IGNORE
       };
 
@@ -705,6 +787,7 @@ private:
       Ref<Packet> reply;
       int i;
       expect_t tag;
+      Time sent;  // for the round trip time
       Expect(Packet *req,expect_t t,int j=0) : request(req), i(j), tag(t) {}
 
       bool has_data_at_pos(off_t pos) const {
@@ -738,6 +821,7 @@ private:
 
    bool GetBetterConnection(int level,bool limit_reached);
    void MoveConnectionHere(SFtp *o);
+   bool SpareSessionsSupported() const { return true; }
 
    bool	 eof;
 
@@ -756,7 +840,67 @@ private:
    int size_write;
    bool use_full_path;
 
+   // extensions announced by the server in SSH_FXP_VERSION.
+   enum {
+      EXT_LIMITS=1,	 // limits@openssh.com
+      EXT_STATVFS=2,	 // statvfs@openssh.com
+      EXT_CHECK_FILE=4,	 // check-file-name
+      EXT_MD5_HASH=8,	 // md5-hash
+      EXT_COPY_DATA=16,	 // copy-data
+   };
+   unsigned extensions;
+   xstring check_file_algos;  // hash algorithms announced for check-file
+   void SetExtensions(const Reply_VERSION *v);
+
+   // limits@openssh.com, zero when unknown.
+   long long server_max_read;
+   long long server_max_write;
+   long long server_max_handles;
+   int BlockSize(int size,long long server_max) const;
+   int ReadSize() const { return BlockSize(size_read,server_max_read); }
+   int WriteSize() const { return BlockSize(size_write,server_max_write); }
+
+   long long space_check_size;
+   xstring copy_handle;	 // the target handle of COPY
+   void SendOpenForStore();
+   void SendChecksumRequest(FileInfo *fi);
+   const char *CheckFileAlgos() const;
+
+   // a directory of LONG_LIST batch being read. Several directories are
+   // open at once, each with READDIR requests and READLINK requests for
+   // the symlinks found in it in flight.
+   struct BatchDir
+   {
+      int i;		// index in fileset_for_batch
+      xstring handle;
+      xstring list;	// long listing for the cache
+      Ref<FileSet> set;
+      int pending;	// READDIR and READLINK requests in flight
+      bool eof;
+      BatchDir(int j) : i(j), set(new FileSet), pending(0), eof(false) {}
+   };
+   xarray_p<BatchDir> batch_dirs;
+   enum { BATCH_DIRS_MAX=8 };
+   int BatchDirsMax() const;
+   int FindBatchDir(int i) const;
+   void SendBatchListRequests();
+   void HandleBatchList(Expect *e);
+   void CloseBatchDirs();
+
+   // sftp:auto-window: the number of data requests in flight is tuned
+   // by the measured round trip time and throughput of the connection.
+   bool auto_window;
+   int window_max;
+   int packets_in_flight;
+   double min_rtt;
+   Time window_sample_start;
+   long long window_sample_bytes;
+   Time last_data_time;
+   void StartWindowSample();
+   void TuneWindow(const Expect *e,int bytes);
+
 protected:
+   const char *ReplyErrorText(const Packet *reply);
    void SetError(int code,const Packet *reply);
    void SetError(int code,const char *mess=0) { FA::SetError(code,mess); }
 
@@ -786,6 +930,9 @@ public:
 
    bool SameSiteAs(const FileAccess *fa) const;
    bool SameLocationAs(const FileAccess *fa) const;
+   bool BatchSupported(open_mode m) const;
+   bool ChecksumSupported() const;
+   bool ParallelStoreSupported() const { return true; }
 
    DirList *MakeDirList(ArgV *args);
    Glob *MakeGlob(const char *pattern);
@@ -20,9 +20,169 @@
 #include <config.h>
 #include "SSH_Access.h"
 #include "misc.h"
+#include "ArgV.h"
+#include "ResMgr.h"
 #include <algorithm>
 #include <cctype>
 #include <string>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* OpenSSH connection sharing. All sessions to the same site run as channels
+   of one master connection (ControlMaster). The first session starts the
+   master, the others wait until its control socket appears, but not longer
+   than net:timeout; then they connect separately. The sockets are kept in
+   a private directory, the masters are stopped on exit. */
+struct SSH_Master
+{
+   xstring_c key;	// connect program, user, host and port
+   xstring_c path;	// control socket
+   xstring_c exit_cmd;
+   const SSH_Access *starting;	// session bringing the master up
+   Time start_time;
+
+   SSH_Master(const char *k,const char *p) : key(k), path(p), starting(0) {}
+   bool Ready() const {
+      struct stat st;
+      return lstat(path,&st)!=-1 && S_ISSOCK(st.st_mode);
+   }
+};
+
+static class SSH_MasterList : public xarray_p<SSH_Master>
+{
+   pid_t pid;
+   xstring_c dir;
+   bool dir_failed;
+public:
+   SSH_MasterList() : pid(0), dir_failed(false) {}
+   ~SSH_MasterList();
+   const char *Dir();
+   int Find(const char *key) const {
+      for(int i=0; i<count(); i++)
+	 if((*this)[i]->key.eq(key))
+	    return i;
+      return -1;
+   }
+} masters;
+
+const char *SSH_MasterList::Dir()
+{
+   if(dir || dir_failed)
+      return dir;
+   const char *tmp=getenv("TMPDIR");
+   if(!tmp || !*tmp)
+      tmp="/tmp";
+   xstring& templ=xstring::cat(tmp,"/lftp-ssh-XXXXXX",NULL);
+   if(!mkdtemp(templ.get_non_const()))
+   {
+      dir_failed=true;
+      return 0;
+   }
+   dir.set(templ);
+   pid=getpid();
+   return dir;
+}
+
+SSH_MasterList::~SSH_MasterList()
+{
+   if(!dir || pid!=getpid())
+      return;
+   for(int i=0; i<count(); i++)
+   {
+      SSH_Master *m=(*this)[i];
+      if(!m->Ready())
+	 continue;
+      // stop the master now instead of waiting for ControlPersist timeout.
+      if(system(m->exit_cmd)!=0)
+	 unlink(m->path);
+   }
+   rmdir(dir);
+}
+
+static bool is_openssh(const char *prog)
+{
+   int len=strcspn(prog," \t");
+   for(int i=len-1; i>=0; i--)
+   {
+      if(prog[i]=='/')
+      {
+	 prog+=i+1;
+	 len-=i+1;
+	 break;
+      }
+   }
+   return len==3 && !strncmp(prog,"ssh",3);
+}
+
+bool SSH_Access::WaitSharedConnection()
+{
+   shared_master=-1;
+   if(!QueryBool("share-connection",hostname))
+      return false;
+   const char *prog=Query("connect-program",hostname);
+   if(!prog || !prog[0])
+      prog="ssh -a -x";
+   if(!is_openssh(prog))
+      return false;
+
+   xstring_c key(xstring::cat(prog,"\n",user?user.get():"","\n",
+			      hostname.get(),"\n",portname?portname.get():"",NULL));
+   int i=masters.Find(key);
+   if(i==-1)
+   {
+      const char *dir=masters.Dir();
+      if(!dir)
+	 return false;
+      i=masters.count();
+      SSH_Master *m=new SSH_Master(key,xstring::format("%s/%d",dir,i));
+      ArgV args;
+      args.Add("-S");
+      args.Add(m->path);
+      args.Add("-O");
+      args.Add("exit");
+      args.Add(hostname);
+      xstring_ca cmd_q(args.CombineShellQuoted(0));
+      m->exit_cmd.set(xstring::cat(prog," ",cmd_q.get()," >/dev/null 2>&1",NULL));
+      masters.append(m);
+   }
+   shared_master=i;
+   SSH_Master *m=masters[i];
+   if(m->Ready())
+      return false;
+   if(!m->starting || m->starting==this)
+   {
+      m->starting=this;
+      m->start_time=SMTask::now;
+      return false;
+   }
+   if(TimeIntervalR(ResMgr::Query("net:timeout",hostname)).Finished(m->start_time))
+   {
+      // the master has not come up, do without it.
+      LogNote(2,"ssh master connection is not ready, connecting separately");
+      shared_master=-1;
+      return false;
+   }
+   // another session is connecting, it will become the master.
+   Timeout(100);
+   return true;
+}
+
+void SSH_Access::AddSharedConnectionOptions(ArgV& args)
+{
+   if(shared_master==-1)
+      return;
+   TimeIntervalR persist(ResMgr::Query("net:idle",hostname));
+   args.Add("-o");
+   args.Add("ControlMaster=auto");
+   args.Add("-o");
+   args.Add(xstring::cat("ControlPath=",masters[shared_master]->path.get(),NULL));
+   args.Add("-o");
+   if(persist.IsInfty())
+      args.Add("ControlPersist=yes");
+   else
+      args.Add(xstring::format("ControlPersist=%ld",long(persist.Seconds())));
+}
 
 void SSH_Access::MakePtyBuffers()
 {
@@ -202,6 +362,8 @@ void SSH_Access::DisconnectLL()
    password_sent=0;
    last_ssh_message.unset();
    last_ssh_message_time=0;
+   if(shared_master!=-1 && masters[shared_master]->starting==this)
+      masters[shared_master]->starting=0;
 }
 
 void SSH_Access::MoveConnectionHere(SSH_Access *o)
@@ -216,4 +378,7 @@ void SSH_Access::MoveConnectionHere(SSH_Access *o)
    password_sent=o->password_sent;
    last_ssh_message.move_here(o->last_ssh_message);
    last_ssh_message_time=o->last_ssh_message_time; o->last_ssh_message_time=0;
+   if(o->shared_master!=-1 && masters[o->shared_master]->starting==o)
+      masters[o->shared_master]->starting=this;
+   shared_master=o->shared_master;
 }
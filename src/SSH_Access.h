@@ -23,6 +23,8 @@
 #include "NetAccess.h"
 #include "PtyShell.h"
 
+class ArgV;
+
 class SSH_Access : public NetAccess
 {
 protected:
@@ -39,6 +41,13 @@ protected:
    xstring last_ssh_message;
    time_t last_ssh_message_time;
 
+   int shared_master;	// index of the shared ssh master, or -1
+
+   // returns true when the session has to wait for another session
+   // bringing up the shared master connection.
+   bool WaitSharedConnection();
+   void AddSharedConnectionOptions(ArgV& args);
+
    void MoveConnectionHere(SSH_Access *o);
    void DisconnectLL();
 
@@ -51,13 +60,13 @@ protected:
       password_sent(0),
       greeting(g), received_greeting(false),
       hostname_valid(false),
-      last_ssh_message_time(0) {}
+      last_ssh_message_time(0), shared_master(-1) {}
 
    SSH_Access(const SSH_Access *o) : NetAccess(o),
       password_sent(0),
       greeting(o->greeting), received_greeting(false),
       hostname_valid(o->hostname_valid),
-      last_ssh_message_time(0) {}
+      last_ssh_message_time(0), shared_master(-1) {}
 };
 
 #endif
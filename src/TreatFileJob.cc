@@ -34,6 +34,7 @@ TreatFileJob::TreatFileJob(FileAccess *s,ArgV *a)
 
    curr=0;
    set_maxdepth(0);
+   batch_mode=FA::CLOSED;
 
    op=args->a0();
    Begin(a->getcurr());
@@ -60,9 +61,106 @@ TreatFileJob::~TreatFileJob()
 {
 }
 
+void TreatFileJob::AddToBatch(const char *d,const FileInfo *fi,int new_mode)
+{
+   if(!first)
+      first=new FileInfo(*fi);
+
+   FileInfo *f=new FileInfo(*fi);
+   f->SetName(dir_file(d,fi->name));
+   // FileSet keeps the names sorted, the rank keeps the order of the walk
+   // (e.g. rm -r has to remove a/b/c before a/b).
+   f->SetRank(batch->count());
+   batch_orig->Add(new FileInfo(*f));
+   if(batch_mode==FA::CHANGE_MODE)
+      f->SetMode(new_mode);
+   batch->Add(f);
+}
+
+/* sends the bulk operation and reports the results */
+bool TreatFileJob::BatchDone()
+{
+   const FileAccessRef& s=SessionJob::session;
+   if(s->IsClosed())
+   {
+      batch->Sort(FileSet::BYRANK);
+      batch_orig->Sort(FileSet::BYRANK);
+      s->SetCwd(batch_cwd);
+      s->Batch(batch.get_non_const(),batch_mode);
+   }
+   int res=s->Done();
+   if(res==FA::IN_PROGRESS)
+      return false;
+
+   bool reported=false;
+   for(int i=0; i<batch->count(); i++)
+   {
+      const FileInfo *fi=(*batch_orig)[i];
+      int r=s->GetBatchResult(i);
+      const char *err=s->GetBatchError(i);
+      if(r==FA::IN_PROGRESS)
+	 r=res;
+      file_count++;
+      if(r<0)
+      {
+	 failed++;
+	 if(quiet)
+	    ;
+	 else if(err)
+	    eprintf("%s: %s: %s\n",op,fi->name.get(),err);
+	 else if(!reported)
+	 {
+	    eprintf("%s: %s\n",op,s->StrError(r));
+	    reported=true;
+	 }
+      }
+      CurrentFinished("",fi,r);
+   }
+   s->Close();
+   batch=0;
+   batch_orig=0;
+   return true;
+}
+
+int TreatFileJob::Do()
+{
+   int m=FinderJob::Do();
+   if(batch && FinderJob::Done() && BatchDone())
+      m=MOVED;
+   return m;
+}
+
 TreatFileJob::prf_res TreatFileJob::ProcessFile(const char *d,const FileInfo *fi)
 {
+   int new_mode=-1;
+   if(batch)
+   {
+      // add the file to the current batch if possible.
+      if(!ProcessingURL() && SessionJob::session->IsClosed()
+      && batch->count()<BATCH_MAX && BatchMode(fi,&new_mode)==batch_mode)
+      {
+	 AddToBatch(d,fi,new_mode);
+	 return PRF_OK;
+      }
+      if(!BatchDone())
+	 return PRF_LATER;
+   }
+
    curr=fi;
+   if(session->IsClosed() && !ProcessingURL())
+   {
+      FA::open_mode m=BatchMode(fi,&new_mode);
+      if(m!=FA::CLOSED && session->BatchSupported(m))
+      {
+	 curr=0;
+	 batch=new FileSet;
+	 batch_orig=new FileSet;
+	 batch_mode=m;
+	 batch_cwd=init_dir;
+	 AddToBatch(d,fi,new_mode);
+	 return PRF_OK;
+      }
+   }
    if(session->IsClosed())
    {
       if(!first)
@@ -83,7 +181,7 @@ TreatFileJob::prf_res TreatFileJob::ProcessFile(const char *d,const FileInfo *fi
       if(!quiet)
          eprintf("%s: %s\n",op,session->StrError(res));
    }
-   CurrentFinished(d,fi);
+   CurrentFinished(d,fi,res);
 
    session->Close();
    return res<0? PRF_ERR:PRF_OK;
@@ -35,15 +35,35 @@ protected:
    int	 failed,file_count;
 
    virtual void	TreatCurrent(const char *d,const FileInfo *fi) = 0;
-   virtual void CurrentFinished(const char *d,const FileInfo *fi) { }
+   virtual void CurrentFinished(const char *d,const FileInfo *fi,int res) { }
+
+   /* Returns the open mode to treat the file with as a part of a bulk
+    * operation, or CLOSED if the file has to be treated alone.
+    * CHANGE_MODE also stores the new mode into *new_mode. */
+   virtual FA::open_mode BatchMode(const FileInfo *fi,int *new_mode) { return FA::CLOSED; }
 
    void Begin(const char *d);
 
+   // files queued for a bulk operation, see FileAccess::Batch.
+   // It is sent via the job's own session when the session is needed
+   // for something else, when the batch is full or at the end.
+   enum { BATCH_MAX=256 };
+   Ref<FileSet> batch;	    // names relative to batch_cwd, new modes
+   Ref<FileSet> batch_orig; // as they were found
+   FA::open_mode batch_mode;
+   FileAccess::Path batch_cwd;
+   void AddToBatch(const char *d,const FileInfo *fi,int new_mode);
+   bool BatchDone();
+
    /* virtuals */
    void Finish();
    prf_res ProcessFile(const char *d,const FileInfo *fi);
 
 public:
+   int	 Do();
+   int	 Done() { return FinderJob::Done() && !batch; }
+   int	 ExitCode() { return FinderJob::ExitCode() || (failed && !quiet); }
+
    xstring& FormatStatus(xstring&,int,const char *);
    void	 ShowRunStatus(const SMTaskRef<StatusLine>&);
 
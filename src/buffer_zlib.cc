@@ -19,6 +19,7 @@
 
 #include <config.h>
 #include "buffer_zlib.h"
+#include "log.h"
 
 void DataInflator::PutTranslated(Buffer *target,const char *put_buf,int size)
 {
@@ -125,7 +126,18 @@ void DataDeflator::PutTranslated(Buffer *target,const char *put_buf,int size)
       z.avail_in=put_size;
       z.next_out=(Bytef*)store_buf;
       z.avail_out=store_size;
+      Time start;
+      if(adaptive)
+	 start.SetToCurrentTime();
       int ret = deflate(&z,flush);
+      if(adaptive)
+      {
+	 Time end;
+	 end.SetToCurrentTime();
+	 sample_busy+=TimeDiff(end,start);
+	 sample_in+=put_size-z.avail_in;
+	 sample_out+=store_size-z.avail_out;
+      }
       switch (ret) {
       case Z_OK:
 	 break;
@@ -160,13 +172,78 @@ void DataDeflator::PutTranslated(Buffer *target,const char *put_buf,int size)
       if(flush==Z_FINISH && ret==Z_STREAM_END)
 	 break;
    }
+   // the level cannot be changed once the stream is being finished.
+   if(adaptive && flush!=Z_FINISH && sample_in>=SAMPLE_SIZE)
+      Adapt(target);
+}
+
+void DataDeflator::SetLevel(Buffer *target,int new_level)
+{
+   // deflateParams may need to flush the data compressed so far.
+   for(size_t store_size=0x1000; store_size<=0x100000; store_size*=2)
+   {
+      char *store_buf=target->GetSpace(store_size);
+      z.next_in=(Bytef*)"";
+      z.avail_in=0;
+      z.next_out=(Bytef*)store_buf;
+      z.avail_out=store_size;
+      int ret=deflateParams(&z,new_level,Z_DEFAULT_STRATEGY);
+      target->SpaceAdd(store_size-z.avail_out);
+      if(ret==Z_OK)
+      {
+	 Log::global->Format(9,"MODE Z: compression level %d -> %d\n",level,new_level);
+	 level=new_level;
+	 return;
+      }
+      if(ret!=Z_BUF_ERROR)
+	 return;
+   }
+}
+
+void DataDeflator::Adapt(Buffer *target)
+{
+   Time t;
+   t.SetToCurrentTime();
+   double wall=TimeDiff(t,sample_start);
+   double ratio=double(sample_out)/sample_in;
+   double busy=(wall>0?sample_busy/wall:1);
+
+   if(ratio>0.97 && level>0)
+   {
+      // incompressible data, just store it for a while.
+      stored_level=level;
+      stored_samples=0;
+      SetLevel(target,0);
+   }
+   else if(level==0)
+   {
+      // the data may become compressible again, e.g. in the next file.
+      if(++stored_samples>=PROBE_SAMPLES)
+	 SetLevel(target,stored_level);
+   }
+   else if(busy>0.5 && level>1)
+      SetLevel(target,level-1);
+   else if(busy<0.1 && level<max_level)
+      SetLevel(target,level+1);
+
+   sample_in=sample_out=0;
+   sample_busy=0;
+   sample_start=t;
 }
 
-DataDeflator::DataDeflator(int level)
+DataDeflator::DataDeflator(int level_,bool adaptive_)
 {
+   level=(level_==Z_DEFAULT_COMPRESSION?6:level_);
+   max_level=level;
+   adaptive=(adaptive_ && level>0);
+   stored_level=level;
+   stored_samples=0;
+   sample_in=sample_out=0;
+   sample_busy=0;
+
    /* allocate deflate state */
    memset(&z,0,sizeof(z));
-   z_err = deflateInit(&z, level);
+   z_err = deflateInit(&z, level_);
 }
 DataDeflator::~DataDeflator()
 {
@@ -175,4 +252,8 @@ DataDeflator::~DataDeflator()
 void DataDeflator::ResetTranslation()
 {
    z_err = deflateReset(&z);
+   stored_samples=0;
+   sample_in=sample_out=0;
+   sample_busy=0;
+   sample_start.SetToCurrentTime();
 }
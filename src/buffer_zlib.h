@@ -41,8 +41,27 @@ class DataDeflator : public DataTranslator
 {
    z_stream z;
    int z_err;
+
+   /* Adaptive level: the level is lowered when deflate takes most of
+      the time (the link is faster than the compression), raised back
+      when the link is the bottleneck, and compression is switched off
+      while the data turns out to be incompressible. */
+   int level;
+   int max_level;
+   bool adaptive;
+   int stored_level;	// the level to probe again after storing
+   int stored_samples;
+   long long sample_in;
+   long long sample_out;
+   double sample_busy;	// seconds spent in deflate
+   Time sample_start;
+   enum { SAMPLE_SIZE=0x100000, PROBE_SAMPLES=16 };
+
+   void SetLevel(Buffer *target,int new_level);
+   void Adapt(Buffer *target);
+
 public:
-   DataDeflator(int level=Z_DEFAULT_COMPRESSION);
+   DataDeflator(int level=Z_DEFAULT_COMPRESSION,bool adaptive=false);
    ~DataDeflator();
    void PutTranslated(Buffer *dst,const char *buf,int size);
    void ResetTranslation();
@@ -345,6 +345,7 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 N_("Rename <file1> to <file2>\n")},
    {"mmv",      cmd_mmv,   N_("mmv [OPTS] <files> <target-dir>"),
 	 N_("Move <files> to <target-directory> with wildcard expansion\n"
+	 " -c, --copy  copy the files on the server instead of moving\n"
 	 " -O <dir>  specifies the target directory (alternative way)\n")},
    {"nlist",   cmd_ls,     N_("[re]nlist [<args>]"),
 	 N_("List remote file names.\n"
@@ -374,6 +375,7 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 "     it requires permission to overwrite remote files\n"
 	 " -E  delete local files after successful transfer (dangerous)\n"
 	 " -a  use ascii mode (binary is the default)\n"
+	 " -n <maxconn>  upload the file using several connections (SFTP only)\n"
 	 " -O <base> specifies base directory or URL where files should be placed\n")},
    {"pwd",     cmd_pwd,    "pwd [-p]",
 	 N_("Print current remote URL.\n"
@@ -1757,6 +1759,7 @@ CMD(get)
    else if(!strcmp(op,"put") || !strcmp(op,"reput"))
    {
       reverse=true;
+      opts=(cont?"+EaO:qP:n:":"+cEeaO:qPn:");
    }
    else if(!strcmp(op,"mget") || !strcmp(op,"mput"))
    {
@@ -2519,17 +2522,22 @@ CMD(mmv)
       {"target-directory",required_argument,0,'O'},
       {"destination-directory",required_argument,0,'O'},
       {"remove-target-first",no_argument,0,'e'},
+      {"copy",no_argument,0,'c'},
       {0}
    };
 
    bool remove_target=false;
+   FA::open_mode m=FA::RENAME;
    const char *target_dir=0;
    args->rewind();
    int opt;
-   while((opt=args->getopt_long("eO:t:",mmv_opts,0))!=EOF)
+   while((opt=args->getopt_long("ceO:t:",mmv_opts,0))!=EOF)
    {
       switch(opt)
       {
+      case('c'):
+	 m=FA::COPY;
+	 break;
       case('e'):
 	 remove_target=true;
 	 break;
@@ -2552,7 +2560,7 @@ CMD(mmv)
       eprintf(_("Usage: %s [OPTS] <files> <target-dir>\n"),args->a0());
       goto help;
    }
-   mmvJob *j=new mmvJob(session->Clone(),args,target_dir,FA::RENAME);
+   mmvJob *j=new mmvJob(session->Clone(),args,target_dir,m);
    if(remove_target)
       j->RemoveTargetFirst();
    return j;
@@ -892,7 +892,7 @@ void Ftp::CatchDATE(int act)
    }
 
    fi->NoNeed(fi->DATE);
-   if(!(fi->need&fi->SIZE))
+   if(!(fi->need&(fi->SIZE|fi->CHECKSUM)))
       fileset_for_info->next();
 
    TrySuccess();
@@ -947,11 +947,156 @@ void Ftp::CatchSIZE(int act)
    if(size>=1)
       fi->SetSize(size);
    fi->NoNeed(fi->SIZE);
-   if(!(fi->need&fi->DATE))
+   if(!(fi->need&(fi->DATE|fi->CHECKSUM)))
       fileset_for_info->next();
 
    TrySuccess();
 }
+
+static const struct { const char *cmd,*algo; } xhash_cmds[]={
+   {"XCRC","CRC32"},
+   {"XMD5","MD5"},
+   {"XSHA1","SHA-1"},
+   {"XSHA256","SHA-256"},
+   {"XSHA512","SHA-512"},
+   {0,0}
+};
+static const char *xhash_cmd(const char *algo)
+{
+   for(int i=0; xhash_cmds[i].cmd; i++)
+      if(!strcasecmp(xhash_cmds[i].algo,algo))
+	 return xhash_cmds[i].cmd;
+   return 0;
+}
+static const char *xhash_cmd_algo(const char *cmd)
+{
+   for(int i=0; xhash_cmds[i].cmd; i++)
+      if(!strcasecmp(xhash_cmds[i].cmd,cmd))
+	 return xhash_cmds[i].algo;
+   return 0;
+}
+
+// HASH reply: 213 <algo> <range> <hex> <file>
+// X-commands: 250 <hex> [<file>], algo is known from the command.
+void Ftp::CatchCHECKSUM(int act,const char *algo)
+{
+   if(!fileset_for_info)
+      return;
+
+   FileInfo *fi=fileset_for_info->curr();
+   if(!fi)
+      return;
+
+   if(is2XX(act))
+   {
+      const char *s=line.length()>4?line+4:"";
+      xstring& hash_algo=xstring::get_tmp(algo);
+      if(!algo)
+      {
+	 int len=strcspn(s," ");
+	 hash_algo.nset(s,len);
+	 s+=len;
+      }
+      // some servers drop the leading zeros of a CRC32.
+      bool crc=!strcasecmp(hash_algo,"CRC32");
+      while(*s)
+      {
+	 s+=strspn(s," ");
+	 int len=strcspn(s," ");
+	 int xlen=0;
+	 while(xlen<len && is_ascii_xdigit(s[xlen]))
+	    xlen++;
+	 if(xlen==len && len>0 && (crc ? len<=8 : len>=8))
+	 {
+	    xstring hex;
+	    if(crc)
+	       hex.append_padding(8-len,'0');
+	    hex.append(s,len);
+	    fi->SetChecksum(hash_algo,hex);
+	    break;
+	 }
+	 s+=len;
+      }
+   }
+   else	if(is5XX(act))
+   {
+      if(cmd_unsupported(act))
+      {
+	 if(algo)
+	    conn->xhash_supported.truncate();
+	 else
+	    conn->hash_supported.set(0);
+      }
+   }
+   else
+   {
+      Disconnect(line);
+      return;
+   }
+
+   fi->NoNeed(fi->CHECKSUM);
+   if(!(fi->need&(fi->DATE|fi->SIZE)))
+      fileset_for_info->next();
+
+   TrySuccess();
+}
+void Ftp::CatchBatch(int act,const Expect *exp)
+{
+   if(!fileset_for_batch || !fileset_for_batch->curr())
+      return;
+
+   int i=fileset_for_batch->curr_index();
+   if(batch_mode==LONG_LIST && is2XX(act))
+      CacheBatchList(i);
+   else if(is2XX(act))
+      SetBatchResult(i,OK);
+   else if((is5XX(act) && !Transient5XX(act)) || (is4XX(act) && act!=421))
+   {
+      // a temporary failure of one file is its own error too,
+      // else the batch would be sent again and again.
+      if(batch_mode==CHANGE_MODE && site_cmd_unsupported(act))
+      {
+	 if(exp->cmd.begins_with("SITE CHMOD"))
+	    conn->site_chmod_supported=false;
+	 else if(exp->cmd.begins_with("MFF"))
+	    conn->mff_supported=false;
+      }
+      SetBatchResult(i,NO_FILE,all_lines);
+   }
+   else
+   {
+      // the unanswered requests are sent again after reconnect.
+      Disconnect(line);
+      return;
+   }
+   batch_list.truncate();
+   fileset_for_batch->next();
+   TrySuccess();
+}
+void Ftp::CacheBatchList(int i)
+{
+   if(!use_stat_for_list)
+   {
+      // the server has ignored the argument of STAT.
+      SetBatchResult(i,NOT_SUPP);
+      return;
+   }
+   int err;
+   Ref<FileSet> set(ParseLongList(batch_list,batch_list.length(),&err));
+   if(batch_list.length()==0 || !set || err>0)
+   {
+      // let ListInfo try other ways.
+      SetBatchResult(i,NOT_SUPP);
+      return;
+   }
+   Path dir(&cwd);
+   dir.ExpandTilde(home);
+   dir.Change((*fileset_for_batch)[i]->name);
+   SMTaskRef<FileAccess> loc(Clone());
+   loc->SetCwd(dir);
+   cache->Add(loc,"",LONG_LIST,OK,batch_list,batch_list.length(),set.get());
+   SetBatchResult(i,OK);
+}
 void Ftp::CatchSIZE_opt(int act)
 {
    long long size=NO_SIZE;
@@ -1154,6 +1299,9 @@ bool Ftp::GetBetterConnection(int level,bool limit_reached)
 {
    bool need_sleep=false;
 
+   if(spare)
+      return need_sleep; // spare sessions are there to be taken over
+
 //    if(level==0 && cwd==0)
 //       return need_sleep;
 
@@ -1451,7 +1599,7 @@ int   Ftp::Do()
       if(proxy && (!xstrcmp(proxy_proto,"ftps")
 	        || !xstrcmp(proxy_proto,"https")))
       {
-	 conn->MakeSSLBuffers(hostname);
+	 conn->MakeSSLBuffers(hostname,0);
       }
       else // note the following block
 #endif
@@ -1474,7 +1622,7 @@ int   Ftp::Do()
 #if USE_SSL
       if(ftps && (!proxy || conn->proxy_is_http))
       {
-	 conn->MakeSSLBuffers(hostname);
+	 conn->MakeSSLBuffers(hostname,SSLSessionKey());
 	 const char *initial_prot=ResMgr::Query("ftps:initial-prot",hostname);
 	 conn->prot=initial_prot[0];
       }
@@ -1711,11 +1859,19 @@ int   Ftp::Do()
       if(mode==CONNECT_VERIFY)
 	 goto notimeout_return;
 
-      if(mode==CHANGE_MODE && !conn->mff_supported && !conn->site_chmod_supported)
+      if((mode==CHANGE_MODE || (mode==BATCH && batch_mode==CHANGE_MODE))
+      && !conn->mff_supported && !conn->site_chmod_supported)
       {
 	 SetError(NOT_SUPP,_("MFF and SITE CHMOD are not supported by this site"));
 	 return MOVED;
       }
+      if(mode==BATCH && batch_mode==LONG_LIST
+      && (!use_stat_for_list || (use_mlsd && conn->mlst_supported)))
+      {
+	 // ListInfo would use MLSD, not the STAT listings.
+	 SetError(NOT_SUPP,0);
+	 return MOVED;
+      }
       if(mode==MP_LIST && !conn->mlst_supported)
       {
 	 SetError(NOT_SUPP,_("MLST and MLSD are not supported by this site"));
@@ -2036,8 +2192,15 @@ int   Ftp::Do()
 	 append_file=true;
 	 want_type=conn->type;
 	 break;
+      case(COPY):
+      case(BLOCK_SUMS):
+	 SetError(NOT_SUPP);
+	 return MOVED;
       case(ARRAY_INFO):
 	 break;
+      case(BATCH):
+	 want_type=conn->type;
+	 break;
       case(CHANGE_MODE):
 	 {
 	    if(conn->mff_supported)
@@ -2080,6 +2243,11 @@ int   Ftp::Do()
 	 SendArrayInfoRequests();
 	 goto pre_WAITING_STATE;
       }
+      if(mode==BATCH)
+      {
+	 SendBatchRequests();
+	 goto pre_WAITING_STATE;
+      }
 
       const char *file_to_append=0;
       if(append_file)
@@ -2422,7 +2590,8 @@ int   Ftp::Do()
       }
       if(conn->t_mode=='Z') {
 	 if(mode==STORE)
-	    conn->AddDataTranslator(new DataDeflator(Query("mode-z-level",hostname)));
+	    conn->AddDataTranslator(new DataDeflator(Query("mode-z-level",hostname),
+				       QueryBool("mode-z-adaptive",hostname)));
 	 else
 	    conn->AddDataTranslator(new DataInflator());
       }
@@ -2576,6 +2745,11 @@ int   Ftp::Do()
 	 SendArrayInfoRequests();
 	 return MOVED;
       }
+      if(expect->IsEmpty() && mode==BATCH && fileset_for_batch->curr())
+      {
+	 SendBatchRequests();
+	 return MOVED;
+      }
 
       if(conn->data_iobuf)
       {
@@ -2830,12 +3004,39 @@ void Ftp::SendArrayInfoRequests()
 	 expect->Push(Expect::MDTM);
 	 sent=true;
       }
+      else
+	 fi->NoNeed(fi->DATE);
       if((fi->need&fi->SIZE) && conn->size_supported && use_size)
       {
 	 conn->SendCmd2("SIZE",ExpandTildeStatic(fi->name));
 	 expect->Push(Expect::SIZE);
 	 sent=true;
       }
+      else
+	 fi->NoNeed(fi->SIZE);
+      const char *algo=0;
+      if((fi->need&fi->CHECKSUM)
+      && (algo=ChooseChecksumAlgo(conn->hash_supported))!=0)
+      {
+	 if(xstrcasecmp(algo,conn->hash_selected))
+	 {
+	    conn->SendCmd2("OPTS HASH",algo);
+	    expect->Push(Expect::IGNORE);
+	    conn->hash_selected.set(algo);
+	 }
+	 conn->SendCmd2("HASH",ExpandTildeStatic(fi->name));
+	 expect->Push(Expect::CHECKSUM);
+	 sent=true;
+      }
+      else if((fi->need&fi->CHECKSUM)
+      && (algo=ChooseChecksumAlgo(conn->xhash_supported))!=0)
+      {
+	 conn->SendCmd2(xhash_cmd(algo),ExpandTildeStatic(fi->name));
+	 expect->Push(new Expect(Expect::CHECKSUM,algo));
+	 sent=true;
+      }
+      else
+	 fi->NoNeed(fi->CHECKSUM);
       if(!sent)
       {
 	 if(i==fileset_for_info->curr_index())
@@ -2851,6 +3052,61 @@ void Ftp::SendArrayInfoRequests()
    }
 }
 
+void Ftp::SendBatchRequests()
+{
+   batch_list.truncate();
+   for(int i=fileset_for_batch->curr_index(); i<fileset_for_batch->count(); i++)
+   {
+      const FileInfo *fi=(*fileset_for_batch)[i];
+      const char *name=ExpandTildeStatic(fi->name);
+      const char *cmd=0;
+      switch(batch_mode)
+      {
+      case REMOVE:
+	 cmd="DELE";
+	 break;
+      case REMOVE_DIR:
+	 cmd="RMD";
+	 break;
+      case MAKE_DIR:
+	 cmd="MKD";
+	 break;
+      case CHANGE_MODE:
+	 if(conn->mff_supported)
+	    cmd=xstring::format("MFF UNIX.mode=%03o;",(unsigned)fi->mode);
+	 else
+	    cmd=xstring::format("SITE CHMOD %03o",(unsigned)fi->mode);
+	 break;
+      case LONG_LIST:
+	 if(list_options && list_options[0])
+	    cmd=xstring::cat("STAT ",list_options.get(),NULL);
+	 else
+	    cmd="STAT";
+	 break;
+      default:
+	 abort();
+      }
+      conn->SendCmd2(cmd,name);
+      expect->Push(new Expect(Expect::BATCH,0,cmd));
+      if(GetFlag(SYNC_MODE))
+	 break;	   // don't flood the queues.
+   }
+}
+
+bool Ftp::BatchSupported(open_mode m) const
+{
+   return m==REMOVE || m==REMOVE_DIR || m==MAKE_DIR || m==CHANGE_MODE
+      || (m==LONG_LIST && use_stat_for_list);
+}
+
+bool Ftp::ChecksumSupported() const
+{
+   // not known until FEAT reply.
+   if(!conn || !conn->have_feat_info)
+      return true;
+   return conn->hash_supported || conn->xhash_supported.length()>0;
+}
+
 int Ftp::ReplyLogPriority(int code) const
 {
    // Greeting messages
@@ -2983,9 +3239,12 @@ int  Ftp::ReceiveResp()
       bool is_first_line=(line[3]=='-' && conn->multiline_code==0);
       bool is_last_line=(line[3]!='-' && code!=0);
 
-      bool is_data=(!expect->IsEmpty() && expect->FirstIs(Expect::QUOTED) && conn->data_iobuf);
+      bool batch_list_data=(mode==BATCH && batch_mode==LONG_LIST && use_stat_for_list);
+      bool is_data=(!expect->IsEmpty()
+	 && ((expect->FirstIs(Expect::QUOTED) && conn->data_iobuf)
+	     || (expect->FirstIs(Expect::BATCH) && batch_list_data)));
       int data_offset=0;
-      if(is_data && mode==LONG_LIST)
+      if(is_data && (mode==LONG_LIST || batch_list_data))
       {
 	 if(code && !is2XX(code))
 	    is_data=false;
@@ -3002,7 +3261,15 @@ int  Ftp::ReceiveResp()
 	       is_data=false;
 	 }
       }
-      if(is_data && conn->data_iobuf)
+      if(is_data && batch_list_data)
+      {
+	 if(line[data_offset]==' ')
+	    data_offset++;
+	 batch_list.append(line+data_offset,line.length()-data_offset);
+	 batch_list.append('\n');
+	 log_prio=10;
+      }
+      else if(is_data && conn->data_iobuf)
       {
 	 if(line[data_offset]==' ')
 	    data_offset++;
@@ -3730,6 +3997,8 @@ void Ftp::ExpectQueue::Close()
       case(Expect::PORT):
       case(Expect::FILE_ACCESS):
       case(Expect::RNFR):
+      case(Expect::BATCH):
+      case(Expect::CHECKSUM):
       case(Expect::QUOTED):
 	 scan->check_case=Expect::IGNORE;
 	 break;
@@ -4061,6 +4330,9 @@ void Ftp::Connection::CheckFEAT(char *reply,const char *line,bool trust)
    tvfs_supported=false;
    mode_z_supported=false;
    cepr_supported=false;
+   hash_supported.set(0);
+   hash_selected.set(0);
+   xhash_supported.truncate();
 
    char *scan=strchr(reply,'\n');
    if(scan)
@@ -4119,6 +4391,22 @@ void Ftp::Connection::CheckFEAT(char *reply,const char *line,bool trust)
 	 site_symlink_supported=true;
       else if(!strcasecmp(f,"SITE MKDIR"))
 	 site_mkdir_supported=true;
+      else if(!strncasecmp(f,"HASH ",5))
+      {
+	 // the currently selected algorithm is marked with `*'.
+	 hash_supported.set(f+5);
+	 char *star=strchr(hash_supported.get_non_const(),'*');
+	 if(star)
+	 {
+	    char *sel=star;
+	    while(sel>hash_supported.get() && sel[-1]!=';')
+	       sel--;
+	    hash_selected.nset(sel,star-sel);
+	    memmove(star,star+1,strlen(star));
+	 }
+      }
+      else if(xhash_cmd_algo(f))
+	 xhash_supported.vappend(";",xhash_cmd_algo(f),NULL);
 #if USE_SSL
       else if(!strncasecmp(f,"AUTH ",5))
       {
@@ -4151,9 +4439,12 @@ void Ftp::Connection::CheckFEAT(char *reply,const char *line,bool trust)
 
 void Ftp::TurnOffStatForList()
 {
-   DataClose();
-   expect->Close();
-   state=EOF_STATE;
+   if(mode==LONG_LIST)
+   {
+      DataClose();
+      expect->Close();
+      state=EOF_STATE;
+   }
    LogNote(2,"Setting ftp:use-stat-for-list to off");
    ResMgr::Set("ftp:use-stat-for-list",hostname,"off");
    use_stat_for_list=false;
@@ -4329,6 +4620,12 @@ void Ftp::CheckResp(int act)
    case Expect::MDTM_OPT:
       CatchDATE_opt(act);
       break;
+   case Expect::BATCH:
+      CatchBatch(act,exp);
+      break;
+   case Expect::CHECKSUM:
+      CatchCHECKSUM(act,exp->arg);
+      break;
 
    case Expect::FILE_ACCESS:
    file_access:
@@ -4541,7 +4838,7 @@ void Ftp::CheckResp(int act)
    case Expect::AUTH_TLS:
       if(is2XX(act) || is3XX(act))
       {
-	 conn->MakeSSLBuffers(hostname);
+	 conn->MakeSSLBuffers(hostname,SSLSessionKey());
       }
       else
       {
@@ -4756,6 +5053,12 @@ int   Ftp::Done()
 	 return(OK);
       return(IN_PROGRESS);
    }
+   if(mode==BATCH)
+   {
+      if(state==WAITING_STATE && expect->IsEmpty() && !fileset_for_batch->curr())
+	 return(OK);
+      return(IN_PROGRESS);
+   }
 
    if(copy_mode==COPY_DEST && !copy_allow_store)
       return(IN_PROGRESS);
@@ -5070,10 +5373,17 @@ FtpS::FtpS(const FtpS *o) : super(o)
 }
 FileAccess *FtpS::New() { return new FtpS(); }
 
-void Ftp::Connection::MakeSSLBuffers(const char *hostname)
+const char *Ftp::SSLSessionKey() const
+{
+   const char *port=portname?portname.get():ftps?FTPS_DEFAULT_PORT:FTP_DEFAULT_PORT;
+   return xstring::cat(hostname.get(),":",port,NULL);
+}
+
+void Ftp::Connection::MakeSSLBuffers(const char *hostname,const char *session_key)
 {
    control_ssl=new lftp_ssl(control_sock,lftp_ssl::CLIENT,hostname);
    control_ssl->load_keys();
+   control_ssl->resume_session(session_key);
    IOBufferSSL *send_ssl=new IOBufferSSL(control_ssl,IOBufferSSL::PUT);
    IOBufferSSL *recv_ssl=new IOBufferSSL(control_ssl,IOBufferSSL::GET);
 
@@ -153,6 +153,9 @@ class Ftp : public NetAccess
 
       xstring_c mlst_attr_supported;
       xstring_c mode_z_opts_supported;
+      xstring_c hash_supported;	 // algorithms of HASH command
+      xstring_c hash_selected;	 // ... and the one currently selected
+      xstring xhash_supported;	 // algorithms of XCRC, XMD5 etc commands
 
       Connection(const char *c);
       ~Connection();
@@ -160,7 +163,7 @@ class Ftp : public NetAccess
       bool data_address_ok(const sockaddr_u *d,bool verify_address,bool verify_port);
 
       void MakeBuffers();
-      void MakeSSLBuffers(const char *h);
+      void MakeSSLBuffers(const char *h,const char *session_key);
       void InitTelnetLayer();
       void SetControlConnectionTranslation(const char *cs);
 
@@ -240,6 +243,8 @@ class Ftp : public NetAccess
 	 SITE_UTIME,
 	 SITE_UTIME2,
 	 ALLO,
+	 BATCH,		// check response for a command of a bulk operation
+	 CHECKSUM,	// check response for HASH or XMD5 and the like
 	 QUOTED		// check response for any command submitted by QUOTE_CMD
 #if USE_SSL
 	 ,AUTH_TLS,PROT,SSCN,CCC
@@ -300,6 +305,9 @@ class Ftp : public NetAccess
    void	 CatchDATE_opt(int);
    void	 CatchSIZE(int);
    void	 CatchSIZE_opt(int);
+   void	 CatchBatch(int,const Expect *exp);
+   void	 CacheBatchList(int);
+   void	 CatchCHECKSUM(int,const char *algo);
    void	 TurnOffStatForList();
 
    enum pasv_state_t
@@ -327,6 +335,7 @@ class Ftp : public NetAccess
 protected:
    bool	 ftps;	  // ssl and prot='P' by default (port 990)
 private:
+   const char *SSLSessionKey() const;
 #else
    static const bool ftps; // for convenience
 #endif
@@ -339,6 +348,7 @@ private:
    int	FlushSendQueueOneCmd();
    int	FlushSendQueue(bool all=false);
    void	SendArrayInfoRequests();
+   void	SendBatchRequests();
    void	SendSiteIdle();
    void	SendAcct();
    void	SendSiteGroup();
@@ -372,6 +382,7 @@ private:
    void MoveConnectionHere(Ftp *o);
    bool GetBetterConnection(int level,bool limit_reached);
    bool SameConnection(const Ftp *o) const;
+   bool SpareSessionsSupported() const { return true; }
 
    // state
    automate_state state;
@@ -381,6 +392,7 @@ private:
 
    xstring line;	// last line of last server reply
    xstring all_lines;   // all lines of last server reply
+   xstring batch_list;  // STAT output for the current LONG_LIST batch item
 
    void	 SetError(int code,const char *mess=0);
 
@@ -459,6 +471,8 @@ public:
 
    bool	 SameLocationAs(const FileAccess *) const;
    bool	 SameSiteAs(const FileAccess *) const;
+   bool	 BatchSupported(open_mode m) const;
+   bool	 ChecksumSupported() const;
 
    void	 ResetLocationData();
 
@@ -518,6 +532,34 @@ public:
    DirList *MakeDirList(ArgV *args);
    FileSet *ParseLongList(const char *buf,int len,int *err=0) const;
 
+   // LIST/MLSD output parser which can be fed with the data as it arrives.
+   // The format is guessed by trying all line parsers on the first lines.
+   class LongListParser
+   {
+   public:
+      enum { NUM_PARSERS=7 };
+   private:
+      xstring_c tz;
+      int err[NUM_PARSERS];
+      FileSet *set[NUM_PARSERS];
+      int best_err1;
+      int best_err2;
+      int guessed;   // index of the guessed parser or -1
+      bool failed;   // too many errors even with the best parser
+      xstring line;
+      xstring tmp_line;
+      void ParseLine();
+   public:
+      LongListParser(const char *tz);
+      ~LongListParser();
+      // parses complete lines only, returns number of bytes consumed.
+      int Parse(const char *buf,int len);
+      // the caller has to delete the resulting FileSet.
+      FileSet *GetResult(int *err_ret);
+      // takes the entries parsed so far once the format is known for sure.
+      FileSet *TakeGuessed();
+   };
+
    void SetCopyMode(copy_mode_t cm,bool rp,bool prot,bool sscn,int rnum,time_t tt)
       {
 	 copy_mode=cm;
@@ -82,6 +82,128 @@ void lftp_ssl_base::set_cert_error(const char *s,const xstring& fp)
    }
 }
 
+lftp_ssl_session_cache lftp_ssl_base::session_cache;
+
+void lftp_ssl_session_cache::Load()
+{
+   loaded=true;
+   const char *f=ResMgr::Query("ssl:session-cache-file",0);
+   if(!f || !*f)
+      return;
+   file.set(expand_home_relative(f));
+   int fd=open(file,O_RDONLY);
+   if(fd==-1)
+      return;
+   fcntl(fd,F_SETFD,FD_CLOEXEC);
+   if(Lock(fd,F_RDLCK)==-1)
+      Log::global->Format(1,"%s: lock for reading failed, trying to read anyway\n",file.get());
+   Read(fd);	// Read closes fd
+   PurgeExpired();
+}
+
+void lftp_ssl_session_cache::PurgeExpired()
+{
+   time_t t=time(0);
+   for(Pair **p=&chain; *p; )
+   {
+      if(extract_expire((*p)->value)<=t)
+	 Purge(p);
+      else
+	 p=&(*p)->next;
+   }
+}
+
+const xstring& lftp_ssl_session_cache::Find(const char *key)
+{
+   if(!loaded)
+      Load();
+   const char *v=Lookup(key);
+   if(!v || extract_expire(v)<=time(0))
+      return xstring::null;
+   const char *hex=strchr(v,':');
+   if(!hex)
+      return xstring::null;
+   return xstring::get_tmp(hex+1).hex_decode();
+}
+
+void lftp_ssl_session_cache::Store(const char *key,const void *data,size_t len)
+{
+   if(!loaded)
+      Load();
+   TimeIntervalR ttl(ResMgr::Query("ssl:session-cache-expire",0));
+   time_t expire=time(0)+(ttl.IsInfty()?10*365*DAY:ttl.Seconds());
+   xstring& v=xstring::format("%lu:",(unsigned long)expire);
+   xstring::get_tmp((const char*)data,len).hexdump_to(v);
+   Add(key,v);
+   if(file && !modified)
+      atexit(SaveAtExit);
+   modified=true;
+}
+
+void lftp_ssl_session_cache::Forget(const char *key)
+{
+   if(!Lookup(key))
+      return;
+   // keep an expired entry so that it replaces the saved one.
+   Add(key,"0:");
+   modified=true;
+}
+
+void lftp_ssl_session_cache::SaveAtExit()
+{
+   lftp_ssl_base::session_cache.Save();
+}
+
+void lftp_ssl_session_cache::Save()
+{
+   if(!file || !modified)
+      return;
+   modified=false;
+   int fd=open(file,O_RDWR|O_CREAT,0600);
+   if(fd==-1)
+      return;
+   fcntl(fd,F_SETFD,FD_CLOEXEC);
+   if(Lock(fd,F_WRLCK)==-1)
+   {
+      Log::global->Format(1,"%s: lock for writing failed\n",file.get());
+      close(fd);
+      return;
+   }
+
+   // merge with sessions saved by other processes.
+   lftp_ssl_session_cache saved;
+   saved.Read(dup(fd));	// Read closes fd
+   for(Pair *p=chain; p; p=p->next)
+      saved.Add(p->key,p->value);
+   saved.PurgeExpired();
+
+   lseek(fd,0,SEEK_SET);
+#ifdef HAVE_FTRUNCATE
+   if(ftruncate(fd,0)==-1) // note the following statement
+#endif
+   close(open(file,O_WRONLY|O_TRUNC));
+
+   saved.Write(fd);	// Write closes fd
+}
+
+const xstring& lftp_ssl_base::find_cached_session(const char *key)
+{
+   if(!key || !ResMgr::QueryBool("ssl:session-cache",hostname))
+      return xstring::null;
+   session_key.set(key);
+   return session_cache.Find(key);
+}
+void lftp_ssl_base::store_session(const void *data,size_t len)
+{
+   if(session_key && len>0)
+      session_cache.Store(session_key,data,len);
+}
+void lftp_ssl_base::forget_session()
+{
+   if(session_key)
+      session_cache.Forget(session_key);
+}
+
 #if USE_GNUTLS
 
 /* Helper functions to load a certificate and key
@@ -347,6 +469,8 @@ void lftp_ssl_gnutls::shutdown()
 }
 lftp_ssl_gnutls::~lftp_ssl_gnutls()
 {
+   // TLS 1.3 tickets come after the handshake, save the latest one.
+   save_session();
    if(cred)
       gnutls_certificate_free_credentials(cred);
    gnutls_deinit(session);
@@ -554,12 +678,22 @@ int lftp_ssl_gnutls::do_handshake()
       {
 	 fatal=check_fatal(res);
 	 set_error("gnutls_handshake",gnutls_strerror(res));
+	 forget_session();
 	 return ERROR;
       }
    }
    handshake_done=true;
    SMTask::current->Timeout(0);
 
+   if(gnutls_session_is_resumed(session))
+      Log::global->Format(9,"GNUTLS: resumed session for %s\n",session_key.get());
+   save_session();
+#if LFTP_LIBGNUTLS_VERSION_CODE >= 0x030200
+   gnutls_datum_t proto;
+   if(gnutls_alpn_get_selected_protocol(session,&proto)==GNUTLS_E_SUCCESS)
+      alpn.nset((const char*)proto.data,proto.size);
+#endif
+
    if(gnutls_certificate_type_get(session)!=GNUTLS_CRT_X509)
    {
       set_cert_error("Unsupported certificate type",xstring::null);
@@ -651,6 +785,43 @@ void lftp_ssl_gnutls::copy_sid(const lftp_ssl_gnutls *o)
       return;
    gnutls_session_set_data(session,session_data,session_data_size);
 }
+// protocols is a comma separated list in the order of preference.
+void lftp_ssl_gnutls::set_alpn(const char *protocols)
+{
+#if LFTP_LIBGNUTLS_VERSION_CODE >= 0x030200
+   gnutls_datum_t p[8];
+   unsigned n=0;
+   char *list=alloca_strdup(protocols);
+   for(char *s=strtok(list,","); s && n<8; s=strtok(0,","))
+   {
+      p[n].data=(unsigned char*)s;
+      p[n].size=strlen(s);
+      n++;
+   }
+   if(gnutls_alpn_set_protocols(session,p,n,0)<0)
+      Log::global->Format(0,"WARNING: failed to configure ALPN TLS extension\n");
+#endif
+}
+void lftp_ssl_gnutls::resume_session(const char *key)
+{
+   const xstring& data=find_cached_session(key);
+   if(data)
+      gnutls_session_set_data(session,data.get(),data.length());
+}
+void lftp_ssl_gnutls::save_session()
+{
+   if(!session_key || !handshake_done || error)
+      return;
+   size_t session_data_size=0;
+   int res=gnutls_session_get_data(session,NULL,&session_data_size);
+   if(res!=GNUTLS_E_SUCCESS && res!=GNUTLS_E_SHORT_MEMORY_BUFFER)
+      return;
+   xstring session_data;
+   session_data.get_space(session_data_size);
+   if(gnutls_session_get_data(session,session_data.get_non_const(),&session_data_size)!=GNUTLS_E_SUCCESS)
+      return;
+   store_session(session_data.get(),session_data_size);
+}
 
 #include <sha1.h>
 const xstring& lftp_ssl_gnutls::get_fp(gnutls_x509_crt_t cert)
@@ -845,17 +1016,19 @@ lftp_ssl_openssl_instance::lftp_ssl_openssl_instance()
 #endif
    ssl_ctx=SSL_CTX_new(SSLv23_client_method());
    long options=SSL_OP_ALL|SSL_OP_NO_TICKET|SSL_OP_NO_SSLv2;
+   bool tickets_set=false;
    const char *priority=ResMgr::Query("ssl:priority", 0);
    if(priority && *priority)
    {
       static const struct ssl_option {
-	 const char name[8];
+	 const char name[12];
 	 long option;
       } opt_table[]={
 	 {"-SSL3.0",SSL_OP_NO_SSLv3},
 	 {"-TLS1.0",SSL_OP_NO_TLSv1},
 	 {"-TLS1.1",SSL_OP_NO_TLSv1_1},
 	 {"-TLS1.2",SSL_OP_NO_TLSv1_2},
+	 {"%NO_TICKETS",SSL_OP_NO_TICKET},
 	 {"",0}
       };
       char *to_parse=alloca_strdup(priority);
@@ -867,12 +1040,23 @@ lftp_ssl_openssl_instance::lftp_ssl_openssl_instance()
 	 for(const ssl_option *opt=opt_table; opt->name[0]; opt++) {
 	    if(!strcmp(ptr,opt->name)) {
 	       options|=opt->option;
+	       if(opt->option==SSL_OP_NO_TICKET)
+		  tickets_set=true;
 	       Log::global->Format(9,"ssl: applied %s option\n",ptr);
 	       break;
 	    }
 	 }
       }
    }
+   if(ResMgr::QueryBool("ssl:session-cache",0))
+   {
+      // session tickets are needed for resumption with TLS 1.3,
+      // unless ssl:priority disables them.
+      if(!tickets_set)
+	 options&=~SSL_OP_NO_TICKET;
+      SSL_CTX_set_session_cache_mode(ssl_ctx,SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(ssl_ctx,lftp_ssl_openssl::new_session_callback);
+   }
    SSL_CTX_set_options(ssl_ctx, options);
    SSL_CTX_set_cipher_list(ssl_ctx, "ALL:!aNULL:!eNULL:!SSLv2:!LOW:!EXP:!MD5:@STRENGTH");
    SSL_CTX_set_verify(ssl_ctx,SSL_VERIFY_PEER,lftp_ssl_openssl::verify_callback);
@@ -931,6 +1115,13 @@ lftp_ssl_openssl::lftp_ssl_openssl(int fd1,handshake_mode_t m,const char *h)
 
    ssl=SSL_new(instance->ssl_ctx);
    SSL_set_fd(ssl,fd);
+   SSL_set_app_data(ssl,this);
+#ifdef SSL_OP_ENABLE_KTLS
+   // OpenSSL falls back to user space encryption by itself if kernel TLS
+   // is not available or the negotiated cipher is not supported by it.
+   if(ResMgr::QueryBool("ssl:ktls",h))
+      SSL_set_options(ssl,SSL_OP_ENABLE_KTLS);
+#endif
    SSL_ctrl(ssl,SSL_CTRL_MODE,SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER,0);
 
    if(h && ResMgr::QueryBool("ssl:use-sni",h)) {
@@ -1007,10 +1198,27 @@ int lftp_ssl_openssl::do_handshake()
       {
 	 fatal=check_fatal(res);
 	 set_error("SSL_connect",strerror());
+	 forget_session();
 	 return ERROR;
       }
    }
    handshake_done=true;
+   if(SSL_session_reused(ssl))
+      Log::global->Format(9,"ssl: resumed session for %s\n",session_key.get());
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+   const unsigned char *proto=0;
+   unsigned proto_len=0;
+   SSL_get0_alpn_selected(ssl,&proto,&proto_len);
+   if(proto_len>0)
+      alpn.nset((const char*)proto,proto_len);
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+   bool ktls_send=BIO_get_ktls_send(SSL_get_wbio(ssl));
+   bool ktls_recv=BIO_get_ktls_recv(SSL_get_rbio(ssl));
+   if(ktls_send || ktls_recv)
+      Log::global->Format(9,"ssl: kernel TLS enabled for%s%s\n",
+	 ktls_send?" send":"",ktls_recv?" receive":"");
+#endif
    check_certificate();
    SMTask::current->Timeout(0);
    return DONE;
@@ -1077,6 +1285,49 @@ void lftp_ssl_openssl::copy_sid(const lftp_ssl_openssl *o)
 {
    SSL_copy_session_id(ssl,o->ssl);
 }
+// protocols is a comma separated list in the order of preference.
+void lftp_ssl_openssl::set_alpn(const char *protocols)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+   // the wire format: each name is preceded by its length.
+   xstring wire;
+   char *list=alloca_strdup(protocols);
+   for(char *s=strtok(list,","); s; s=strtok(0,","))
+   {
+      wire.append(char(strlen(s)));
+      wire.append(s);
+   }
+   if(SSL_set_alpn_protos(ssl,(const unsigned char*)wire.get(),wire.length())!=0)
+      Log::global->Format(0,"WARNING: failed to configure ALPN TLS extension\n");
+#endif
+}
+void lftp_ssl_openssl::resume_session(const char *key)
+{
+   const xstring& data=find_cached_session(key);
+   if(!data)
+      return;
+   const unsigned char *p=(const unsigned char*)data.get();
+   SSL_SESSION *sess=d2i_SSL_SESSION(NULL,&p,data.length());
+   if(!sess)
+      return;
+   SSL_set_session(ssl,sess);
+   SSL_SESSION_free(sess);
+}
+int lftp_ssl_openssl::new_session_callback(SSL *ssl,SSL_SESSION *sess)
+{
+   lftp_ssl_openssl *o=(lftp_ssl_openssl*)SSL_get_app_data(ssl);
+   if(!o || !o->session_key)
+      return 0;
+   int len=i2d_SSL_SESSION(sess,NULL);
+   if(len<=0)
+      return 0;
+   xstring data;
+   data.get_space(len);
+   unsigned char *p=(unsigned char*)data.get_non_const();
+   i2d_SSL_SESSION(sess,&p);
+   o->store_session(data.get(),len);
+   return 0;   // the session is not kept
+}
 
 const char *lftp_ssl_openssl::strerror()
 {
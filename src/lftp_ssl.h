@@ -33,6 +33,30 @@
 
 #include "Ref.h"
 #include "xstring.h"
+#include "keyvalue.h"
+
+/* TLS session data of recent connections by host:port, used to resume
+   sessions instead of doing a full handshake (ssl:session-cache).
+   The cache can be kept in a file to be used by later lftp processes
+   (ssl:session-cache-file). Values are "expire_time:hex_data". */
+class lftp_ssl_session_cache : public KeyValueDB
+{
+   bool loaded;
+   bool modified;
+   xstring file;
+
+   static time_t extract_expire(const char *v) { return atol(v); }
+   void Load();
+   void PurgeExpired();
+   static void SaveAtExit();
+
+public:
+   lftp_ssl_session_cache() : loaded(false), modified(false) {}
+   const xstring& Find(const char *key);
+   void Store(const char *key,const void *data,size_t len);
+   void Forget(const char *key);
+   void Save();
+};
 
 class lftp_ssl_base
 {
@@ -40,10 +64,12 @@ public:
    bool handshake_done;
    int fd;
    xstring_c hostname;
+   xstring_c session_key;  // host:port for the session cache
    enum handshake_mode_t { CLIENT, SERVER } handshake_mode;
    xstring error;
    bool fatal;
    bool cert_error;
+   xstring_c alpn;   // the protocol the server has chosen with ALPN
 
    lftp_ssl_base(int fd,handshake_mode_t m,const char *host=0);
 
@@ -51,6 +77,11 @@ public:
 
    void set_error(const char *s1,const char *s2);
    void set_cert_error(const char *s,const xstring& fp);
+
+   static lftp_ssl_session_cache session_cache;
+   const xstring& find_cached_session(const char *key);
+   void store_session(const void *data,size_t len);
+   void forget_session();
 };
 
 #if USE_GNUTLS
@@ -109,6 +140,9 @@ public:
    bool want_in();
    bool want_out();
    void copy_sid(const lftp_ssl_gnutls *);
+   void set_alpn(const char *protocols);
+   void resume_session(const char *key);
+   void save_session();
    void load_keys();
    void shutdown();
 };
@@ -132,6 +166,7 @@ class lftp_ssl_openssl : public lftp_ssl_base
 public:
    static int verify_crl(X509_STORE_CTX *ctx);
    static int verify_callback(int ok,X509_STORE_CTX *ctx);
+   static int new_session_callback(SSL *ssl,SSL_SESSION *sess);
    void check_certificate();
 
    static void global_init();
@@ -145,6 +180,8 @@ public:
    bool want_in();
    bool want_out();
    void copy_sid(const lftp_ssl_openssl *);
+   void set_alpn(const char *protocols);
+   void resume_session(const char *key);
    void load_keys();
    void shutdown();
 };
@@ -80,13 +80,23 @@ int mkdirJob::Do()
       else
       {
 	 session=orig_session;
-	 session->Mkdir(curr,opt_p);
+	 if(!opt_p && session->BatchSupported(FA::MAKE_DIR))
+	    StartBatch();
+	 else
+	    session->Mkdir(curr,opt_p);
       }
    }
 
    int res=session->Done();
    if(res==FA::DO_AGAIN || res==FA::IN_PROGRESS)
       return STALL;
+   if(batch)
+   {
+      BatchDone(res);
+      session->Close();
+      curr=args->getnext();
+      return MOVED;
+   }
    if(res<0)
    {
       failed++;
@@ -99,6 +109,54 @@ int mkdirJob::Do()
    return MOVED;
 }
 
+// takes the current path and the following plain ones.
+void mkdirJob::StartBatch()
+{
+   batch=new FileSet;
+   for(;;)
+   {
+      FileInfo *fi=new FileInfo(curr);
+      fi->SetRank(batch->count());
+      batch->Add(fi);
+      const char *next=args->getnext();
+      if(!next || batch->count()>=BATCH_MAX || batch->FindByName(next)
+      || ParsedURL(next,true).proto)
+      {
+	 args->back();
+	 break;
+      }
+      curr=next;
+   }
+   batch->Sort(FileSet::BYRANK);
+   session->Batch(batch.get_non_const(),FA::MAKE_DIR);
+}
+
+void mkdirJob::BatchDone(int res)
+{
+   bool reported=false;
+   for(int i=0; i<batch->count(); i++)
+   {
+      int r=session->GetBatchResult(i);
+      if(r==FA::IN_PROGRESS)
+	 r=res;
+      file_count++;
+      if(r>=0)
+	 continue;
+      failed++;
+      const char *err=session->GetBatchError(i);
+      if(quiet)
+	 ;
+      else if(err)
+	 fprintf(stderr,"%s: %s: %s\n",args->getarg(0),(*batch)[i]->name.get(),err);
+      else if(!reported)
+      {
+	 fprintf(stderr,"%s: %s\n",args->getarg(0),session->StrError(r));
+	 reported=true;
+      }
+   }
+   batch=0;
+}
+
 xstring& mkdirJob::FormatStatus(xstring& s,int v,const char *prefix)
 {
    SessionJob::FormatStatus(s,v,prefix);
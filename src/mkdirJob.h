@@ -23,6 +23,7 @@
 #include "Job.h"
 #include "StatusLine.h"
 #include "ArgV.h"
+#include "FileSet.h"
 #include "trio.h"
 
 class mkdirJob : public SessionJob
@@ -35,6 +36,12 @@ class mkdirJob : public SessionJob
    bool	 quiet;
    bool	 opt_p;
 
+   // plain paths (without -p) go in one bulk request, see FileAccess::Batch.
+   enum { BATCH_MAX=256 };
+   Ref<FileSet> batch;
+   void StartBatch();
+   void BatchDone(int res);
+
 public:
    int	 Do();
    int	 Done() { return curr==0; }
@@ -139,6 +139,8 @@ void  mmvJob::SayFinal()
       printf(plural("%s: %d error$|s$ detected\n",error_count),cmd(),error_count);
    if(m==FA::RENAME)
       printf(plural("%s: %d file$|s$ moved\n",moved_count),cmd(),moved_count);
+   else if(m==FA::COPY)
+      printf(plural("%s: %d file$|s$ copied\n",moved_count),cmd(),moved_count);
    else
       printf(plural("%s: %d file$|s$ linked\n",moved_count),cmd(),moved_count);
 }
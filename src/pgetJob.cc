@@ -122,11 +122,11 @@ int pgetJob::Do()
       if(size==NO_SIZE_YET)
 	 return m;
 
-      if(size==NO_SIZE || (c->put && c->put->GetLocal()==0))
+      if(size==NO_SIZE || (RemoteTarget() && !ParallelPutSupported()))
       {
 	 Log::global->Write(0,_("pget: falling back to plain get"));
 	 Log::global->Write(0," (");
-	 if(c->put && c->put->GetLocal()==0)
+	 if(RemoteTarget() && !ParallelPutSupported())
 	 {
 	    Log::global->Write(0,_("the target file is remote"));
 	    if(size==NO_SIZE)
@@ -142,7 +142,8 @@ int pgetJob::Do()
 
       // Make sure the destination file is open before starting chunks,
       // it disables temp-name creation in the chunk's Init.
-      if(c->put->GetLocal()->getfd()==-1)
+      // A remote target is truncated on open, wait for the first write.
+      if(RemoteTarget() ? c->put->GetSeekPos()<=0 : c->put->GetLocal()->getfd()==-1)
 	 return m;
 
       c->put->NeedSeek(); // seek before writing
@@ -165,7 +166,7 @@ int pgetJob::Do()
       {
 	 SaveStatus();
 	 status_timer.Reset();
-	 if(ResMgr::QueryBool("file:use-fallocate",0)) {
+	 if(!RemoteTarget() && ResMgr::QueryBool("file:use-fallocate",0)) {
 	    // allocate space after creating *.lftp-pget-status file,
 	    // so that the incomplete status is more obvious.
 	    const Ref<FDStream>& local=c->put->GetLocal();
@@ -334,7 +335,13 @@ pgetJob::pgetJob(FileCopy *c1,const char *n,int m)
    total_eta=-1;
    status_timer.SetResource("pget:save-status",0);
    const Ref<FDStream>& local=c->put->GetLocal();
-   if(local && local->full_name)
+   if(!local)
+   {
+      // an upload is continued from the size of the target file.
+      c->SetContinue(pget_cont);
+      pget_cont=false;
+   }
+   else if(local->full_name)
    {
       status_file.vset(local->full_name.get(),".lftp-pget-status",NULL);
       if(pget_cont)
@@ -350,13 +357,25 @@ pgetJob::~pgetJob()
 {
 }
 
+bool pgetJob::ParallelPutSupported() const
+{
+   const FileAccessRef& session=c->put->GetSession();
+   return c->get->GetLocal() && session && session->ParallelStoreSupported();
+}
+
 pgetJob::ChunkXfer *pgetJob::NewChunk(const char *remote,off_t start,off_t limit)
 {
-   const Ref<FDStream>& local=c->put->GetLocal();
-   FileCopyPeerFDStream
-		*dst_peer=new FileCopyPeerFDStream(local,FileCopyPeer::PUT);
-   dst_peer->NeedSeek(); // seek before writing
-   dst_peer->SetBase(0);
+   FileCopyPeer *dst_peer;
+   if(RemoteTarget())
+      dst_peer=c->put->Clone();
+   else
+   {
+      const Ref<FDStream>& local=c->put->GetLocal();
+      FileCopyPeerFDStream *local_peer=new FileCopyPeerFDStream(local,FileCopyPeer::PUT);
+      local_peer->NeedSeek(); // seek before writing
+      local_peer->SetBase(0);
+      dst_peer=local_peer;
+   }
 
    FileCopy *c1=FileCopy::New(c->get->Clone(),dst_peer,false);
    c1->SetRange(start,limit);
@@ -52,6 +52,11 @@ class pgetJob : public CopyJob
    void free_chunks();
    ChunkXfer *NewChunk(const char *remote,off_t start,off_t limit);
 
+   // parallel upload: the source is local and the target session can
+   // write parts of the file from several connections.
+   bool RemoteTarget() const { return c->put->GetLocal()==0; }
+   bool ParallelPutSupported() const;
+
    long total_eta;
 
    Timer status_timer;
@@ -160,7 +160,7 @@ const char *OrderValidate(xstring_c *s)
 static const char *SortByValidate(xstring_c *s)
 {
    static const char * const valid_set[]={
-      "name", "name-desc", "size", "size-desc", "date", "date-desc", 0
+      "name", "name-desc", "size", "size-desc", "date", "date-desc", "balanced", 0
    };
    return SetValidate(*s,valid_set,"mirror:order-by");
 }
@@ -206,14 +206,17 @@ static ResType lftp_vars[] = {
    {"ftp:fix-pasv-address",	 "yes",   ResMgr::BoolValidate,0},
    {"ftp:ignore-pasv-address",	 "no",	  ResMgr::BoolValidate,0},
    {"ftp:fxp-force",		 "no",	  ResMgr::BoolValidate,0},
+   {"ftp:fxp-parallel",		 "4",	  ResMgr::UNumberValidate,0},
    {"ftp:fxp-passive-source",	 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"ftp:fxp-passive-sscn",	 "yes",   ResMgr::BoolValidate,ResMgr::NoClosure},
+   {"ftp:fxp-retry-interval",	 "10m",	  ResMgr::TimeIntervalValidate,0},
    {"ftp:home",			 "",	  0,0},
    {"ftp:site"			 "",	  0,0},
    {"ftp:site-group",		 "",	  0,0},
    {"ftp:lang",			 "",	  0,0},
    {"ftp:list-empty-ok",	 "no",	  0,0},
    {"ftp:list-options",		 "",	  0,0},
+   {"ftp:mode-z-adaptive",	 "yes",	  ResMgr::BoolValidate,0},
    {"ftp:mode-z-level",		 "6",	  ResMgr::UNumberValidate,0},
    {"ftp:nop-interval",		 "120",   ResMgr::UNumberValidate,0},
    {"ftp:passive-mode",		 "on",    ResMgr::BoolValidate,0},
@@ -297,11 +300,15 @@ static ResType lftp_vars[] = {
    {"http:cache",		 "yes",   ResMgr::BoolValidate,0},
    {"http:cache-control",	 "",	  0,0},
    {"http:decode",		 "yes",	  ResMgr::BoolValidate,0},
+   {"http:pipeline-depth",	 "0",	  ResMgr::UNumberValidate,0},
+   {"http:pool-idle",		 "30s",	  ResMgr::TimeIntervalValidate,0},
+   {"http:pool-max-idle",	 "4",	  ResMgr::UNumberValidate,0},
    {"http:proxy",		 "",	  HttpProxyValidate,0},
    {"http:use-mkcol",		 "yes",   ResMgr::BoolValidate,0},
    {"http:use-propfind",	 "no",    ResMgr::BoolValidate,0},
    {"http:use-range",		 "yes",   ResMgr::BoolValidate,0},
    {"http:use-allprop",		 "no",	  ResMgr::BoolValidate,0},
+   {"http:use-http2",		 "no",	  ResMgr::BoolValidate,0},
    {"http:user-agent",		 PACKAGE "/" VERSION,0,0},
    {"http:cookie",		 "",	  0,0},
    {"http:set-cookies",		 "no",	  0,0},
@@ -325,6 +332,9 @@ static ResType lftp_vars[] = {
    {"net:reconnect-interval-max","300",	  ResMgr::UNumberValidate,0},
    {"net:socket-buffer",	 "0",	  ResMgr::UNumberValidate,0},
    {"net:socket-maxseg",	 "0",	  ResMgr::UNumberValidate,0},
+   {"net:spare-sessions-idle",	 "30s",	  ResMgr::TimeIntervalValidate,0},
+   {"net:spare-sessions-max",	 "0",	  ResMgr::UNumberValidate,0},
+   {"net:spare-sessions-min",	 "0",	  ResMgr::UNumberValidate,0},
    {"net:socket-bind-ipv4",	 "",	  ResMgr::IPv4AddrValidate,0},
 #if INET6
    {"net:socket-bind-ipv6",	 "",	  ResMgr::IPv6AddrValidate,0},
@@ -334,10 +344,13 @@ static ResType lftp_vars[] = {
    {"net:connection-limit-timer","5m",	  ResMgr::TimeIntervalValidate,0},
    {"net:connection-takeover",	 "yes",   ResMgr::BoolValidate,0},
 
+   {"mirror:checksum-algo",	 "SHA-256,SHA-1,MD5,CRC32",0,ResMgr::NoClosure},
    {"mirror:sort-by",		 "name",  SortByValidate,ResMgr::NoClosure},
    {"mirror:order",		 "*.sfv *.sig *.md5* *.sum * */", 0,ResMgr::NoClosure},
    {"mirror:parallel-directories", "yes", ResMgr::BoolValidate,ResMgr::NoClosure},
    {"mirror:parallel-transfer-count", "0",ResMgr::UNumberValidate,0},
+   {"mirror:bulk-max-size",	 "1M",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
+   {"mirror:delta-min-size",	 "0",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
    {"mirror:exclude-regex",	 "(^|/)(\\.in\\.|\\.nfs)",ResMgr::ERegExpValidate,ResMgr::NoClosure},
    {"mirror:include-regex",	 "",	  ResMgr::ERegExpValidate,ResMgr::NoClosure},
    {"mirror:use-pget-n",	 "0",	  ResMgr::UNumberValidate,0},
@@ -347,18 +360,26 @@ static ResType lftp_vars[] = {
    {"mirror:no-empty-dirs",	 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"mirror:require-source",	 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"mirror:overwrite",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
+   {"mirror:fan-out-wait",	 "10s",	  ResMgr::TimeIntervalValidate,ResMgr::NoClosure},
+   {"mirror:watch-delay",	 "1s",	  ResMgr::TimeIntervalValidate,ResMgr::NoClosure},
+   {"mirror:watch-verify-interval","1h", ResMgr::TimeIntervalValidate,ResMgr::NoClosure},
 
    {"sftp:auto-confirm",	 "no",	  ResMgr::BoolValidate,0},
+   {"sftp:auto-window",		 "yes",	  ResMgr::BoolValidate,0},
    {"sftp:max-packets-in-flight","16",	  ResMgr::UNumberValidate,0},
+   {"sftp:max-window",		 "16M",	  ResMgr::UNumberValidate,0},
    {"sftp:protocol-version",	 "6",	  ResMgr::UNumberValidate,0},
    {"sftp:size-read",		 "32k",	  ResMgr::UNumberValidate,0},
    {"sftp:size-write",		 "32k",	  ResMgr::UNumberValidate,0},
+   {"sftp:space-check-size",	 "16M",	  ResMgr::UNumberValidate,0},
    {"sftp:connect-program",	 "ssh -a -x",0,0},
+   {"sftp:share-connection",	 "no",	  ResMgr::BoolValidate,0},
    {"sftp:server-program",	 "sftp",  0,0},
    {"sftp:charset",		 "",	  ResMgr::CharsetValidate,0},
    {"sftp:use-full-path",	 "yes",	  ResMgr::BoolValidate,0},
 
    {"file:charset",		 "",	  ResMgr::CharsetValidate,ResMgr::NoClosure},
+   {"file:parallel-checksums",	 "4",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
    {"file:use-lock",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"file:use-fallocate",	 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
 
@@ -383,6 +404,8 @@ static ResType lftp_vars[] = {
    {"fish:auto-confirm",	 "no",	  ResMgr::BoolValidate,0},
    {"fish:shell",		 "/bin/sh",0,0},
    {"fish:connect-program",	 "ssh -a -x",0,0},
+   {"fish:share-connection",	 "no",	  ResMgr::BoolValidate,0},
+   {"fish:bulk-transfer",	 "yes",	  ResMgr::BoolValidate,0},
    {"fish:charset",		 "",	  ResMgr::CharsetValidate,0},
 
    {"color:dir-colors",		 "",	  0,ResMgr::NoClosure},
@@ -415,7 +438,11 @@ static ResType lftp_vars[] = {
    {"ssl:verify-certificate",	 "yes",	  ResMgr::BoolValidate,0},
    {"ssl:use-sni",		 "yes",	  ResMgr::BoolValidate,0},
    {"ssl:priority",		 "",	  0,0},
+   {"ssl:session-cache",	 "no",	  ResMgr::BoolValidate,0},
+   {"ssl:session-cache-expire", "2h",	  ResMgr::TimeIntervalValidate,ResMgr::NoClosure},
+   {"ssl:session-cache-file",	 "",	  0,ResMgr::NoClosure},
 # if USE_OPENSSL
+   {"ssl:ktls",		 "no",	  ResMgr::BoolValidate,0},
    {"ssl:ca-path",		 "",	  ResMgr::DirReadable,ResMgr::NoClosure},
    {"ssl:crl-path",		 "",	  ResMgr::DirReadable,ResMgr::NoClosure},
 # endif
@@ -65,12 +65,16 @@ void  rmJob::SayFinal()
    }
 }
 
-void rmJob::TreatCurrent(const char *d, const FileInfo *fi)
+FA::open_mode rmJob::BatchMode(const FileInfo *fi,int *)
 {
    /* If we're recursing and this is a directory, rmdir it.  (If we're
     * not recursing, just send an rm and let it fail.) */
    if(recurse && (fi->defined&fi->TYPE) && (fi->filetype==fi->DIRECTORY))
-      session->Open(fi->name,FA::REMOVE_DIR);
-   else
-      session->Open(fi->name,mode);
+      return FA::REMOVE_DIR;
+   return mode;
+}
+
+void rmJob::TreatCurrent(const char *d, const FileInfo *fi)
+{
+   session->Open(fi->name,BatchMode(fi,0));
 }
@@ -25,6 +25,7 @@
 class rmJob : public TreatFileJob
 {
    void TreatCurrent(const char *, const FileInfo *);
+   FA::open_mode BatchMode(const FileInfo *fi,int *);
 
 protected:
    FA::open_mode mode;
@@ -0,0 +1,128 @@
+/*
+	Loopback SFTP download benchmark. lftp talks to a local sftp-server
+	directly (no ssh), and the CPU time lftp spends per byte is printed,
+	so that the receive path can be compared before and after a change.
+	Set SFTP_SERVER to the server program if it is not found.
+*/
+
+#include <config.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include "FileAccess.h"
+#include "log.h"
+
+char *program_name;
+
+static const char *find_server()
+{
+   static const char *const paths[]={
+      "/usr/lib/openssh/sftp-server",
+      "/usr/libexec/openssh/sftp-server",
+      "/usr/libexec/sftp-server",
+      "/usr/lib/ssh/sftp-server",
+      0
+   };
+   const char *env=getenv("SFTP_SERVER");
+   if(env)
+      return access(env,X_OK)==0?env:0;
+   for(int i=0; paths[i]; i++)
+      if(access(paths[i],X_OK)==0)
+	 return paths[i];
+   return 0;
+}
+
+static double cpu_time()
+{
+   struct rusage ru;
+   getrusage(RUSAGE_SELF,&ru);
+   return ru.ru_utime.tv_sec+ru.ru_stime.tv_sec
+      +(ru.ru_utime.tv_usec+ru.ru_stime.tv_usec)/1e6;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   const char *server=find_server();
+   if(!server)
+   {
+      fprintf(stderr,"sftp-server not found, skipping\n");
+      return 77;
+   }
+
+   const long long size=(argc>1?atoll(argv[1]):64)<<20;
+   char file[]="/tmp/lftp-sftp-get.XXXXXX";
+   int fd=mkstemp(file);
+   if(fd==-1)
+   {
+      perror("mkstemp");
+      return 1;
+   }
+   static char block[0x10000];
+   for(unsigned i=0; i<sizeof(block); i++)
+      block[i]=i*7;
+   for(long long left=size; left>0; left-=sizeof(block))
+   {
+      if(write(fd,block,sizeof(block))!=(int)sizeof(block))
+      {
+	 perror("write");
+	 unlink(file);
+	 return 1;
+      }
+   }
+   close(fd);
+
+   // the rest of the ssh command line is commented out.
+   ResMgr::Set("sftp:connect-program",0,xstring::cat("exec ",server," #",NULL));
+
+   FileAccess *f=FileAccess::New("sftp","localhost");
+   if(!f)
+   {
+      fprintf(stderr,"sftp: unknown protocol, cannot create sftp session\n");
+      unlink(file);
+      return 1;
+   }
+   f->Open(file,f->RETRIEVE);
+   Buffer buf;
+   long long got=0;
+   double start=cpu_time();
+   int rc=0;
+   for(;;)
+   {
+      SMTask::Schedule();
+
+      int res=f->Read(&buf,0x10000);
+      if(res<0)
+      {
+	 if(res==f->DO_AGAIN)
+	 {
+	    SMTask::Block();
+	    continue;
+	 }
+	 fprintf(stderr,"Error: %s\n",f->StrError(res));
+	 rc=1;
+	 break;
+      }
+      if(res==0) // eof
+	 break;
+      buf.SpaceAdd(res);
+      buf.Skip(res);
+      got+=res;
+   }
+   double cpu=cpu_time()-start;
+   f->Close();
+   SMTask::Delete(f);
+   unlink(file);
+   if(rc)
+      return rc;
+   if(got!=size)
+   {
+      fprintf(stderr,"got %lld bytes instead of %lld\n",got,size);
+      return 1;
+   }
+   printf("%lld bytes, %.3f s CPU, %.1f MB per CPU second\n",
+      got,cpu,cpu>0?got/cpu/(1<<20):0.0);
+   return 0;
+}